@@ -1,3 +1,8 @@
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
 #include "vast/batch.hpp"
 #include "vast/detail/assert.hpp"
 #include "vast/detail/byte_swap.hpp"
@@ -7,6 +12,161 @@
 
 namespace vast {
 
+constexpr size_t batch::columnar_block_events;
+
+namespace {
+
+// The encoding of a single column.
+enum class encoding : uint8_t {
+  generic,
+  delta,
+  dictionary
+};
+
+// Counts the leaf fields of a record type.
+size_t leaves(record_type const& rt) {
+  size_t result = 0;
+  for (auto& f : rt.fields) {
+    auto nested = get_if<record_type>(f.type);
+    result += nested ? leaves(*nested) : 1;
+  }
+  return result;
+}
+
+// Checks whether data has exactly the structure of a record type, so that we
+// can split it into columns and join it back together without loss.
+bool conforms(data const& x, record_type const& rt) {
+  auto xs = get_if<vector>(x);
+  if (!xs || xs->size() != rt.fields.size())
+    return false;
+  for (auto i = 0u; i < xs->size(); ++i)
+    if (auto nested = get_if<record_type>(rt.fields[i].type))
+      if (!conforms((*xs)[i], *nested))
+        return false;
+  return true;
+}
+
+// Appends the leaves of a conforming record to their columns.
+void split(data const& x, record_type const& rt, std::vector<vector>& columns,
+           size_t& column) {
+  auto& xs = *get_if<vector>(x);
+  for (auto i = 0u; i < xs.size(); ++i)
+    if (auto nested = get_if<record_type>(rt.fields[i].type))
+      split(xs[i], *nested, columns, column);
+    else
+      columns[column++].push_back(xs[i]);
+}
+
+// Reassembles the record in a given row from its leaves.
+vector join(record_type const& rt, std::vector<vector>& columns, size_t row,
+            size_t& column) {
+  vector result;
+  result.reserve(rt.fields.size());
+  for (auto& f : rt.fields)
+    if (auto nested = get_if<record_type>(f.type))
+      result.push_back(join(*nested, columns, row, column));
+    else
+      result.push_back(std::move(columns[column++][row]));
+  return result;
+}
+
+template <class Serializer>
+void encode_deltas(Serializer& sink, std::vector<int64_t>& xs) {
+  int64_t previous = 0;
+  for (auto& x : xs) {
+    auto current = x;
+    x -= previous;
+    previous = current;
+  }
+  sink << xs;
+}
+
+template <class Deserializer>
+std::vector<int64_t> decode_deltas(Deserializer& source) {
+  std::vector<int64_t> xs;
+  source >> xs;
+  int64_t previous = 0;
+  for (auto& x : xs)
+    previous = x += previous;
+  return xs;
+}
+
+// Chooses the most compact encoding for a column and writes it.
+template <class Serializer>
+void encode(Serializer& sink, vector const& xs) {
+  auto all = [&](auto pred) { return std::all_of(xs.begin(), xs.end(), pred); };
+  auto is_timestamp = [](auto& x) { return is<timestamp>(x); };
+  auto is_string = [](auto& x) { return is<none>(x) || is<std::string>(x); };
+  if (all(is_timestamp)) {
+    sink << static_cast<uint8_t>(encoding::delta);
+    std::vector<int64_t> ts;
+    ts.reserve(xs.size());
+    for (auto& x : xs)
+      ts.push_back(get_if<timestamp>(x)->time_since_epoch().count());
+    encode_deltas(sink, ts);
+  } else if (all(is_string)) {
+    sink << static_cast<uint8_t>(encoding::dictionary);
+    // Index 0 stands for nil, all others for the string at index - 1.
+    std::vector<std::string> dictionary;
+    std::unordered_map<std::string, uint32_t> indices;
+    std::vector<uint32_t> column;
+    column.reserve(xs.size());
+    for (auto& x : xs) {
+      auto str = get_if<std::string>(x);
+      if (!str) {
+        column.push_back(0);
+        continue;
+      }
+      auto i = indices.find(*str);
+      if (i == indices.end()) {
+        dictionary.push_back(*str);
+        auto index = static_cast<uint32_t>(dictionary.size());
+        i = indices.emplace(*str, index).first;
+      }
+      column.push_back(i->second);
+    }
+    sink << dictionary << column;
+  } else {
+    sink << static_cast<uint8_t>(encoding::generic) << xs;
+  }
+}
+
+template <class Deserializer>
+vector decode(Deserializer& source) {
+  uint8_t tag;
+  source >> tag;
+  vector result;
+  switch (static_cast<encoding>(tag)) {
+    default:
+      throw std::runtime_error("invalid column encoding");
+    case encoding::generic:
+      source >> result;
+      break;
+    case encoding::delta: {
+      auto ts = decode_deltas(source);
+      result.reserve(ts.size());
+      for (auto t : ts)
+        result.emplace_back(timestamp{timespan{t}});
+      break;
+    }
+    case encoding::dictionary: {
+      std::vector<std::string> dictionary;
+      std::vector<uint32_t> column;
+      source >> dictionary >> column;
+      result.reserve(column.size());
+      for (auto i : column) {
+        if (i > dictionary.size())
+          throw std::runtime_error("invalid dictionary index");
+        result.push_back(i == 0 ? data{} : data{dictionary[i - 1]});
+      }
+      break;
+    }
+  }
+  return result;
+}
+
+} // namespace <anonymous>
+
 bool batch::ids(event_id begin, event_id end) {
   if (end - begin != events())
     return false;
@@ -32,16 +192,40 @@ batch::size_type batch::events() const {
   return events_;
 }
 
+timestamp batch::earliest() const {
+  return first_;
+}
+
+timestamp batch::latest() const {
+  return last_;
+}
+
+std::vector<type> const& batch::types() const {
+  return types_;
+}
+
+void batch::types(std::vector<type> xs) {
+  types_ = std::move(xs);
+}
+
 uint64_t bytes(batch const& b) {
-  return sizeof(b.method_) + sizeof(b.first_) + sizeof(b.last_) +
-    sizeof(b.events_) + sizeof(b.ids_) + sizeof(b.data_) + b.data_.size();
+  return sizeof(b.method_) + sizeof(b.layout_) + sizeof(b.first_) +
+    sizeof(b.last_) + sizeof(b.events_) + sizeof(b.ids_) + sizeof(b.types_) +
+    sizeof(b.blocks_) + b.blocks_.size() * sizeof(batch::block) +
+    sizeof(b.data_) + b.data_.size();
 }
 
-batch::writer::writer(compression method)
-  : vectorbuf_{batch_.data_},
-    compressedbuf_{vectorbuf_, method},
+batch::writer::writer(compression method, size_t block_size, layout l,
+                      int level, std::vector<char> const* dictionary)
+  : block_size_{block_size},
+    vectorbuf_{batch_.data_},
+    // We give the compressed streambuffer some head room so that it rarely
+    // needs to cut a block in the middle of an event.
+    compressedbuf_{vectorbuf_, method, 2 * block_size, level, dictionary},
     serializer_{compressedbuf_} {
+  VAST_ASSERT(block_size > 0);
   batch_.method_ = method;
+  batch_.layout_ = l;
 }
 
 bool batch::writer::write(event const& e) {
@@ -50,38 +234,129 @@ bool batch::writer::write(event const& e) {
     batch_.first_ = e.timestamp();
   if (e.timestamp() > batch_.last_)
     batch_.last_ = e.timestamp();
-  // Write type.
+  // Register type.
   auto t = type_cache_.find(e.type());
   if (t == type_cache_.end()) {
-    auto type_id = static_cast<uint32_t>(type_cache_.size());
-    type_cache_.emplace(e.type(), type_id);
-    serializer_ << type_id << e.type();
-  } else {
-    serializer_ << t->second;
+    auto type_id = static_cast<uint32_t>(batch_.types_.size());
+    t = type_cache_.emplace(e.type(), type_id).first;
+    batch_.types_.push_back(e.type());
   }
-  serializer_ << e.timestamp() << e.data();
   ++batch_.events_;
+  if (batch_.layout_ == layout::columnar) {
+    buffered_types_.push_back(t->second);
+    buffered_events_.push_back(e);
+    if (buffered_events_.size() == columnar_block_events)
+      return write_columns();
+    return true;
+  }
+  serializer_ << t->second << e.timestamp() << e.data();
+  // Begin a new block at this event boundary once we have accumulated enough
+  // data. Because types live outside the compressed stream, a reader can
+  // start decompressing at any such block.
+  if (compressedbuf_.pending() >= block_size_) {
+    if (compressedbuf_.pubsync() < 0)
+      return false;
+    batch_.blocks_.push_back({batch_.events_, batch_.data_.size()});
+  }
+  return true;
+}
+
+// A columnar block begins with the type IDs and timestamps of all events,
+// followed by the data of each type that occurs in the block, in the order of
+// type IDs. The data of a record type consists of one column per leaf field
+// if all its events have the structure of the record, and of a single column
+// with the entire event data otherwise.
+bool batch::writer::write_columns() {
+  if (buffered_events_.empty())
+    return true;
+  auto n = buffered_events_.size();
+  std::vector<int64_t> timestamps;
+  timestamps.reserve(n);
+  for (auto& e : buffered_events_)
+    timestamps.push_back(e.timestamp().time_since_epoch().count());
+  serializer_ << buffered_types_;
+  encode_deltas(serializer_, timestamps);
+  auto type_ids = buffered_types_;
+  std::sort(type_ids.begin(), type_ids.end());
+  type_ids.erase(std::unique(type_ids.begin(), type_ids.end()),
+                 type_ids.end());
+  for (auto type_id : type_ids) {
+    std::vector<event const*> rows;
+    for (auto i = 0u; i < n; ++i)
+      if (buffered_types_[i] == type_id)
+        rows.push_back(&buffered_events_[i]);
+    auto rt = get_if<record_type>(batch_.types_[type_id]);
+    auto split_rows = rt != nullptr;
+    for (auto i = 0u; split_rows && i < rows.size(); ++i)
+      split_rows = conforms(rows[i]->data(), *rt);
+    serializer_ << split_rows;
+    if (split_rows) {
+      std::vector<vector> columns(leaves(*rt));
+      for (auto& column : columns)
+        column.reserve(rows.size());
+      for (auto row : rows) {
+        size_t column = 0;
+        split(row->data(), *rt, columns, column);
+      }
+      for (auto& column : columns)
+        encode(serializer_, column);
+    } else {
+      vector column;
+      column.reserve(rows.size());
+      for (auto row : rows)
+        column.push_back(row->data());
+      encode(serializer_, column);
+    }
+  }
+  buffered_types_.clear();
+  buffered_events_.clear();
+  // Each columnar block is also a compressed block.
+  if (compressedbuf_.pubsync() < 0)
+    return false;
+  batch_.blocks_.push_back({batch_.events_, batch_.data_.size()});
   return true;
 }
 
 batch batch::writer::seal() {
+  // Encode the remaining events of a columnar batch.
+  auto columns = write_columns();
+  VAST_ASSERT(columns);
   auto n = compressedbuf_.pubsync();
   VAST_ASSERT(n >= 0);
+  // Don't keep a trailing block without any events.
+  if (!batch_.blocks_.empty() && batch_.blocks_.back().events == batch_.events_)
+    batch_.blocks_.pop_back();
   auto result = std::move(batch_);
   // Prepare for the next batch.
   batch_ = batch{};
   batch_.method_ = result.method_;
+  batch_.layout_ = result.layout_;
+  type_cache_.clear();
   vectorbuf_ = caf::vectorbuf{batch_.data_};
   return result;
 }
 
-batch::reader::reader(batch const& b)
-  : data_{b.data_},
+batch::reader::input::input(char const* data, size_t size,
+                            compression method,
+                            std::vector<char> const* dictionary)
+  : charbuf{const_cast<char*>(data), size},
+    compressedbuf{charbuf, method, detail::compressedbuf::default_block_size,
+                  0, dictionary},
+    deserializer{compressedbuf} {
+}
+
+batch::reader::reader(batch const& b) : reader{b, b.types_} {
+}
+
+batch::reader::reader(batch const& b, std::vector<type> const& types,
+                      std::vector<char> const* dictionary)
+  : batch_{b},
+    types_{types},
+    dictionary_{dictionary},
     id_range_{bit_range(b.ids_)},
     available_{b.events()},
-    charbuf_{const_cast<char*>(data_.data()), data_.size()},
-    compressedbuf_{charbuf_, b.method_},
-    deserializer_{compressedbuf_} {
+    input_{std::make_unique<input>(b.data_.data(), b.data_.size(),
+                                   b.method_, dictionary)} {
 }
 
 expected<std::vector<event>> batch::reader::read() {
@@ -96,80 +371,156 @@ expected<std::vector<event>> batch::reader::read() {
 }
 
 expected<std::vector<event>> batch::reader::read(const bitmap& ids) {
-  using word = typename bitmap::word_type;
   auto result = std::vector<event>{};
-  if (id_range_.done())
-    return result;
-  auto e = expected<event>{make_error(ec::unspecified)};
-  auto n = event_id{0};
-  auto rng = bit_range(ids);
-  auto begin = rng.begin();
-  auto end = rng.end();
-  auto next = [&](auto bits, auto id) {
-    auto i = bits.find_next(id - n);
-    if (i != word::npos)
-      i += n;
-    return i;
-  };
-  for ( ; begin != end; n += begin->size(), ++begin) {
-    auto& bits = *begin;
-    auto first = bits.find_first();
-    if (first == word::npos)
-      continue;
-    auto id = n + first;
-    // If a previously materialized event is ahead, we must catch up first.
-    if (e && id < e->id()) {
-      id = next(bits, e->id() - 1);
-      if (id == e->id()) {
-        result.push_back(std::move(*e));
-        id = next(bits, id);
-      }
+  auto hits = select(ids);
+  // Walk through the requested IDs in lock-step with the IDs of the batch.
+  while (hits && available_ > 0 && !id_range_.done()) {
+    auto next = id_range_.get();
+    if (hits.get() < next) {
+      // The requested ID is not in the batch, catch up with the batch.
+      hits.skip(next - hits.get());
+    } else if (hits.get() > next) {
+      // Skip over all events until the requested ID.
+      auto r = seek(hits.get());
+      if (!r)
+        return r.error();
+    } else {
+      auto e = materialize();
+      if (!e)
+        return e.error();
+      result.push_back(std::move(*e));
+      hits.next();
     }
-    while (id != word::npos) {
-      // Materialize events until have the one we want.
-      do {
-        e = materialize();
-        if (!e) {
-          if (e.error() == ec::end_of_input) // No more events.
-            return result;
-          else
-            return e.error();
+  }
+  return result;
+}
+
+expected<void> batch::reader::seek(event_id id) {
+  // Compute the position of the first event with an ID not less than *id*,
+  // i.e., the number of batch IDs in [0, id).
+  auto& ids = batch_.ids_;
+  auto target = size_type{0};
+  if (id >= ids.size())
+    target = rank(ids);
+  else if (id > 1)
+    target = rank(ids, id - 1);
+  else if (id == 1)
+    target = select(ids, 1) == 0 ? 1 : 0;
+  auto position = batch_.events_ - available_;
+  if (target <= position)
+    return {};
+  if (target >= batch_.events_) {
+    available_ = 0;
+    return {};
+  }
+  // Jump to the last block that begins at or before the target, unless we're
+  // already in it.
+  auto& blocks = batch_.blocks_;
+  auto before = [](size_type x, block const& b) { return x < b.events; };
+  auto i = std::upper_bound(blocks.begin(), blocks.end(), target, before);
+  if (i != blocks.begin() && (--i)->events > position) {
+    auto data = batch_.data_.data() + i->offset;
+    auto size = batch_.data_.size() - i->offset;
+    input_ = std::make_unique<input>(data, size, batch_.method_,
+                                     dictionary_);
+    block_.clear();
+    block_position_ = 0;
+    id_range_.next(i->events - position);
+    available_ = batch_.events_ - i->events;
+    position = i->events;
+  }
+  // Materialize and discard the remaining events within the block.
+  for (; position < target; ++position) {
+    auto e = materialize();
+    if (!e)
+      return e.error();
+  }
+  return {};
+}
+
+expected<void> batch::reader::read_columns() {
+  block_.clear();
+  block_position_ = 0;
+  try {
+    std::vector<uint32_t> type_ids;
+    input_->deserializer >> type_ids;
+    auto timestamps = decode_deltas(input_->deserializer);
+    auto n = type_ids.size();
+    if (n == 0 || timestamps.size() != n)
+      return make_error(ec::unspecified, "invalid columnar block");
+    block_.resize(n);
+    auto distinct = type_ids;
+    std::sort(distinct.begin(), distinct.end());
+    distinct.erase(std::unique(distinct.begin(), distinct.end()),
+                   distinct.end());
+    for (auto type_id : distinct) {
+      if (type_id >= types_.size())
+        return make_error(ec::unspecified, "invalid type ID", type_id);
+      auto& t = types_[type_id];
+      std::vector<size_t> rows;
+      for (auto i = 0u; i < n; ++i)
+        if (type_ids[i] == type_id)
+          rows.push_back(i);
+      bool split_rows;
+      input_->deserializer >> split_rows;
+      if (split_rows) {
+        auto rt = get_if<record_type>(t);
+        if (!rt)
+          return make_error(ec::unspecified, "columns for non-record type");
+        std::vector<vector> columns;
+        for (auto i = leaves(*rt); i > 0; --i) {
+          columns.push_back(decode(input_->deserializer));
+          if (columns.back().size() != rows.size())
+            return make_error(ec::unspecified, "invalid column size");
         }
-        VAST_ASSERT(e->id() != invalid_event_id);
-      } while (id > e->id());
-      // If the materialized event is ahead, see if the current bit sequence
-      // has the event ID.
-      if (id < e->id())
-        id = next(bits, e->id() - 1);
-      // If we have materialized the event we want, add it to the result.
-      if (id == e->id()) {
-        result.push_back(std::move(*e));
-        id = next(bits, id);
+        for (auto i = 0u; i < rows.size(); ++i) {
+          size_t column = 0;
+          block_[rows[i]] = event{{join(*rt, columns, i, column), t}};
+        }
+      } else {
+        auto column = decode(input_->deserializer);
+        if (column.size() != rows.size())
+          return make_error(ec::unspecified, "invalid column size");
+        for (auto i = 0u; i < rows.size(); ++i)
+          block_[rows[i]] = event{{std::move(column[i]), t}};
       }
     }
+    for (auto i = 0u; i < n; ++i)
+      block_[i].timestamp(timestamp{timespan{timestamps[i]}});
+  } catch (std::runtime_error const& e) {
+    return make_error(ec::unspecified, e.what());
   }
-  return result;
+  return {};
 }
 
 expected<event> batch::reader::materialize() {
   if (available_ == 0)
     return make_error(ec::end_of_input);
   --available_;
+  if (batch_.layout_ == layout::columnar) {
+    if (block_position_ == block_.size()) {
+      auto r = read_columns();
+      if (!r)
+        return r.error();
+    }
+    auto e = std::move(block_[block_position_++]);
+    if (!id_range_.done()) {
+      e.id(id_range_.get());
+      id_range_.next();
+    }
+    return e;
+  }
   try {
     // Read type.
     uint32_t type_id;
-    deserializer_ >> type_id;
-    auto t = type_cache_.find(type_id);
-    if (t == type_cache_.end()) {
-      type new_type;
-      deserializer_ >> new_type;
-      t = type_cache_.emplace(type_id, std::move(new_type)).first;
-    }
+    input_->deserializer >> type_id;
+    if (type_id >= types_.size())
+      return make_error(ec::unspecified, "invalid type ID", type_id);
     // Read event timestamp and data.
     timestamp ts;
     data d;
-    deserializer_ >> ts >> d;
-    event e{{std::move(d), t->second}};
+    input_->deserializer >> ts >> d;
+    event e{{std::move(d), types_[type_id]}};
     // Assign an event ID.
     if (!id_range_.done()) {
       e.id(id_range_.get());
@@ -1,4 +1,5 @@
 #include "lz4/lz4.h"
+#include "lz4/lz4hc.h"
 
 #include "vast/compression.hpp"
 #include "vast/die.hpp"
@@ -18,11 +19,42 @@ size_t compress(char const* in, size_t in_size, char* out, size_t out_size) {
   return LZ4_compress_default(in, out, in_size, out_size);
 }
 
+size_t compress(char const* in, size_t in_size, char* out, size_t out_size,
+                int level, char const* dict, size_t dict_size) {
+  auto n = 0;
+  if (level > 0) {
+    if (dict == nullptr)
+      return LZ4_compress_HC(in, out, in_size, out_size, level);
+    auto stream = LZ4_createStreamHC();
+    LZ4_resetStreamHC(stream, level);
+    LZ4_loadDictHC(stream, dict, dict_size);
+    n = LZ4_compress_HC_continue(stream, in, out, in_size, out_size);
+    LZ4_freeStreamHC(stream);
+  } else {
+    if (dict == nullptr)
+      return compress(in, in_size, out, out_size);
+    auto stream = LZ4_createStream();
+    LZ4_loadDict(stream, dict, dict_size);
+    n = LZ4_compress_fast_continue(stream, in, out, in_size, out_size, 1);
+    LZ4_freeStream(stream);
+  }
+  return n;
+}
+
 size_t uncompress(char const* in, size_t in_size, char* out, size_t out_size) {
   return LZ4_decompress_safe(in, out, static_cast<int>(in_size),
                              static_cast<int>(out_size));
 }
 
+size_t uncompress(char const* in, size_t in_size, char* out, size_t out_size,
+                  char const* dict, size_t dict_size) {
+  if (dict == nullptr)
+    return uncompress(in, in_size, out, out_size);
+  return LZ4_decompress_safe_usingDict(in, out, static_cast<int>(in_size),
+                                       static_cast<int>(out_size), dict,
+                                       static_cast<int>(dict_size));
+}
+
 } // namespace lz4
 
 #ifdef VAST_HAVE_SNAPPY
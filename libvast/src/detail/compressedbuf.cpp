@@ -1,4 +1,7 @@
+#include <algorithm>
+#include <atomic>
 #include <cstring>
+#include <thread>
 
 #include "vast/detail/assert.hpp"
 #include "vast/detail/byte_swap.hpp"
@@ -7,57 +10,75 @@
 
 namespace vast {
 namespace detail {
+namespace {
+
+// The number of helper threads that may compress blocks at the same time,
+// shared by all streambuffers of the process. A writer that finds no idle
+// helper compresses its blocks itself, so that many concurrent writers never
+// start more threads than there are cores.
+std::atomic<size_t> idle_helpers{
+  std::max(std::thread::hardware_concurrency(), 1u) - 1};
+
+// Reserves up to *n* helpers and returns how many we got.
+size_t acquire_helpers(size_t n) {
+  auto idle = idle_helpers.load();
+  size_t k;
+  do {
+    k = std::min(n, idle);
+    if (k == 0)
+      return 0;
+  } while (!idle_helpers.compare_exchange_weak(idle, idle - k));
+  return k;
+}
+
+void release_helpers(size_t n) {
+  idle_helpers += n;
+}
+
+} // namespace <anonymous>
 
 compressedbuf::compressedbuf(std::streambuf& sb, compression method,
-                            size_t block_size)
+                            size_t block_size, int level,
+                            std::vector<char> const* dictionary,
+                            size_t threads)
   : streambuf_{sb},
     method_{method},
-    block_size_{block_size} {
+    block_size_{block_size},
+    level_{level},
+    dictionary_{dictionary && !dictionary->empty() ? dictionary : nullptr},
+    threads_{threads > 0 ? threads : std::thread::hardware_concurrency()},
+    blocks_(1) {
   VAST_ASSERT(block_size > 0);
-  compressed_.resize(block_size_);
-  uncompressed_.resize(block_size_);
-  setp(uncompressed_.data(), uncompressed_.data() + uncompressed_.size());
+  if (threads_ == 0)
+    threads_ = 1;
+  blocks_[0].compressed.resize(block_size_);
+  blocks_[0].uncompressed.resize(block_size_);
+  auto& put = blocks_[0].uncompressed;
+  setp(put.data(), put.data() + put.size());
+}
+
+size_t compressedbuf::pending() const {
+  return pptr() - pbase();
 }
 
 int compressedbuf::sync() {
   if (pbase() == nullptr)
     return -1;
-  if (uncompressed_.empty())
-    return 0;
-  size_t uncompressed_size = pptr() - pbase();
-  uncompressed_.resize(uncompressed_size);
-  compress();
-  auto total = 0;
-  // Write header.
-  char size[16];
-  auto n = varbyte::encode(uncompressed_size, size);
-  size_t put = streambuf_.sputn(size, n);
-  if (put != n)
-    return -1;
-  total += put;
-  n = varbyte::encode(compressed_.size(), size);
-  put = streambuf_.sputn(size, n);
-  if (put != n)
-    return -1;
-  total += put;
-  // Write data block.
-  put = streambuf_.sputn(compressed_.data(), compressed_.size());
-  if (put != compressed_.size())
-    return -1;
-  total += put;
-  // Reset put area.
-  setp(uncompressed_.data(), uncompressed_.data() + uncompressed_.size());
-  return total;
+  // Never write empty blocks, the reading side cannot handle them.
+  if (pptr() != pbase()) {
+    blocks_[full_].uncompressed.resize(pptr() - pbase());
+    ++full_;
+  }
+  return write_blocks();
 }
 
 compressedbuf::int_type compressedbuf::overflow(int_type c) {
   // Handle given character.
   if (traits_type::eq_int_type(c, traits_type::eof()))
     return traits_type::not_eof(c);
-  auto bytes = sync();
-  if (bytes < 0)
+  if (!next_block())
     return traits_type::eof(); // indicates failure
-  uncompressed_[0] = traits_type::to_char_type(c);
+  *pptr() = traits_type::to_char_type(c);
   pbump(1);
   return c;
 }
@@ -104,18 +125,19 @@ compressedbuf::int_type compressedbuf::underflow() {
     return traits_type::eof();
   varbyte::decode(compressed_size, size);
   // Adjust buffers.
-  uncompressed_.resize(uncompressed_size);
-  compressed_.resize(compressed_size);
+  auto& b = blocks_[0];
+  b.uncompressed.resize(uncompressed_size);
+  b.compressed.resize(compressed_size);
   // Retrieve compressed data block.
-  size_t got = streambuf_.sgetn(compressed_.data(), compressed_size);
+  size_t got = streambuf_.sgetn(b.compressed.data(), compressed_size);
   if (got != compressed_size)
     return traits_type::eof();
   // Uncompress data.
-  uncompress();
+  uncompress(b);
   // Reset get area.
-  setg(uncompressed_.data(),
-       uncompressed_.data(),
-       uncompressed_.data() + uncompressed_.size());
+  setg(b.uncompressed.data(),
+       b.uncompressed.data(),
+       b.uncompressed.data() + b.uncompressed.size());
   return traits_type::to_int_type(*gptr());
 }
 
@@ -140,59 +162,125 @@ std::streamsize compressedbuf::xsgetn(char_type* s, std::streamsize n) {
   return got;
 }
 
-void compressedbuf::compress() {
+bool compressedbuf::next_block() {
+  // The put area is full at this point.
+  ++full_;
+  if (full_ == threads_ && write_blocks() < 0)
+    return false;
+  if (full_ == blocks_.size())
+    blocks_.emplace_back();
+  auto& put = blocks_[full_].uncompressed;
+  put.resize(block_size_);
+  setp(put.data(), put.data() + put.size());
+  return true;
+}
+
+int compressedbuf::write_blocks() {
+  if (full_ == 0)
+    return 0;
+  // Distribute the blocks round-robin over ourselves and as many helpers as
+  // are idle.
+  auto helpers = acquire_helpers(full_ - 1);
+  auto stride = helpers + 1;
+  auto work = [this, stride](size_t first) {
+    for (auto i = first; i < full_; i += stride)
+      compress(blocks_[i]);
+  };
+  std::vector<std::thread> workers;
+  workers.reserve(helpers);
+  for (auto i = 1u; i <= helpers; ++i)
+    workers.emplace_back(work, i);
+  work(0);
+  for (auto& t : workers)
+    t.join();
+  release_helpers(helpers);
+  auto total = 0;
+  for (auto i = 0u; i < full_; ++i) {
+    auto& b = blocks_[i];
+    // Write header.
+    char size[16];
+    auto n = varbyte::encode(b.uncompressed.size(), size);
+    size_t put = streambuf_.sputn(size, n);
+    if (put != n)
+      return -1;
+    total += put;
+    n = varbyte::encode(b.compressed.size(), size);
+    put = streambuf_.sputn(size, n);
+    if (put != n)
+      return -1;
+    total += put;
+    // Write data block.
+    put = streambuf_.sputn(b.compressed.data(), b.compressed.size());
+    if (put != b.compressed.size())
+      return -1;
+    total += put;
+    b.uncompressed.resize(block_size_);
+  }
+  // Reset put area.
+  full_ = 0;
+  auto& put = blocks_[0].uncompressed;
+  setp(put.data(), put.data() + put.size());
+  return total;
+}
+
+void compressedbuf::compress(block& b) const {
+  auto& in = b.uncompressed;
+  auto& out = b.compressed;
   size_t n = 0;
   switch (method_) {
     case compression::null:
-      compressed_.resize(uncompressed_.size());
-      std::memcpy(compressed_.data(), uncompressed_.data(),
-                  uncompressed_.size());
-      n = uncompressed_.size();
+      out.resize(in.size());
+      std::memcpy(out.data(), in.data(), in.size());
+      n = in.size();
       break;
     case compression::lz4: {
-      compressed_.resize(lz4::compress_bound(uncompressed_.size()));
-      n = lz4::compress(uncompressed_.data(), uncompressed_.size(),
-                        compressed_.data(), compressed_.size());
+      out.resize(lz4::compress_bound(in.size()));
+      auto dict = dictionary_ ? dictionary_->data() : nullptr;
+      auto dict_size = dictionary_ ? dictionary_->size() : 0;
+      n = lz4::compress(in.data(), in.size(), out.data(), out.size(), level_,
+                        dict, dict_size);
       break;
     }
 #ifdef VAST_HAVE_SNAPPY
     case compression::snappy: {
-      compressed_.resize(snappy::compress_bound(uncompressed_.size()));
-      n = snappy::compress(pbase(), uncompressed_.size(), compressed_.data());
+      out.resize(snappy::compress_bound(in.size()));
+      n = snappy::compress(in.data(), in.size(), out.data());
       break;
     }
 #endif // VAST_HAVE_SNAPPY
   }
-  compressed_.resize(n);
-  uncompressed_.resize(block_size_);
+  out.resize(n);
 }
 
-void compressedbuf::uncompress() {
+void compressedbuf::uncompress(block& b) const {
+  auto& in = b.compressed;
+  auto& out = b.uncompressed;
   size_t n = 0;
   switch (method_) {
     case compression::null: {
-      std::memcpy(uncompressed_.data(), compressed_.data(), compressed_.size());
-      n = compressed_.size();
+      std::memcpy(out.data(), in.data(), in.size());
+      n = in.size();
       break;
     }
     case compression::lz4: {
-      n = lz4::uncompress(compressed_.data(), compressed_.size(),
-                          uncompressed_.data(), uncompressed_.size());
+      auto dict = dictionary_ ? dictionary_->data() : nullptr;
+      auto dict_size = dictionary_ ? dictionary_->size() : 0;
+      n = lz4::uncompress(in.data(), in.size(), out.data(), out.size(), dict,
+                          dict_size);
       break;
     }
 #ifdef VAST_HAVE_SNAPPY
     case compression::snappy: {
-      auto success = snappy::uncompress(compressed_.data(), compressed_.size(),
-                                        uncompressed_.data());
+      auto success = snappy::uncompress(in.data(), in.size(), out.data());
       VAST_ASSERT(success);
-      n = snappy::uncompress_bound(compressed_.data(), compressed_.size());
+      n = snappy::uncompress_bound(in.data(), in.size());
       break;
     }
 #endif // VAST_HAVE_SNAPPY
   }
   VAST_ASSERT(n > 0);
-  uncompressed_.resize(n);
-  compressed_.resize(block_size_);
+  out.resize(n);
+  in.resize(block_size_);
 }
 
 } // namespace detail
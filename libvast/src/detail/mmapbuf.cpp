@@ -3,6 +3,7 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 
+#include <algorithm>
 #include <cstdio>
 #include <cstring>
 
@@ -32,7 +33,7 @@ mmapbuf::mmapbuf(const std::string& filename, size_t size)
 }
 
 mmapbuf::~mmapbuf() {
-  if (!map_)
+  if (map_)
     ::munmap(map_, size_);
   if (fd_ != -1)
     ::close(fd_);
@@ -42,6 +43,25 @@ size_t mmapbuf::size() const {
   return size_;
 }
 
+mmapbuf::char_type const* mmapbuf::data() const {
+  return map_;
+}
+
+void mmapbuf::prefetch(size_t offset, size_t length) const {
+  if (!map_ || offset >= size_)
+    return;
+  length = std::min(length, size_ - offset);
+  static auto page_size = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+  auto begin = offset - offset % page_size;
+  auto end = offset + length;
+  // Let the kernel schedule the entire range at once before faulting in each
+  // page individually.
+  ::madvise(map_ + begin, end - begin, MADV_WILLNEED);
+  auto ptr = static_cast<char_type const volatile*>(map_);
+  for (auto i = begin; i < end; i += page_size)
+    static_cast<void>(ptr[i]);
+}
+
 std::streamsize mmapbuf::showmanyc() {
   VAST_ASSERT(map_);
   return egptr() - gptr();
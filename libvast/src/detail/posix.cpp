@@ -229,6 +229,14 @@ bool write(int fd, void const* buffer, size_t bytes, size_t* put) {
   return true;
 }
 
+bool fsync(int fd) {
+  int result;
+  do {
+    result = ::fsync(fd);
+  } while (result < 0 && errno == EINTR);
+  return result == 0;
+}
+
 bool seek(int fd, size_t bytes) {
   return ::lseek(fd, bytes, SEEK_CUR) != -1;
 }
@@ -252,6 +252,66 @@ bool time_restrictor::operator()(predicate const& p) const {
   return true; // nothing to retrict.
 }
 
+time_bounder::interval time_bounder::operator()(none) const {
+  return interval{timestamp::min(), timestamp::max()};
+}
+
+time_bounder::interval time_bounder::operator()(conjunction const& con) const {
+  auto result = interval{timestamp::min(), timestamp::max()};
+  for (auto& op : con) {
+    auto x = visit(*this, op);
+    result.first = std::max(result.first, x.first);
+    result.second = std::min(result.second, x.second);
+  }
+  return result;
+}
+
+time_bounder::interval time_bounder::operator()(disjunction const& dis) const {
+  if (dis.empty())
+    return interval{timestamp::min(), timestamp::max()};
+  auto result = interval{timestamp::max(), timestamp::min()};
+  for (auto& op : dis) {
+    auto x = visit(*this, op);
+    result.first = std::min(result.first, x.first);
+    result.second = std::max(result.second, x.second);
+  }
+  return result;
+}
+
+time_bounder::interval time_bounder::operator()(negation const&) const {
+  // The complement of an interval is not an interval in general.
+  return interval{timestamp::min(), timestamp::max()};
+}
+
+time_bounder::interval time_bounder::operator()(predicate const& p) const {
+  auto result = interval{timestamp::min(), timestamp::max()};
+  auto a = get_if<attribute_extractor>(p.lhs);
+  if (!a || a->attr != "time")
+    return result;
+  auto d = get_if<data>(p.rhs);
+  if (!d)
+    return result;
+  auto t = get_if<timestamp>(*d);
+  if (!t)
+    return result;
+  switch (p.op) {
+    default:
+      break;
+    case equal:
+      result = {*t, *t};
+      break;
+    case less:
+    case less_equal:
+      result.second = *t;
+      break;
+    case greater:
+    case greater_equal:
+      result.first = *t;
+      break;
+  }
+  return result;
+}
+
 
 key_resolver::key_resolver(type const& t) : type_{t} {
 }
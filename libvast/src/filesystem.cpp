@@ -299,6 +299,10 @@ bool file::write(void const* source, size_t bytes, size_t* put) {
   return is_open_ && detail::write(handle_, source, bytes, put);
 }
 
+bool file::sync() {
+  return is_open_ && detail::fsync(handle_);
+}
+
 bool file::seek(size_t bytes) {
   if (!is_open_ || seek_failed_)
     return false;
@@ -419,6 +423,10 @@ bool rm(const path& p) {
   return false;
 }
 
+bool mv(path const& from, path const& to) {
+  return VAST_MOVE_FILE(from.str().data(), to.str().data());
+}
+
 maybe<void> mkdir(path const& p) {
   auto components = split(p);
   if (components.empty())
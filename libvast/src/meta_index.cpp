@@ -0,0 +1,339 @@
+#include <algorithm>
+#include <cmath>
+#include <type_traits>
+
+#include "vast/concept/hashable/uhash.hpp"
+#include "vast/concept/hashable/xxhash.hpp"
+#include "vast/event.hpp"
+#include "vast/expression_visitors.hpp"
+#include "vast/meta_index.hpp"
+
+namespace vast {
+
+namespace {
+
+// Checks whether two data instances hold values of the same type.
+bool same_kind(data const& x, data const& y) {
+  auto f = [](auto& lhs, auto& rhs) {
+    using lhs_type = std::decay_t<decltype(lhs)>;
+    using rhs_type = std::decay_t<decltype(rhs)>;
+    return std::is_same<lhs_type, rhs_type>::value;
+  };
+  return visit(f, x, y);
+}
+
+// Applies a lookup to every element of a container on the RHS of an IN
+// predicate. Returns nothing if the RHS is not a container.
+template <class Synopsis>
+optional<bool> lookup_elements(Synopsis const& s, data const& x) {
+  auto f = [&](auto& xs) {
+    return std::any_of(xs.begin(), xs.end(),
+                       [&](auto& y) { return s.lookup(equal, y); });
+  };
+  if (auto xs = get_if<vector>(x))
+    return f(*xs);
+  if (auto xs = get_if<set>(x))
+    return f(*xs);
+  return {};
+}
+
+// Invokes a function with each bit position of a hashed value in a Bloom
+// filter stage. We derive the positions from a single 64-bit hash by double
+// hashing.
+template <class F>
+void each_position(bloom_synopsis::stage const& s, uint64_t h, F f) {
+  auto h1 = h;
+  auto h2 = (h >> 32) | (h << 32) | 1;
+  auto m = s.bits.size() * 64;
+  for (auto i = 0u; i < s.hashes; ++i)
+    f((h1 + i * h2) % m);
+}
+
+bool contains(bloom_synopsis::stage const& s, uint64_t h) {
+  auto result = true;
+  each_position(s, h, [&](uint64_t i) {
+    result = result && (s.bits[i / 64] & (uint64_t{1} << (i % 64)));
+  });
+  return result;
+}
+
+// The first stage of a Bloom synopsis has a false positive rate of 2^-7, i.e.,
+// just below 1%.
+constexpr uint32_t initial_hashes = 7;
+
+// A Bloom filter with a false positive rate of 2^-k needs about k / ln 2 bits
+// per value.
+uint64_t bits_for(uint64_t values, uint32_t hashes) {
+  auto bits = std::max(64.0, std::ceil(values * hashes / std::log(2.0)));
+  uint64_t result = 64;
+  while (result < bits)
+    result *= 2;
+  return result;
+}
+
+// The number of values that a stage accommodates at its false positive rate.
+uint64_t capacity(bloom_synopsis::stage const& s) {
+  return static_cast<uint64_t>(s.bits.size() * 64 * std::log(2.0) / s.hashes);
+}
+
+bloom_synopsis::stage make_stage(uint64_t values, uint32_t hashes) {
+  auto words = bits_for(values, hashes) / 64;
+  return {std::vector<uint64_t>(words), hashes, 0};
+}
+
+bool has_skip_attribute(type const& t) {
+  auto& attrs = t.attributes();
+  return std::find(attrs.begin(), attrs.end(), attribute{"skip"})
+         != attrs.end();
+}
+
+// Evaluates an expression that has been resolved for a single type over the
+// synopses of the type. A `false` result means that no event of the type can
+// satisfy the expression.
+struct synopsis_evaluator {
+  synopsis_evaluator(type_synopsis const& ts) : ts_{ts} {
+  }
+
+  bool operator()(none) const {
+    return false;
+  }
+
+  bool operator()(conjunction const& c) const {
+    return std::all_of(c.begin(), c.end(),
+                       [&](auto& x) { return visit(*this, x); });
+  }
+
+  bool operator()(disjunction const& d) const {
+    return std::any_of(d.begin(), d.end(),
+                       [&](auto& x) { return visit(*this, x); });
+  }
+
+  bool operator()(negation const&) const {
+    // Synopses cannot rule out the complement of a predicate.
+    return true;
+  }
+
+  bool operator()(predicate const& p) const {
+    auto x = get_if<data>(p.rhs);
+    if (!x)
+      return true;
+    if (auto e = get_if<data_extractor>(p.lhs)) {
+      if (e->type != ts_.type)
+        return false;
+      auto i = ts_.fields.find(e->offset);
+      if (i == ts_.fields.end())
+        return true;
+      return visit([&](auto& s) { return s.lookup(p.op, *x); }, i->second);
+    }
+    if (auto e = get_if<attribute_extractor>(p.lhs))
+      if (e->attr == "type")
+        return evaluate(ts_.type.name(), p.op, *x);
+    return true;
+  }
+
+  type_synopsis const& ts_;
+};
+
+} // namespace <anonymous>
+
+void minmax_synopsis::add(data const& x) {
+  if (is<none>(min)) {
+    min = x;
+    max = x;
+  } else if (same_kind(min, x)) {
+    if (x < min)
+      min = x;
+    else if (max < x)
+      max = x;
+  }
+}
+
+bool minmax_synopsis::lookup(relational_operator op, data const& x) const {
+  if (is<none>(x))
+    return true;
+  if (op == in)
+    if (auto result = lookup_elements(*this, x))
+      return *result;
+  if (is<none>(min))
+    return false;
+  if (!same_kind(min, x))
+    return true;
+  switch (op) {
+    default:
+      return true;
+    case equal:
+      return !(x < min) && !(max < x);
+    case less:
+      return min < x;
+    case less_equal:
+      return !(x < min);
+    case greater:
+      return x < max;
+    case greater_equal:
+      return !(max < x);
+  }
+}
+
+void bloom_synopsis::add(data const& x) {
+  uint64_t h = uhash<xxhash64>{}(x);
+  // Only values that no stage knows yet count towards the capacity.
+  auto known = [&](auto& s) { return contains(s, h); };
+  if (std::any_of(stages.begin(), stages.end(), known))
+    return;
+  if (stages.empty())
+    stages.push_back(make_stage(default_values, initial_hashes));
+  else if (stages.back().values >= capacity(stages.back()))
+    stages.push_back(make_stage(2 * capacity(stages.back()),
+                                stages.back().hashes + 1));
+  auto& s = stages.back();
+  each_position(s, h, [&](uint64_t i) {
+    s.bits[i / 64] |= uint64_t{1} << (i % 64);
+  });
+  ++s.values;
+}
+
+bool bloom_synopsis::lookup(relational_operator op, data const& x) const {
+  if (op == in)
+    if (auto result = lookup_elements(*this, x))
+      return *result;
+  if (op != equal || !(is<std::string>(x) || is<address>(x)))
+    return true;
+  uint64_t h = uhash<xxhash64>{}(x);
+  return std::any_of(stages.begin(), stages.end(),
+                     [&](auto& s) { return contains(s, h); });
+}
+
+void bloom_synopsis::shrink() {
+  for (auto& s : stages) {
+    auto target = bits_for(s.values, s.hashes);
+    // Since the number of bits is a power of two, a position modulo the new
+    // size equals the old position modulo the new size, so that OR-ing the
+    // upper half onto the lower half preserves all values.
+    while (s.bits.size() * 64 > target) {
+      auto half = s.bits.size() / 2;
+      for (auto i = 0u; i < half; ++i)
+        s.bits[i] |= s.bits[i + half];
+      s.bits.resize(half);
+    }
+    s.bits.shrink_to_fit();
+  }
+}
+
+uint64_t bloom_synopsis::size() const {
+  uint64_t result = 0;
+  for (auto& s : stages)
+    result += s.bits.size() * 64;
+  return result;
+}
+
+void port_synopsis::add(data const& x) {
+  auto p = get_if<port>(x);
+  if (!p)
+    return;
+  if (numbers.empty())
+    numbers.resize((1 << 16) / 64);
+  numbers[p->number() / 64] |= uint64_t{1} << (p->number() % 64);
+  protocols |= 1 << p->type();
+}
+
+bool port_synopsis::lookup(relational_operator op, data const& x) const {
+  if (op == in)
+    if (auto result = lookup_elements(*this, x))
+      return *result;
+  auto p = get_if<port>(x);
+  if (op != equal || !p)
+    return true;
+  if (numbers.empty())
+    return false;
+  if (!(numbers[p->number() / 64] & (uint64_t{1} << (p->number() % 64))))
+    return false;
+  // An unknown protocol on either side matches every protocol.
+  if (p->type() == port::unknown || (protocols & (1 << port::unknown)))
+    return true;
+  return (protocols & (1 << p->type())) != 0;
+}
+
+void meta_index::add(uuid const& partition, std::vector<event> const& events) {
+  auto& part = partitions_[partition];
+  type_synopsis* ts = nullptr;
+  for (auto& e : events) {
+    if (e.timestamp() < part.from)
+      part.from = e.timestamp();
+    if (e.timestamp() > part.to)
+      part.to = e.timestamp();
+    if (has_skip_attribute(e.type()))
+      continue;
+    // Batches tend to consist of runs of the same type.
+    if (ts == nullptr || ts->type.name() != e.type().name()) {
+      auto i = part.types.find(e.type().name());
+      if (i == part.types.end()) {
+        type_synopsis x{e.type(), {}};
+        if (auto r = get_if<record_type>(e.type())) {
+          for (auto& f : record_type::each{*r}) {
+            auto& t = f.trace.back()->type;
+            if (has_skip_attribute(t))
+              continue;
+            if (auto s = make_synopsis(t))
+              x.fields.emplace(f.offset, std::move(*s));
+          }
+        } else if (auto s = make_synopsis(e.type())) {
+          x.fields.emplace(offset{}, std::move(*s));
+        }
+        i = part.types.emplace(e.type().name(), std::move(x)).first;
+      }
+      ts = &i->second;
+    }
+    for (auto& f : ts->fields) {
+      auto x = f.first.empty() ? &e.data() : get(e.data(), f.first);
+      if (x != nullptr && !is<none>(*x))
+        visit([&](auto& s) { s.add(*x); }, f.second);
+    }
+  }
+}
+
+std::vector<uuid> meta_index::lookup(expression const& expr) const {
+  std::vector<uuid> result;
+  for (auto& p : partitions_) {
+    if (!visit(time_restrictor{p.second.from, p.second.to}, expr))
+      continue;
+    auto& types = p.second.types;
+    auto candidate = std::any_of(types.begin(), types.end(), [&](auto& x) {
+      auto resolved = visit(key_resolver{x.second.type}, expr);
+      // If we cannot resolve the expression, we must not rule out anything.
+      if (!resolved)
+        return true;
+      return visit(synopsis_evaluator{x.second}, *resolved);
+    });
+    if (candidate)
+      result.push_back(p.first);
+  }
+  return result;
+}
+
+void meta_index::seal(uuid const& partition) {
+  auto i = partitions_.find(partition);
+  if (i == partitions_.end())
+    return;
+  for (auto& t : i->second.types)
+    for (auto& f : t.second.fields)
+      if (auto s = get_if<bloom_synopsis>(f.second))
+        s->shrink();
+}
+
+partition_synopsis const* meta_index::find(uuid const& partition) const {
+  auto i = partitions_.find(partition);
+  return i == partitions_.end() ? nullptr : &i->second;
+}
+
+optional<synopsis> meta_index::make_synopsis(type const& t) {
+  if (is<integer_type>(t) || is<count_type>(t) || is<real_type>(t)
+      || is<timestamp_type>(t) || is<timespan_type>(t))
+    return synopsis{minmax_synopsis{}};
+  if (is<string_type>(t) || is<address_type>(t))
+    return synopsis{bloom_synopsis{}};
+  if (is<port_type>(t))
+    return synopsis{port_synopsis{}};
+  return {};
+}
+
+} // namespace vast
@@ -1,4 +1,8 @@
 #include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
 
 #include "vast/logger.hpp"
 
@@ -19,46 +23,229 @@ using std::chrono::steady_clock;
 using std::chrono::duration_cast;
 using std::chrono::microseconds;
 
+CAF_ALLOW_UNSAFE_MESSAGE_TYPE(std::shared_ptr<vast::system::segment const>)
+
 namespace vast {
 namespace system {
 
 const segment::magic_type segment::magic;
 const segment::version_type segment::version;
 
-void segment::add(batch&& b) {
-  auto min = select(b.ids(), 1);
-  VAST_ASSERT(min != invalid_event_id);
-  VAST_ASSERT(batches_.find(min) == batches_.end());
+namespace {
+
+// Orders an event ID before a directory entry.
+struct before_entry {
+  bool operator()(event_id id, segment::entry const& e) const {
+    return id < e.first;
+  }
+};
+
+} // namespace <anonymous>
+
+expected<segment> segment::open(path const& filename) {
+  auto file = std::make_unique<detail::mmapbuf>(filename.str());
+  if (file->data() == nullptr)
+    return make_error(ec::filesystem_error, "failed to map segment", filename);
+  segment result;
+  magic_type m;
+  version_type v;
+  auto r = load(*file, m, v, result.id_, result.bytes_, result.types_,
+                result.dictionaries_, result.directory_);
+  if (!r)
+    return r.error();
+  if (m != magic)
+    return make_error(ec::unspecified, "segment magic error");
+  if (v < version)
+    return make_error(ec::version_error, v, version);
+  if (!result.directory_.empty()) {
+    auto pos = file->pubseekoff(0, std::ios_base::cur, std::ios_base::in);
+    result.base_ = static_cast<uint64_t>(pos);
+    auto& last = result.directory_.back();
+    if (result.base_ + last.offset + last.size > file->size())
+      return make_error(ec::unspecified, "truncated segment", filename);
+  }
+  result.loaded_.resize(result.directory_.size());
+  result.resident_ = result.base_;
+  result.file_ = std::move(file);
+  return result;
+}
+
+void segment::add(batch&& b, std::vector<char> const* dictionary) {
+  VAST_ASSERT(!file_);
+  auto first = select(b.ids(), 1);
+  auto last = select(b.ids(), -1) + 1;
+  VAST_ASSERT(first != invalid_event_id);
+  // The ARCHIVE appends batches in ID order, so the insertion point is almost
+  // always the end and this boils down to a push_back.
+  auto i = std::upper_bound(directory_.begin(), directory_.end(), first,
+                            before_entry{});
+  VAST_ASSERT(i == directory_.begin() || (i - 1)->last <= first);
+  VAST_ASSERT(i == directory_.end() || last <= i->first);
+  auto j = batches_.begin() + (i - directory_.begin());
+  // Move the type table of the batch into the dictionary.
+  std::vector<uint32_t> types;
+  types.reserve(b.types().size());
+  for (auto& t : b.types()) {
+    auto k = type_ids_.find(t);
+    if (k == type_ids_.end()) {
+      auto type_id = static_cast<uint32_t>(types_.size());
+      k = type_ids_.emplace(t, type_id).first;
+      types_.push_back(t);
+    }
+    types.push_back(k->second);
+  }
+  b.types({});
   bytes_ += bytes(b);
-  batches_.emplace(min, std::move(b));
+  // Store each compression dictionary only once.
+  uint32_t dict = 0;
+  if (dictionary && !dictionary->empty()) {
+    auto k = std::find(dictionaries_.begin(), dictionaries_.end(),
+                       *dictionary);
+    if (k == dictionaries_.end()) {
+      dictionaries_.push_back(*dictionary);
+      bytes_ += dictionary->size();
+      k = dictionaries_.end() - 1;
+    }
+    dict = static_cast<uint32_t>(k - dictionaries_.begin()) + 1;
+  }
+  directory_.insert(i, entry{first, last, b.earliest(), b.latest(), 0, 0,
+                             std::move(types), dict});
+  batches_.insert(j, std::move(b));
+}
+
+expected<void> segment::write(path const& filename) const {
+  VAST_ASSERT(!file_);
+  // Serialize all batches back-to-back first to compute their locations.
+  std::vector<char> buffer;
+  auto directory = directory_;
+  for (auto i = 0u; i < batches_.size(); ++i) {
+    directory[i].offset = buffer.size();
+    auto r = save(buffer, batches_[i]);
+    if (!r)
+      return r.error();
+    directory[i].size = buffer.size() - directory[i].offset;
+  }
+  std::ofstream fs{filename.str()};
+  if (!fs)
+    return make_error(ec::filesystem_error, "failed to create filestream",
+                      filename);
+  auto r = save(*fs.rdbuf(), magic, version, id_, bytes_, types_,
+                dictionaries_, directory);
+  if (!r)
+    return r.error();
+  if (!fs.write(buffer.data(), buffer.size()))
+    return make_error(ec::filesystem_error, "failed to write segment",
+                      filename);
+  return {};
+}
+
+expected<batch> segment::load_batch(size_t i) const {
+  VAST_ASSERT(file_);
+  VAST_ASSERT(i < directory_.size());
+  auto& e = directory_[i];
+  if (!loaded_[i]) {
+    loaded_[i] = true;
+    resident_ += e.size;
+  }
+  auto ptr = const_cast<char*>(file_->data()) + base_ + e.offset;
+  caf::charbuf buf{ptr, e.size};
+  batch result;
+  auto r = load(buf, result);
+  if (!r)
+    return r.error();
+  return result;
 }
 
-// FIXME: this algorithm is not very efficient. It operates in O(MN) time where
-// M is the number of batches and N the size of the bitmap. Conceptually,
-// there's a straight-forward O(log M * N) or even O(N) algorithm by walking
-// through the query bitmap in lock-step with the batches.
-expected<std::vector<event>> segment::extract(bitmap const& bm) const {
+// We walk through the 1-bits of the query bitmap in lock-step with the ID
+// ranges of the batches. Whenever the bitmap falls behind, we skip it ahead to
+// the next batch, and whenever the batches fall behind, we binary-search for
+// the batch that may contain the next 1-bit. This takes O(M + N) time, where M
+// is the number of batches and N the size of the bitmap, and never touches a
+// batch without hits.
+expected<std::vector<event>>
+segment::extract(bitmap const& bm, timestamp from, timestamp to) const {
   std::vector<event> result;
-  auto min = select(bm, 1);
-  auto max = select(bm, -1);
-  // FIXME: what we really want here is detail::range_map, but it's currently
-  // missing lower_bound()/upper_bound() functionality, so we emulate it here.
-  auto begin = batches_.lower_bound(min);
-  if (begin != batches_.begin()
-      && (begin == batches_.end() || begin->first > min))
-    --begin;
-  auto end = batches_.upper_bound(max);
-  for (; begin != end; ++begin) {
-    batch::reader reader{begin->second};
-    auto xs = reader.read(bm);
-    if (!xs)
-      return xs;
-    result.reserve(result.size() + xs->size());
-    std::move(xs->begin(), xs->end(), std::back_inserter(result));
+  auto ones = select(bm);
+  if (!ones || directory_.empty())
+    return result;
+  // Position on the last batch that begins at or before the given ID.
+  auto seek = [&](auto first, event_id id) {
+    auto i = std::upper_bound(first, directory_.end(), id, before_entry{});
+    return i == first ? i : i - 1;
+  };
+  auto i = seek(directory_.begin(), ones.get());
+  while (ones && i != directory_.end()) {
+    if (ones.get() < i->first) {
+      // Bitmap must catch up, batch is ahead.
+      ones.skip(i->first - ones.get());
+    } else if (ones.get() >= i->last) {
+      // Batch must catch up, bitmap is ahead.
+      i = seek(i + 1, ones.get());
+    } else if (i->latest < from || i->earliest > to) {
+      // Match, but the batch lies outside the time interval.
+      ones.skip(i->last - ones.get());
+      ++i;
+    } else {
+      // Match: collect all IDs that fall into this batch and extract them.
+      bitmap hits;
+      while (ones && ones.get() < i->last) {
+        hits.append_bits(false, ones.get() - hits.size());
+        hits.append_bit(true);
+        ones.next();
+      }
+      auto k = static_cast<size_t>(i - directory_.begin());
+      batch mapped;
+      if (file_) {
+        auto b = load_batch(k);
+        if (!b)
+          return b.error();
+        mapped = std::move(*b);
+      }
+      // Reconstruct the type table of the batch from the dictionary.
+      std::vector<type> types;
+      types.reserve(i->types.size());
+      for (auto t : i->types) {
+        if (t >= types_.size())
+          return make_error(ec::unspecified, "invalid type ID", t);
+        types.push_back(types_[t]);
+      }
+      if (i->dictionary > dictionaries_.size())
+        return make_error(ec::unspecified, "invalid dictionary ID",
+                          i->dictionary);
+      auto dict = i->dictionary > 0 ? &dictionaries_[i->dictionary - 1]
+                                    : nullptr;
+      batch::reader reader{file_ ? mapped : batches_[k], types, dict};
+      auto xs = reader.read(hits);
+      if (!xs)
+        return xs;
+      result.reserve(result.size() + xs->size());
+      for (auto& x : *xs)
+        if (x.timestamp() >= from && x.timestamp() <= to)
+          result.push_back(std::move(x));
+      ++i;
+    }
   }
   return result;
 }
 
+void segment::prefetch(bitmap const& bm) const {
+  if (!file_)
+    return;
+  auto ones = select(bm);
+  auto i = directory_.begin();
+  while (ones && i != directory_.end()) {
+    if (ones.get() < i->first) {
+      ones.skip(i->first - ones.get());
+    } else if (ones.get() < i->last) {
+      file_->prefetch(base_ + i->offset, i->size);
+      ones.skip(i->last - ones.get());
+      ++i;
+    } else {
+      ++i;
+    }
+  }
+}
+
 uuid const& segment::id() const {
   return id_;
 }
@@ -67,81 +254,1095 @@ uint64_t bytes(segment const& s) {
   return s.bytes_;
 }
 
+uint64_t resident(segment const& s) {
+  return s.file_ ? s.resident_ : s.bytes_;
+}
+
 namespace {
 
+// The number of journal records after which the ARCHIVE replaces its meta
+// data snapshot, which bounds the replay time on startup.
+constexpr size_t max_journal_records = 1024;
+
+// Flushes a file or directory from the OS buffers to stable storage.
+expected<void> sync(path const& p) {
+  file f{p};
+  auto opened = f.open(file::read_only);
+  if (!opened)
+    return opened.error();
+  if (!f.sync())
+    return make_error(ec::filesystem_error, "failed to sync", p);
+  return {};
+}
+
+// Applies a meta data change to the segment map and time bounds. Applying the
+// same change twice has no further effect, which makes replaying a journal on
+// top of a newer snapshot safe.
+template <class State>
+void apply(State& st, meta_delta const& x) {
+  if (!x.replaced.empty()) {
+    auto& ids = x.replaced;
+    std::vector<std::pair<event_id, event_id>> stale;
+    for (auto& e : st.segments)
+      if (std::find(ids.begin(), ids.end(), e.value) != ids.end())
+        stale.emplace_back(e.left, e.right);
+    for (auto& r : stale)
+      st.segments.erase(r.first, r.second);
+    for (auto& id : ids)
+      st.bounds.erase(id);
+  }
+  for (auto& r : x.ranges) {
+    st.segments.erase(r.first, r.second);
+    st.segments.inject(r.first, r.second, x.id);
+  }
+  st.bounds[x.id] = x.bounds;
+}
+
+// Reads all complete records from a meta data journal. A torn record at the
+// end, e.g., due to a crash in the middle of an append, was never committed
+// and does not count.
+expected<std::vector<meta_delta>> load_journal(path const& filename) {
+  std::ifstream fs{filename.str(), std::ios::binary};
+  if (!fs)
+    return make_error(ec::filesystem_error, "failed to open journal",
+                      filename);
+  std::vector<char> bytes{std::istreambuf_iterator<char>{fs},
+                          std::istreambuf_iterator<char>{}};
+  std::vector<meta_delta> result;
+  size_t i = 0;
+  while (bytes.size() - i >= sizeof(uint32_t)) {
+    uint32_t n;
+    std::memcpy(&n, bytes.data() + i, sizeof(n));
+    i += sizeof(n);
+    if (bytes.size() - i < n)
+      break;
+    caf::charbuf buf{bytes.data() + i, n};
+    meta_delta x;
+    auto r = load(buf, x);
+    if (!r)
+      return r.error();
+    result.push_back(std::move(x));
+    i += n;
+  }
+  return result;
+}
+
+// Hands a snapshot of the meta data to the WRITER, which then no longer needs
+// the journal records so far. The snapshot must only refer to segments on
+// stable storage. The active segment has no file yet, so we leave it out; its
+// ranges go into the journal once we flush it. The unwritten segments precede
+// the snapshot in the mailbox of the WRITER, which commits them before it
+// writes the snapshot.
+template <class Actor>
+void checkpoint(Actor* self) {
+  auto& st = self->state;
+  auto segments = st.segments;
+  auto bounds = st.bounds;
+  for (auto& r : st.active_ranges)
+    segments.erase(r.first, r.second);
+  bounds.erase(st.active.id());
+  std::vector<char> buf;
+  auto r = save(buf, segments, bounds);
+  if (!r) {
+    VAST_ERROR(self, "failed to serialize meta data:",
+               self->system().render(r.error()));
+    return;
+  }
+  st.journaled = 0;
+  self->send(st.writer, snapshot_atom::value, std::move(buf));
+}
+
+template <class Actor>
+void compact(Actor* self);
+
+// Hands the active segment to the WRITER and starts a new one. The segment
+// remains available for lookups until it has become durable, at which point
+// the ARCHIVE swaps it for its memory-mapped version in the cache.
 template <class Actor>
 expected<void> flush_active_segment(Actor* self) {
-  VAST_DEBUG(self, "flushes current segment", self->state.active.id());
+  auto& st = self->state;
+  VAST_DEBUG(self, "flushes current segment", st.active.id());
   // Don't touch filesystem if we have nothing to do.
-  if (bytes(self->state.active) == 0)
+  if (bytes(st.active) == 0)
     return {};
-  // Write segment to file system.
-  if (!exists(self->state.dir)) {
-    auto result = mkdir(self->state.dir);
-    if (!result)
-      return result.error();
+  auto id = st.active.id();
+  auto size = bytes(st.active);
+  auto delta = meta_delta{id, std::move(st.active_ranges), st.bounds[id], {}};
+  auto s = std::make_shared<segment const>(std::move(st.active));
+  st.active = {};
+  st.active_ranges.clear();
+  st.unwritten.emplace(id, s);
+  auto start = steady_clock::now();
+  self->request(st.writer, caf::infinite, write_atom::value, s,
+                std::move(delta)).then(
+    [=](ok_atom) {
+      if (self->state.accountant) {
+        auto stop = steady_clock::now();
+        auto unit = duration_cast<microseconds>(stop - start).count();
+        auto rate = size * 1e6 / unit;
+        self->send(self->state.accountant, "archive.flush.rate", rate);
+      }
+      auto filename = self->state.dir / to_string(id);
+      VAST_DEBUG(self, "persisted segment", filename);
+      auto mapped = segment::open(filename);
+      if (!mapped) {
+        self->quit(mapped.error());
+        return;
+      }
+      self->state.cache.insert(id, std::move(*mapped));
+      self->state.unwritten.erase(id);
+      compact(self);
+    },
+    [=](caf::error& e) {
+      VAST_ERROR(self, "failed to write segment:", self->system().render(e));
+      self->quit(std::move(e));
+    }
+  );
+  if (++st.journaled >= max_journal_records)
+    checkpoint(self);
+  return {};
+}
+
+// Assembles a compression dictionary from the samples of a type. LZ4 has no
+// dictionary trainer, it merely primes its window with the dictionary. Hence
+// we concatenate the samples in their serialized form up to the largest
+// dictionary that LZ4 can use.
+std::vector<char> make_dictionary(std::vector<event> const& samples,
+                                  type const& t) {
+  std::vector<char> result;
+  for (auto& e : samples) {
+    if (result.size() >= lz4::max_dictionary_size)
+      break;
+    if (e.type() == t && !save(result, e.timestamp(), e.data()))
+      return {};
   }
-  auto id = self->state.active.id();
-  auto filename = self->state.dir / to_string(id);
+  if (result.size() > lz4::max_dictionary_size)
+    result.resize(lz4::max_dictionary_size);
+  return result;
+}
+
+// Serializes and compresses a sequence of events into a batch. Works for both
+// ARCHIVE and COMPRESSOR, as both have an accountant in their state.
+template <class Actor>
+expected<batch> make_batch(Actor* self, std::vector<event> const& events,
+                           compression method, size_t block_size,
+                           batch::layout layout, int level,
+                           std::vector<char> const* dictionary) {
+  VAST_ASSERT(!events.empty());
   auto start = steady_clock::now();
-  auto result = save(filename, segment::magic, segment::version,
-                     self->state.active);
-  if (!result)
-    return result.error();
+  batch::writer writer{method, block_size, layout, level, dictionary};
+  for (auto& e : events)
+    if (!writer.write(e))
+      return make_error(ec::unspecified, "failed to create batch");
+  auto b = writer.seal();
+  b.ids(events.front().id(), events.back().id() + 1);
+  auto stop = steady_clock::now();
   if (self->state.accountant) {
-    auto stop = steady_clock::now();
-    auto unit = duration_cast<microseconds>(stop - start).count();
-    auto rate = bytes(self->state.active) * 1e6 / unit;
-    self->send(self->state.accountant, "archive.flush.rate", rate);
+    auto runtime = stop - start;
+    auto unit = duration_cast<microseconds>(runtime).count();
+    auto rate = events.size() * 1e6 / unit;
+    self->send(self->state.accountant, "archive.compression.rate", rate);
+    uint64_t num = events.size();
+    self->send(self->state.accountant, "archive.events.per.batch", num);
   }
-  VAST_DEBUG(self, "wrote active segment to", filename);
-  self->state.cache.insert(id, std::move(self->state.active));
-  self->state.active = {};
-  // Update meta data on filessytem.
-  auto t = save(self->state.dir / "meta", self->state.segments);
-  if (!t)
-    return t.error();
-  VAST_DEBUG(self, "updated persistent meta data");
+  return b;
+}
+
+struct compressor_state {
+  std::unordered_map<type, std::vector<char>> dictionaries;
+  accountant_type accountant;
+  char const* name = "compressor";
+};
+
+// A COMPRESSOR turns a sequence of events into a sealed batch on behalf of the
+// ARCHIVE. The ARCHIVE sends it the dictionary of each type before the first
+// events of that type.
+caf::behavior compressor(caf::stateful_actor<compressor_state>* self,
+                         compression method, size_t block_size,
+                         batch::layout layout, int level) {
+  return {
+    [=](accountant_type const& acc) {
+      self->state.accountant = acc;
+    },
+    [=](type const& t, std::vector<char>& dictionary) {
+      self->state.dictionaries[t] = std::move(dictionary);
+    },
+    [=](std::vector<event> const& events) -> caf::result<batch> {
+      auto& dicts = self->state.dictionaries;
+      auto i = dicts.find(events.front().type());
+      auto dict = i != dicts.end() ? &i->second : nullptr;
+      auto b = make_batch(self, events, method, block_size, layout, level,
+                          dict);
+      if (!b)
+        return b.error();
+      return std::move(*b);
+    }
+  };
+}
+
+struct prefetcher_state {
+  char const* name = "prefetcher";
+};
+
+// A PREFETCHER pages in segments on behalf of the ARCHIVE. It runs in its own
+// thread, since it blocks on disk I/O.
+caf::behavior prefetcher(caf::stateful_actor<prefetcher_state>* self) {
+  return {
+    [=](std::string const& filename, bitmap const& bm) {
+      auto s = segment::open(filename);
+      if (!s) {
+        VAST_DEBUG(self, "failed to open segment", filename);
+        return;
+      }
+      s->prefetch(bm);
+    }
+  };
+}
+
+struct writer_state {
+  ~writer_state() {
+    journal.close();
+  }
+
+  path dir;
+  file journal;
+  std::vector<path> unsynced;
+  std::vector<uuid> obsolete;
+  std::vector<caf::response_promise> waiting;
+  bool scheduled = false;
+  accountant_type accountant;
+  char const* name = "writer";
+};
+
+// Makes all writes since the last commit durable, deletes the segments that
+// the journal no longer refers to, and then answers the waiting requests.
+template <class Actor>
+expected<void> commit(Actor* self) {
+  auto& st = self->state;
+  auto result = [&]() -> expected<void> {
+    for (auto& p : st.unsynced) {
+      auto r = sync(p);
+      if (!r)
+        return r;
+    }
+    if (st.journal.is_open() && !st.journal.sync())
+      return make_error(ec::filesystem_error, "failed to sync journal");
+    // Persist the directory entries of new files as well. This includes the
+    // segments of the COMPACTOR, which must not be lost after we delete the
+    // segments they replace.
+    if (!st.unsynced.empty() || !st.obsolete.empty()) {
+      auto r = sync(st.dir);
+      if (!r)
+        return r;
+      if (st.accountant)
+        self->send(st.accountant, "archive.sync.directory",
+                   uint64_t{st.obsolete.size()});
+    }
+    for (auto& id : st.obsolete)
+      rm(st.dir / to_string(id));
+    if (!st.obsolete.empty() && st.accountant)
+      self->send(st.accountant, "archive.segments.removed",
+                 uint64_t{st.obsolete.size()});
+    return {};
+  }();
+  if (!st.unsynced.empty() || !st.waiting.empty())
+    VAST_DEBUG(self, "committed", st.unsynced.size(), "segments for",
+               st.waiting.size(), "requests");
+  st.unsynced.clear();
+  st.obsolete.clear();
+  auto waiting = std::move(st.waiting);
+  st.waiting.clear();
+  for (auto& rp : waiting)
+    if (result)
+      rp.deliver(ok_atom::value);
+    else
+      rp.deliver(result.error());
+  return result;
+}
+
+// Appends a record to the journal, prefixed by its size.
+template <class Actor>
+expected<void> append_record(Actor* self, meta_delta const& x) {
+  auto& st = self->state;
+  if (!st.journal.is_open()) {
+    st.journal = file{st.dir / "journal"};
+    auto opened = st.journal.open(file::write_only, true);
+    if (!opened)
+      return opened.error();
+  }
+  std::vector<char> buf(sizeof(uint32_t));
+  auto r = save(buf, x);
+  if (!r)
+    return r;
+  uint32_t n = buf.size() - sizeof(uint32_t);
+  std::memcpy(buf.data(), &n, sizeof(n));
+  if (!st.journal.write(buf.data(), buf.size()))
+    return make_error(ec::filesystem_error, "failed to append to journal");
   return {};
 }
 
-using flush_promise = caf::typed_response_promise<ok_atom>;
-using lookup_promise = caf::typed_response_promise<std::vector<event>>;
+// Commits once the WRITER has worked through all writes in its mailbox, so
+// that a burst of writes costs only a single round of syncs.
+template <class Actor>
+void schedule_commit(Actor* self) {
+  if (self->state.scheduled)
+    return;
+  self->state.scheduled = true;
+  self->send(self, persist_atom::value);
+}
+
+// A WRITER persists segments and meta data changes on behalf of the ARCHIVE.
+// It runs in its own thread, since it blocks on disk I/O.
+caf::behavior writer(caf::stateful_actor<writer_state>* self, path dir) {
+  self->state.dir = std::move(dir);
+  auto fail = [=](caf::error const& e) {
+    VAST_ERROR(self, self->system().render(e));
+    self->quit(e);
+  };
+  return {
+    [=](accountant_type const& acc) {
+      self->state.accountant = acc;
+    },
+    [=](write_atom, std::shared_ptr<segment const> const& s,
+        meta_delta const& delta) {
+      auto rp = self->make_response_promise();
+      auto& st = self->state;
+      if (!exists(st.dir)) {
+        auto r = mkdir(st.dir);
+        if (!r) {
+          rp.deliver(r.error());
+          fail(r.error());
+          return rp;
+        }
+      }
+      auto filename = st.dir / to_string(s->id());
+      auto r = s->write(filename);
+      if (r)
+        r = append_record(self, delta);
+      if (!r) {
+        rp.deliver(r.error());
+        fail(r.error());
+        return rp;
+      }
+      st.unsynced.push_back(filename);
+      st.waiting.push_back(rp);
+      schedule_commit(self);
+      return rp;
+    },
+    [=](meta_delta const& delta) {
+      auto r = append_record(self, delta);
+      if (!r) {
+        fail(r.error());
+        return;
+      }
+      auto& obsolete = self->state.obsolete;
+      obsolete.insert(obsolete.end(), delta.replaced.begin(),
+                      delta.replaced.end());
+      schedule_commit(self);
+    },
+    [=](snapshot_atom, std::vector<char> const& buf) {
+      auto& st = self->state;
+      auto r = commit(self);
+      if (!r) {
+        fail(r.error());
+        return;
+      }
+      // Write the snapshot to a temporary file first and then rename it, so
+      // that a crash never leaves behind a partially written snapshot.
+      auto filename = st.dir / "meta";
+      auto tmp = st.dir / "meta.tmp";
+      {
+        std::ofstream fs{tmp.str(), std::ios::binary};
+        if (!fs.write(buf.data(), buf.size())) {
+          fail(make_error(ec::filesystem_error, "failed to write", tmp));
+          return;
+        }
+      }
+      r = sync(tmp);
+      if (!r) {
+        fail(r.error());
+        return;
+      }
+      if (std::rename(tmp.str().c_str(), filename.str().c_str()) != 0) {
+        fail(make_error(ec::filesystem_error, "failed to rename", tmp));
+        return;
+      }
+      r = sync(st.dir);
+      if (!r) {
+        fail(r.error());
+        return;
+      }
+      // The snapshot subsumes all journal records so far.
+      st.journal.close();
+      rm(st.dir / "journal");
+      VAST_DEBUG(self, "replaced meta data snapshot");
+    },
+    [=](persist_atom) {
+      self->state.scheduled = false;
+      auto r = commit(self);
+      if (!r)
+        fail(r.error());
+    },
+    [=](flush_atom) -> caf::result<ok_atom> {
+      auto r = commit(self);
+      if (!r)
+        return r.error();
+      return ok_atom::value;
+    }
+  };
+}
+
+// The maximum number of events per batch when merging segments.
+constexpr size_t max_merged_batch_events = 1 << 16;
+
+struct compactor_state {
+  char const* name = "compactor";
+};
+
+// A COMPACTOR merges runs of adjacent undersized segments into a single one on
+// behalf of the ARCHIVE. It runs in its own thread, since it performs disk I/O
+// and re-compresses all events of the merged segments.
+caf::behavior compactor(caf::stateful_actor<compactor_state>* self, path dir,
+                        compression method, size_t block_size, int level,
+                        batch::layout layout, bool train,
+                        size_t max_segment_size) {
+  using result_type = caf::result<uuid, std::vector<uuid>>;
+  auto nothing = [] { return result_type{uuid::nil(), std::vector<uuid>{}}; };
+  return {
+    [=](detail::range_map<event_id, uuid> const& segments,
+        std::vector<uuid> const& busy) -> result_type {
+      // Collect all ranges of each segment, as ID gaps or earlier merges may
+      // leave a segment with more than one. We order the segments by their
+      // first range.
+      using range = std::pair<event_id, event_id>;
+      std::vector<std::pair<uuid, std::vector<range>>> ordered;
+      std::unordered_map<uuid, size_t> positions;
+      for (auto& x : segments) {
+        auto i = positions.find(x.value);
+        if (i == positions.end()) {
+          i = positions.emplace(x.value, ordered.size()).first;
+          ordered.emplace_back(x.value, std::vector<range>{});
+        }
+        ordered[i->second].second.emplace_back(x.left, x.right);
+      }
+      // Find the first run of at least two consecutive segments that are
+      // each below half the maximum size and together fit into one segment.
+      struct candidate {
+        std::vector<range> ranges;
+        segment seg;
+      };
+      std::vector<candidate> run;
+      uint64_t total = 0;
+      for (auto& x : ordered) {
+        // The active and unwritten segments are the most recent ones.
+        if (std::find(busy.begin(), busy.end(), x.first) != busy.end())
+          break;
+        auto seg = segment::open(dir / to_string(x.first));
+        if (!seg)
+          return seg.error();
+        auto size = bytes(*seg);
+        auto small = size < max_segment_size / 2;
+        auto fits = total + size <= max_segment_size;
+        if (small && fits) {
+          total += size;
+          run.push_back({x.second, std::move(*seg)});
+          continue;
+        }
+        if (run.size() > 1)
+          break;
+        run.clear();
+        total = 0;
+        if (small) {
+          total = size;
+          run.push_back({x.second, std::move(*seg)});
+        }
+      }
+      if (run.size() < 2)
+        return nothing();
+      VAST_DEBUG(self, "merges", run.size(), "segments with", total, "bytes");
+      // Re-batch the events of all segments in the run.
+      segment merged;
+      std::vector<uuid> ids;
+      std::unordered_map<type, std::vector<char>> dictionaries;
+      std::vector<char> const* dict = nullptr;
+      std::unique_ptr<batch::writer> writer;
+      size_t n = 0;
+      event_id first = 0;
+      event_id next = 0;
+      auto seal = [&] {
+        auto b = writer->seal();
+        b.ids(first, next);
+        merged.add(std::move(b), dict);
+        n = 0;
+      };
+      for (auto& c : run) {
+        ids.push_back(c.seg.id());
+        // The ARCHIVE points all ranges of the segment to the merged one, so
+        // we must copy every single one of them.
+        bitmap bm;
+        for (auto& r : c.ranges) {
+          bm.append_bits(false, r.first - bm.size());
+          bm.append_bits(true, r.second - r.first);
+        }
+        auto xs = c.seg.extract(bm);
+        if (!xs)
+          return xs.error();
+        for (auto& x : *xs) {
+          if (n > 0 && (x.id() != next || n == max_merged_batch_events))
+            seal();
+          if (n == 0) {
+            first = x.id();
+            dict = nullptr;
+            if (train && method == compression::lz4) {
+              auto i = dictionaries.find(x.type());
+              if (i == dictionaries.end())
+                i = dictionaries.emplace(x.type(),
+                                        make_dictionary(*xs, x.type())).first;
+              if (!i->second.empty())
+                dict = &i->second;
+            }
+            writer = std::make_unique<batch::writer>(method, block_size,
+                                                     layout, level, dict);
+          }
+          if (!writer->write(x))
+            return make_error(ec::unspecified, "failed to create batch");
+          next = x.id() + 1;
+          ++n;
+        }
+      }
+      if (n > 0)
+        seal();
+      auto filename = dir / to_string(merged.id());
+      auto result = merged.write(filename);
+      if (!result)
+        return result.error();
+      // The merged segment and its directory entry must be durable before the
+      // journal refers to it.
+      result = sync(filename);
+      if (result)
+        result = sync(dir);
+      if (!result)
+        return result.error();
+      return result_type{merged.id(), std::move(ids)};
+    }
+  };
+}
+
+template <class Actor>
+void drain(Actor* self);
+
+// Replaces the merged segments with the result of a compaction.
+template <class Actor>
+void replace(Actor* self, uuid const& merged, std::vector<uuid> const& ids) {
+  auto& st = self->state;
+  meta_delta delta;
+  delta.id = merged;
+  delta.replaced = ids;
+  for (auto& x : st.segments)
+    if (std::find(ids.begin(), ids.end(), x.value) != ids.end())
+      delta.ranges.emplace_back(x.left, x.right);
+  // The merged segment covers the union of the time intervals.
+  for (auto& id : ids) {
+    auto i = st.bounds.find(id);
+    if (i == st.bounds.end())
+      continue;
+    delta.bounds.earliest = std::min(delta.bounds.earliest,
+                                     i->second.earliest);
+    delta.bounds.latest = std::max(delta.bounds.latest, i->second.latest);
+  }
+  apply(st, delta);
+  for (auto& id : ids)
+    st.cache.erase(id);
+  // The WRITER deletes the originals once the journal no longer refers to
+  // them.
+  self->send(st.writer, std::move(delta));
+  if (++st.journaled >= max_journal_records)
+    checkpoint(self);
+}
+
+// Starts a compaction of undersized segments in the background, unless one is
+// already running.
+template <class Actor>
+void compact(Actor* self) {
+  auto& st = self->state;
+  if (st.shutting_down)
+    return;
+  // A segment written during a compaction may complete a run, so we look
+  // again once the current compaction has finished.
+  if (st.compacting) {
+    st.recompact = true;
+    return;
+  }
+  st.compacting = true;
+  st.recompact = false;
+  std::vector<uuid> busy{st.active.id()};
+  for (auto& x : st.unwritten)
+    busy.push_back(x.first);
+  self->request(st.compactor, caf::infinite, st.segments, busy).then(
+    [=](uuid const& merged, std::vector<uuid> const& ids) {
+      self->state.compacting = false;
+      if (!ids.empty()) {
+        VAST_DEBUG(self, "merged", ids.size(), "segments into", merged);
+        replace(self, merged, ids);
+        if (self->state.accountant) {
+          uint64_t n = ids.size();
+          self->send(self->state.accountant, "archive.compaction.merged", n);
+        }
+      }
+      // There may be more to do.
+      if (!ids.empty() || self->state.recompact)
+        compact(self);
+      if (self->state.shutting_down)
+        drain(self);
+    },
+    [=](caf::error& e) {
+      VAST_ERROR(self, "failed to compact segments:",
+                 self->system().render(e));
+      self->state.compacting = false;
+      if (self->state.shutting_down)
+        drain(self);
+    }
+  );
+}
+
+// Appends a sealed batch to the active segment, flushing the active segment
+// first if it has reached its maximum size.
+template <class Actor>
+expected<void> append(Actor* self, batch&& b, event_id first, event_id last,
+                      std::vector<char> const* dictionary) {
+  // If the batch would cause the segment to exceed its maximum size, then
+  // flush the active segment and append the batch to the new one.
+  auto too_big = bytes(self->state.active) >= self->state.max_segment_size;
+  auto empty = bytes(self->state.active) == 0;
+  if (!empty && too_big) {
+    auto result = flush_active_segment(self);
+    if (!result)
+      return result;
+  }
+  auto active_id = self->state.active.id();
+  self->state.segments.inject(first, last + 1, active_id);
+  auto& ranges = self->state.active_ranges;
+  if (!ranges.empty() && ranges.back().second == first)
+    ranges.back().second = last + 1;
+  else
+    ranges.emplace_back(first, last + 1);
+  auto& bounds = self->state.bounds[active_id];
+  bounds.earliest = std::min(bounds.earliest, b.earliest());
+  bounds.latest = std::max(bounds.latest, b.latest());
+  self->state.active.add(std::move(b), dictionary);
+  return {};
+}
+
+// Returns the compression dictionary for a sequence of events, or `nullptr`
+// for none. The first events of a type determine its dictionary, which the
+// ARCHIVE then distributes to all COMPRESSORs.
+template <class Actor>
+std::vector<char> const* dictionary(Actor* self,
+                                    std::vector<event> const& events) {
+  auto& st = self->state;
+  if (!st.train || st.method != compression::lz4)
+    return nullptr;
+  auto& t = events.front().type();
+  auto i = st.dictionaries.find(t);
+  if (i == st.dictionaries.end()) {
+    i = st.dictionaries.emplace(t, make_dictionary(events, t)).first;
+    VAST_DEBUG(self, "assembled", i->second.size(),
+               "byte dictionary for type", t.name());
+    for (auto& c : st.compressors)
+      self->send(c, t, i->second);
+  }
+  return i->second.empty() ? nullptr : &i->second;
+}
+
+// Checks whether a lookup can proceed without waiting for pending batches,
+// i.e., whether all requested IDs precede the first ID still in flight.
+template <class Actor>
+bool can_lookup(Actor* self, bitmap const& bm) {
+  if (self->state.pending.empty())
+    return true;
+  auto last = select(bm, -1);
+  return last == bitmap::word_type::npos
+         || last < self->state.pending.begin()->second.first;
+}
+
+// Checks whether a segment may contain events in the time interval [from, to].
+// Segments without known bounds always qualify.
+template <class Actor>
+bool overlaps(Actor* self, uuid const& id, timestamp from, timestamp to) {
+  auto i = self->state.bounds.find(id);
+  return i == self->state.bounds.end()
+         || !(i->second.latest < from || i->second.earliest > to);
+}
+
+// Collects candidate segments by alternating between the query bitmap and the
+// segment map: for the next ID in the bitmap we binary-search the segment that
+// contains it or follows it, and then skip the bitmap past that segment.
+// Segments outside the time interval [from, to] do not qualify.
+template <class Actor>
+std::vector<uuid> candidates(Actor* self, bitmap const& bm, timestamp from,
+                             timestamp to) {
+  std::vector<uuid> result;
+  auto& segments = self->state.segments;
+  auto ones = select(bm);
+  while (ones) {
+    auto i = segments.lower_bound(ones.get());
+    if (i == segments.end())
+      break;
+    if (ones.get() < i->left) {
+      // Bitmap must catch up, segment is ahead.
+      ones.skip(i->left - ones.get());
+      continue;
+    }
+    // Match: bitmap is within an existing segment.
+    if (overlaps(self, i->value, from, to))
+      result.push_back(i->value);
+    else
+      VAST_DEBUG(self, "prunes segment", i->value, "by time");
+    ones.skip(i->right - ones.get());
+  }
+  VAST_DEBUG(self, "processing", result.size(), "candidates");
+  return result;
+}
+
+// The number of recent cache misses we remember for admission decisions.
+constexpr size_t max_misses = 128;
+
+// Decides whether to cache a segment that we just loaded after a miss.
+template <class Actor>
+bool admit(Actor* self, uuid const& id, uint64_t size) {
+  auto& st = self->state;
+  if (!st.admission)
+    return true;
+  // As long as there is room, caching never hurts.
+  if (st.cache.weight() + size <= st.cache.capacity())
+    return true;
+  // Otherwise we only evict hot segments for a segment that missed before.
+  auto i = std::find(st.misses.begin(), st.misses.end(), id);
+  if (i != st.misses.end()) {
+    st.misses.erase(i);
+    return true;
+  }
+  st.misses.push_back(id);
+  if (st.misses.size() > max_misses)
+    st.misses.pop_front();
+  return false;
+}
+
+template <class Actor>
+void report_cache(Actor* self) {
+  auto& st = self->state;
+  if (!st.accountant)
+    return;
+  uint64_t resident = st.cache.weight();
+  self->send(st.accountant, "archive.cache.hits", st.cache_hits);
+  self->send(st.accountant, "archive.cache.misses", st.cache_misses);
+  self->send(st.accountant, "archive.cache.evictions", st.cache_evictions);
+  self->send(st.accountant, "archive.cache.resident", resident);
+}
+
+// Extracts the events in a single candidate segment.
+template <class Actor>
+expected<std::vector<event>> extract(Actor* self, uuid const& id,
+                                     bitmap const& bm, timestamp from,
+                                     timestamp to) {
+  segment const* s;
+  segment uncached;
+  // If the segment turns out to be the active segment, we can
+  // can query it immediately.
+  auto unwritten = self->state.unwritten.find(id);
+  if (id == self->state.active.id()) {
+    VAST_DEBUG(self, "looking into active segment");
+    s = &self->state.active;
+  } else if (unwritten != self->state.unwritten.end()) {
+    // The same holds for segments that are still on their way to disk.
+    VAST_DEBUG(self, "looking into unwritten segment", id);
+    s = unwritten->second.get();
+  } else {
+    // Otherwise we look into the cache.
+    s = self->state.cache.lookup(id);
+    if (s) {
+      VAST_DEBUG(self, "got cache hit for segment", id);
+      ++self->state.cache_hits;
+    } else {
+      VAST_DEBUG(self, "got cache miss for segment", id);
+      ++self->state.cache_misses;
+      auto filename = self->state.dir / to_string(id);
+      auto seg = segment::open(filename);
+      if (!seg)
+        return seg.error();
+      if (admit(self, id, resident(*seg))) {
+        s = self->state.cache.insert(id, std::move(*seg)).first;
+      } else {
+        VAST_DEBUG(self, "bypasses cache for segment", id);
+        uncached = std::move(*seg);
+        s = &uncached;
+      }
+    }
+  }
+  VAST_ASSERT(s != nullptr);
+  auto xs = s->extract(bm, from, to);
+  if (!xs)
+    VAST_ERROR(self, self->system().render(xs.error()));
+  // A mapped segment grows by the batches it had to decode.
+  self->state.cache.reweigh(id);
+  return xs;
+}
+
+// Asks the PREFETCHER to page in a segment. Since we process candidates in
+// reverse order, we skip the first *n* from the back, which we are about to
+// extract from anyway.
+template <class Actor>
+void prefetch(Actor* self, std::vector<uuid> const& ids, bitmap const& bm,
+              size_t n = 0) {
+  for (auto c = ids.rbegin() + std::min(ids.size(), n); c != ids.rend(); ++c)
+    if (*c != self->state.active.id() && !self->state.unwritten.count(*c)) {
+      auto filename = self->state.dir / to_string(*c);
+      self->send(self->state.prefetcher, filename.str(), bm);
+    }
+}
+
+template <class Actor>
+expected<std::vector<event>> lookup(Actor* self, bitmap const& bm,
+                                    timestamp from, timestamp to) {
+  auto ids = candidates(self, bm, from, to);
+  prefetch(self, ids, bm, 1);
+  // Process candidates *in reverse order* to get maximum LRU cache hits.
+  std::vector<event> result;
+  for (auto c = ids.rbegin(); c != ids.rend(); ++c) {
+    auto xs = extract(self, *c, bm, from, to);
+    if (!xs)
+      return xs.error();
+    result.reserve(result.size() + xs->size());
+    std::move(xs->begin(), xs->end(), std::back_inserter(result));
+  }
+  report_cache(self);
+  VAST_DEBUG(self, "delivers", result.size(), "events");
+  return result;
+}
+
+// Ships the events of each candidate segment to a sink as soon as we have
+// extracted them, followed by a completion message.
+template <class Actor>
+void stream(Actor* self, bitmap const& bm, timestamp from, timestamp to,
+            caf::actor const& sink) {
+  auto ids = candidates(self, bm, from, to);
+  prefetch(self, ids, bm, 1);
+  uint64_t shipped = 0;
+  for (auto c = ids.rbegin(); c != ids.rend(); ++c) {
+    auto xs = extract(self, *c, bm, from, to);
+    if (!xs) {
+      self->send(sink, xs.error());
+      return;
+    }
+    if (xs->empty())
+      continue;
+    VAST_DEBUG(self, "ships", xs->size(), "events from segment", *c);
+    shipped += xs->size();
+    self->send(sink, std::move(*xs));
+  }
+  report_cache(self);
+  VAST_DEBUG(self, "completes streaming lookup with", shipped, "events");
+  self->send(sink, done_atom::value, shipped);
+}
+
+// Parks a lookup until the batches it waits for have arrived. Meanwhile, the
+// PREFETCHER pages in the segments that already hold some of its IDs.
+template <class Actor>
+void defer(Actor* self, deferred_lookup x) {
+  prefetch(self, candidates(self, x.ids, x.from, x.to), x.ids);
+  self->state.deferred_lookups.push_back(std::move(x));
+}
+
+template <class Actor>
+void flush(Actor* self, archive_state::flush_promise& rp) {
+  auto result = flush_active_segment(self);
+  if (!result) {
+    rp.deliver(result.error());
+    self->quit(result.error());
+    return;
+  }
+  // The WRITER answers once everything up to here has become durable.
+  self->request(self->state.writer, caf::infinite, flush_atom::value).then(
+    [=](ok_atom) mutable {
+      rp.deliver(ok_atom::value);
+    },
+    [=](caf::error& e) mutable {
+      rp.deliver(e);
+      self->quit(std::move(e));
+    }
+  );
+}
+
+// Appends all batches that have come back from the compressors in sequence,
+// and then serves the requests that waited for them.
+template <class Actor>
+void drain(Actor* self) {
+  auto& st = self->state;
+  while (!st.pending.empty() && st.pending.begin()->second.sealed) {
+    auto i = st.pending.begin();
+    auto result = append(self, std::move(*i->second.sealed),
+                         i->second.first, i->second.last,
+                         i->second.dictionary);
+    auto promise = std::move(i->second.promise);
+    st.pending.erase(i);
+    if (!result) {
+      promise.deliver(result.error());
+      self->quit(result.error());
+      return;
+    }
+    promise.deliver(ok_atom::value);
+  }
+  if (!st.deferred_lookups.empty()) {
+    auto lookups = std::move(st.deferred_lookups);
+    st.deferred_lookups.clear();
+    for (auto& x : lookups) {
+      if (!can_lookup(self, x.ids)) {
+        st.deferred_lookups.push_back(std::move(x));
+      } else if (x.sink) {
+        stream(self, x.ids, x.from, x.to, x.sink);
+      } else {
+        auto result = lookup(self, x.ids, x.from, x.to);
+        if (result)
+          x.promise.deliver(std::move(*result));
+        else
+          x.promise.deliver(result.error());
+      }
+    }
+  }
+  if (!st.pending.empty())
+    return;
+  auto flushes = std::move(st.deferred_flushes);
+  st.deferred_flushes.clear();
+  for (auto& rp : flushes)
+    flush(self, rp);
+  // An ongoing compaction calls back into here once it has finished.
+  if (st.shutting_down && !st.compacting) {
+    auto result = flush_active_segment(self);
+    if (!result) {
+      self->quit(result.error());
+      return;
+    }
+    self->request(st.writer, caf::infinite, flush_atom::value).then(
+      [=](ok_atom) {
+        self->quit(caf::exit_reason::user_shutdown);
+      },
+      [=](caf::error& e) {
+        self->quit(std::move(e));
+      }
+    );
+  }
+}
 
 } // namespace <anonymous>
 
 archive_type::behavior_type
 archive(archive_type::stateful_pointer<archive_state> self,
-        path dir, size_t capacity, size_t max_segment_size) {
+        path dir, size_t capacity, size_t max_segment_size,
+        size_t compressors, compression method, int level, bool train,
+        size_t block_size, batch::layout layout) {
   VAST_ASSERT(max_segment_size > 0);
+  VAST_ASSERT(block_size > 0);
   self->state.dir = std::move(dir);
   self->state.max_segment_size = max_segment_size;
+  self->state.method = method;
+  self->state.level = level;
+  self->state.train = train;
+  self->state.block_size = block_size;
+  self->state.layout = layout;
   self->state.cache.capacity(capacity);
+  self->state.cache.weigh([](segment const& x) { return resident(x); });
   self->state.cache.on_evict(
     [=](uuid const& id, segment&) {
       VAST_DEBUG(self, "evicts cache entry: segment", id);
+      ++self->state.cache_evictions;
     }
   );
   // Load meta data about existing segments.
   if (exists(self->state.dir / "meta")) {
-    auto t = load(self->state.dir / "meta", self->state.segments);
+    auto t = load(self->state.dir / "meta", self->state.segments,
+                  self->state.bounds);
     if (!t) {
       VAST_ERROR(self, "failed to unarchive meta data:",
                  self->system().render(t.error()));
       self->quit(t.error());
     }
   }
+  // Replay the changes since the last snapshot.
+  if (exists(self->state.dir / "journal")) {
+    auto deltas = load_journal(self->state.dir / "journal");
+    if (!deltas) {
+      VAST_ERROR(self, "failed to replay meta data journal:",
+                 self->system().render(deltas.error()));
+      self->quit(deltas.error());
+    } else {
+      for (auto& x : *deltas)
+        apply(self->state, x);
+      self->state.journaled = deltas->size();
+      VAST_DEBUG(self, "replayed", deltas->size(), "journal records");
+    }
+  }
+  self->state.writer =
+    self->spawn<caf::detached + caf::linked>(writer, self->state.dir);
+  self->state.prefetcher =
+    self->spawn<caf::detached + caf::linked>(prefetcher);
+  self->state.compactor =
+    self->spawn<caf::detached + caf::linked>(compactor, self->state.dir,
+                                             self->state.method,
+                                             self->state.block_size,
+                                             self->state.level,
+                                             self->state.layout,
+                                             self->state.train,
+                                             max_segment_size);
+  for (auto i = 0u; i < compressors; ++i)
+    self->state.compressors.push_back(
+      self->spawn<caf::linked>(compressor, self->state.method,
+                               self->state.block_size, self->state.layout,
+                               self->state.level));
+  auto handle_lookup = [=](bitmap const& bm, timestamp from, timestamp to) {
+    VAST_DEBUG(self, "got query in range ["
+               << select(bm, 1) << ',' << (select(bm, -1) + 1) << ')');
+    auto rp = self->make_response_promise<archive_state::lookup_promise>();
+    // Lookups that touch IDs still at a compressor must wait.
+    if (!can_lookup(self, bm)) {
+      VAST_DEBUG(self, "defers lookup until pending batches arrive");
+      defer(self, {bm, from, to, rp, {}});
+      return rp;
+    }
+    auto result = lookup(self, bm, from, to);
+    if (result)
+      rp.deliver(std::move(*result));
+    else
+      rp.deliver(result.error());
+    return rp;
+  };
+  auto handle_stream = [=](bitmap const& bm, timestamp from, timestamp to,
+                           caf::actor const& sink) {
+    VAST_DEBUG(self, "got streaming query for", sink, "in range ["
+               << select(bm, 1) << ',' << (select(bm, -1) + 1) << ')');
+    if (!can_lookup(self, bm)) {
+      VAST_DEBUG(self, "defers lookup until pending batches arrive");
+      defer(self, {bm, from, to, {}, sink});
+      return;
+    }
+    stream(self, bm, from, to, sink);
+  };
   return {
     [=](shutdown_atom) {
-      flush_active_segment(self);
-      self->quit(caf::exit_reason::user_shutdown);
+      // Wait for outstanding batches before writing the last segment.
+      self->state.shutting_down = true;
+      if (self->state.pending.empty())
+        drain(self);
     },
     [=](accountant_type const& acc) {
       VAST_DEBUG(self, "registers accountant#" << acc->id());
       self->state.accountant = acc;
+      self->send(self->state.writer, acc);
+      for (auto& c : self->state.compressors)
+        self->send(c, acc);
     },
-    [=](std::vector<event> const& events) {
+    [=](std::vector<event> const& events) -> archive_state::batch_promise {
       VAST_ASSERT(!events.empty());
+      auto rp = self->make_response_promise<archive_state::batch_promise>();
       // Ensure that all events have strictly monotonic IDs
       auto non_monotonic = [](auto& x, auto& y) {
         return x.id() != y.id() - 1;
@@ -151,134 +1352,86 @@ archive(archive_type::stateful_pointer<archive_state> self,
       if (!valid) {
         VAST_WARNING(self, "ignores", events.size(),
                      "events with non-monotonic IDs");
-        return;
+        rp.deliver(ok_atom::value);
+        return rp;
       }
-      // Construct a batch from the events.
       auto first_id = events.front().id();
       auto last_id  = events.back().id();
       VAST_DEBUG(self, "got", events.size(),
                  "events [" << first_id << ',' << (last_id + 1) << ')');
-      auto start = steady_clock::now();
-      batch::writer writer{compression::lz4};
-      for (auto& e : events)
-        if (!writer.write(e)) {
-          self->quit(make_error(ec::unspecified, "failed to create batch"));
-          return;
+      auto dict = dictionary(self, events);
+      // Without compressors, we construct the batch ourselves.
+      if (self->state.compressors.empty()) {
+        auto b = make_batch(self, events, self->state.method,
+                            self->state.block_size, self->state.layout,
+                            self->state.level, dict);
+        if (!b) {
+          rp.deliver(b.error());
+          self->quit(b.error());
+          return rp;
         }
-      auto b = writer.seal();
-      b.ids(first_id, last_id + 1);
-      auto stop = steady_clock::now();
-      if (self->state.accountant) {
-        auto runtime = stop - start;
-        auto unit = duration_cast<microseconds>(runtime).count();
-        auto rate = events.size() * 1e6 / unit;
-        self->send(self->state.accountant, "archive.compression.rate", rate);
-        uint64_t num = events.size();
-        self->send(self->state.accountant, "archive.events.per.batch", num);
-      }
-      // If the batch would cause the segment to exceed its maximum size, then
-      // flush the active segment and append the batch to the new one.
-      auto too_big = bytes(self->state.active) >= self->state.max_segment_size;
-      auto empty = bytes(self->state.active) == 0;
-      if (!empty && too_big) {
-        auto result = flush_active_segment(self);
-        if (!result) {
+        auto result = append(self, std::move(*b), first_id, last_id, dict);
+        if (result) {
+          rp.deliver(ok_atom::value);
+        } else {
+          rp.deliver(result.error());
           self->quit(result.error());
-          return;
         }
+        return rp;
       }
-      auto active_id = self->state.active.id();
-      self->state.segments.inject(first_id, last_id + 1, active_id);
-      self->state.active.add(std::move(b));
-    },
-    [=](flush_atom) -> flush_promise {
-      auto rp = self->make_response_promise<flush_promise>();
-      auto result = flush_active_segment(self);
-      if (!result) {
-        rp.deliver(result.error());
-        self->quit(result.error());
-      } else {
-        rp.deliver(ok_atom::value);
-      }
+      // Otherwise we hand the events off to the next compressor and keep
+      // track of the batch so that we append it in sequence.
+      auto& st = self->state;
+      auto seq = st.next_sequence++;
+      st.pending.emplace(seq, pending_batch{first_id, last_id, dict, {}, rp});
+      if (st.accountant)
+        self->send(st.accountant, "archive.pending",
+                   uint64_t{st.pending.size()});
+      auto n = st.next_compressor++ % st.compressors.size();
+      auto& worker = st.compressors[n];
+      auto msg = self->current_mailbox_element()->move_content_to_message();
+      self->request(worker, caf::infinite, std::move(msg)).then(
+        [=](batch& b) {
+          auto i = self->state.pending.find(seq);
+          VAST_ASSERT(i != self->state.pending.end());
+          i->second.sealed = std::move(b);
+          drain(self);
+        },
+        [=](caf::error& e) {
+          VAST_ERROR(self, "failed to compress batch:",
+                     self->system().render(e));
+          self->quit(std::move(e));
+        }
+      );
       return rp;
     },
-    [=](bitmap const& bm) -> lookup_promise {
-      VAST_DEBUG(self, "got query in range ["
-                 << select(bm, 1) << ',' << (select(bm, -1) + 1) << ')');
-      auto rp = self->make_response_promise<lookup_promise>();
-      // Collect candidate segments by seeking through the query bitmap and
-      // probing each ID interval.
-      std::vector<uuid const*> candidates;
-      auto ones = select(bm);
-      auto i = self->state.segments.begin();
-      auto end = self->state.segments.end();
-      while (ones && i != end) {
-        if (ones.get() < i->left) {
-          // Bitmap must catch up, segment is ahead.
-          ones.skip(i->left - ones.get());
-        } else if (ones.get() < i->right) {
-          // Match: bitmap is within an existing segment.
-          candidates.push_back(&i->value);
-          ones.skip(i->right - ones.get());
-          ++i;
-        } else {
-          // Segment must catch up, bitmap is ahead.
-          ++i;
-        }
-      }
-      // Process candidates *in reverse order* to get maximum LRU cache hits.
-      std::vector<event> result;
-      VAST_DEBUG(self, "processing", candidates.size(), "candidates");
-      for (auto c = candidates.rbegin(); c != candidates.rend(); ++c) {
-        segment* s;
-        // If the segment turns out to be the active segment, we can
-        // can query it immediately.
-        if (**c == self->state.active.id()) {
-          VAST_DEBUG(self, "looking into active segment");
-          s = &self->state.active;
-        } else {
-          // Otherwise we look into the cache.
-          s = self->state.cache.lookup(**c);
-          if (s) {
-            VAST_DEBUG(self, "got cache hit for segment", **c);
-          } else {
-            VAST_DEBUG(self, "got cache miss for segment", **c);
-            auto filename = self->state.dir / to_string(**c);
-            segment::magic_type m;
-            segment::version_type v;
-            segment seg;
-            auto result = load(filename, m, v, seg);
-            if (!result) {
-              rp.deliver(result.error());
-              return rp;
-            }
-            if (m != segment::magic) {
-              rp.deliver(make_error(ec::unspecified, "segment magic error"));
-              return rp;
-            }
-            if (v < segment::version) {
-              rp.deliver(make_error(ec::version_error, v, segment::version));
-              return rp;
-            }
-            self->state.cache.insert(**c, std::move(seg));
-            s = self->state.cache.lookup(**c);
-          }
-        }
-        // Perform lookup in segment and append extracted events to result.
-        VAST_ASSERT(s != nullptr);
-        auto xs = s->extract(bm);
-        if (!xs) {
-          VAST_ERROR(self, self->system().render(xs.error()));
-          rp.deliver(xs.error());
-          return rp;
-        }
-        result.reserve(result.size() + xs->size());
-        std::move(xs->begin(), xs->end(), std::back_inserter(result));
-      }
-      VAST_DEBUG(self, "delivers", result.size(), "events");
-      rp.deliver(std::move(result));
+    [=](flush_atom) -> archive_state::flush_promise {
+      auto rp = self->make_response_promise<archive_state::flush_promise>();
+      if (self->state.pending.empty())
+        flush(self, rp);
+      else
+        self->state.deferred_flushes.push_back(rp);
       return rp;
     },
+    [=](bitmap const& bm) -> archive_state::lookup_promise {
+      return handle_lookup(bm, timestamp::min(), timestamp::max());
+    },
+    [=](bitmap const& bm, timestamp from, timestamp to)
+    -> archive_state::lookup_promise {
+      return handle_lookup(bm, from, to);
+    },
+    [=](prefetch_atom, bitmap const& bm) {
+      auto ids = candidates(self, bm, timestamp::min(), timestamp::max());
+      VAST_DEBUG(self, "prefetches", ids.size(), "segments");
+      prefetch(self, ids, bm);
+    },
+    [=](bitmap const& bm, caf::actor const& sink) {
+      handle_stream(bm, timestamp::min(), timestamp::max(), sink);
+    },
+    [=](bitmap const& bm, timestamp from, timestamp to,
+        caf::actor const& sink) {
+      handle_stream(bm, from, to, sink);
+    },
   };
 }
 
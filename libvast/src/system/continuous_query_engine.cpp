@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+
+#include "vast/detail/assert.hpp"
+#include "vast/event.hpp"
+#include "vast/expression_visitors.hpp"
+
+#include "vast/system/continuous_query_engine.hpp"
+
+namespace vast {
+namespace system {
+namespace {
+
+// Tailors a predicate to an event type. The result is none if no event of the
+// type can satisfy the predicate.
+expression resolve(predicate const& pred, type const& t) {
+  auto x = visit(key_resolver{t}, expression{pred});
+  if (!x)
+    return {};
+  return visit(type_resolver{t}, *x);
+}
+
+} // namespace <anonymous>
+
+bool continuous_query_engine::add(expression const& expr) {
+  if (queries_.count(expr) > 0)
+    return false;
+  auto preds = visit(predicatizer{}, expr);
+  std::sort(preds.begin(), preds.end());
+  preds.erase(std::unique(preds.begin(), preds.end()), preds.end());
+  for (auto& pred : preds)
+    ++predicates_[pred];
+  queries_.emplace(expr, std::move(preds));
+  return true;
+}
+
+bool continuous_query_engine::remove(expression const& expr) {
+  auto q = queries_.find(expr);
+  if (q == queries_.end())
+    return false;
+  for (auto& pred : q->second) {
+    auto i = predicates_.find(pred);
+    VAST_ASSERT(i != predicates_.end());
+    if (--i->second == 0)
+      predicates_.erase(i);
+  }
+  queries_.erase(q);
+  return true;
+}
+
+bool continuous_query_engine::empty() const {
+  return queries_.empty();
+}
+
+size_t continuous_query_engine::size() const {
+  return queries_.size();
+}
+
+size_t continuous_query_engine::predicates() const {
+  return predicates_.size();
+}
+
+std::vector<std::pair<expression, bitmap>>
+continuous_query_engine::evaluate(std::vector<event> const& events) const {
+  std::vector<std::pair<expression, bitmap>> result;
+  if (queries_.empty() || events.empty())
+    return result;
+  // We evaluate every predicate exactly once per event and record the
+  // outcome in one bitmap per predicate. The mask marks the events of the
+  // batch.
+  std::map<predicate, bitmap> hits;
+  std::vector<bitmap*> columns;
+  columns.reserve(predicates_.size());
+  for (auto& x : predicates_)
+    columns.push_back(&hits[x.first]);
+  bitmap mask;
+  // Batches tend to consist of runs of the same type, for which we resolve
+  // all predicates only once.
+  std::unordered_map<std::string, std::vector<expression>> resolved;
+  std::vector<expression> const* checkers = nullptr;
+  std::string const* current = nullptr;
+  for (auto& e : events) {
+    VAST_ASSERT(e.id() != invalid_event_id);
+    VAST_ASSERT(e.id() >= mask.size());
+    if (current == nullptr || *current != e.type().name()) {
+      auto i = resolved.find(e.type().name());
+      if (i == resolved.end()) {
+        std::vector<expression> xs;
+        xs.reserve(predicates_.size());
+        for (auto& x : predicates_)
+          xs.push_back(resolve(x.first, e.type()));
+        i = resolved.emplace(e.type().name(), std::move(xs)).first;
+      }
+      current = &i->first;
+      checkers = &i->second;
+    }
+    mask.append_bits(false, e.id() - mask.size());
+    mask.append_bit(true);
+    for (size_t i = 0; i < columns.size(); ++i) {
+      auto& bm = *columns[i];
+      bm.append_bits(false, e.id() - bm.size());
+      bm.append_bit(visit(event_evaluator{e}, (*checkers)[i]));
+    }
+  }
+  // Combine the predicate hits into the hits of each query.
+  auto evaluator = make_bitmap_evaluator<bitmap>(
+    [&](predicate const& pred) -> bitmap const* {
+      auto i = hits.find(pred);
+      return i == hits.end() ? nullptr : &i->second;
+    }
+  );
+  for (auto& q : queries_) {
+    auto bm = visit(evaluator, q.first);
+    if (bm.empty())
+      continue;
+    // A negation also flips the bits before the first event of the batch.
+    bm &= mask;
+    if (!all<0>(bm))
+      result.emplace_back(q.first, std::move(bm));
+  }
+  return result;
+}
+
+} // namespace system
+} // namespace vast
@@ -44,6 +44,22 @@ void ship_results(Actor* self) {
     self->send(s, msg);
 }
 
+template <class Actor>
+void complete(Actor* self);
+
+// Completes the export once the INDEX has reported all hits, the ARCHIVE has
+// answered all lookups, and the sinks have taken all results. A finished
+// lookup also accounts for IDs that the ARCHIVE did not return, e.g.,
+// because they fall outside the time interval of the query.
+template <class Actor>
+void try_complete(Actor* self) {
+  auto& st = self->state;
+  if (st.lookups == 0)
+    st.unprocessed = {};
+  if (st.index_done && rank(st.unprocessed) == 0 && st.results.empty())
+    complete(self);
+}
+
 template <class Actor>
 void complete(Actor* self) {
   timespan runtime = steady_clock::now() - self->state.start;
@@ -81,6 +97,8 @@ behavior exporter(stateful_actor<exporter_state>* self, expression expr,
         return;
     }
   );
+  // Time constraints in the query let the archive skip entire segments.
+  auto interval = visit(time_bounder{}, normalize(expr));
   auto operating = behavior{
     [=](bitmap& hits) {
       timespan runtime = steady_clock::now() - self->state.start;
@@ -95,9 +113,29 @@ behavior exporter(stateful_actor<exporter_state>* self, expression expr,
                  << select(hits, 1) << ',' << (select(hits, -1) + 1) << ')');
       self->state.hits |= hits;
       self->state.unprocessed |= hits;
+      ++self->state.lookups;
       VAST_DEBUG(self, "forwards hits to archive");
       // FIXME: restrict according to configured limit.
-      self->send(self->state.archive, std::move(hits));
+      // We ask the archive to stream the events per segment, so that we can
+      // start checking candidates before the full lookup completes.
+      self->send(self->state.archive, std::move(hits), interval.first,
+                 interval.second, actor_cast<actor>(self));
+    },
+    [=](done_atom, uint64_t shipped) {
+      VAST_DEBUG(self, "completed archive lookup with", shipped, "events");
+      VAST_ASSERT(self->state.lookups > 0);
+      --self->state.lookups;
+      try_complete(self);
+    },
+    [=](caf::error& e) {
+      // A failed lookup concludes without a done_atom. The events it did not
+      // ship are lost, so the query cannot complete.
+      VAST_ERROR(self, "failed archive lookup:", self->system().render(e));
+      VAST_ASSERT(self->state.lookups > 0);
+      --self->state.lookups;
+      for (auto& s : self->state.sinks)
+        self->send(s, e);
+      self->quit(std::move(e));
     },
     [=](std::vector<event>& candidates) {
       VAST_DEBUG(self, "got batch of", candidates.size(), "events");
@@ -133,6 +171,7 @@ behavior exporter(stateful_actor<exporter_state>* self, expression expr,
       }
       self->state.requested = max_events;
       ship_results(self);
+      try_complete(self);
     },
     [=](extract_atom, uint64_t requested) {
       if (self->state.requested == max_events) {
@@ -144,6 +183,7 @@ behavior exporter(stateful_actor<exporter_state>* self, expression expr,
       VAST_DEBUG(self, "got request to extract", n, "new events in addition to",
                  self->state.requested, "pending results");
       ship_results(self);
+      try_complete(self);
     },
     [=](progress_atom, uint64_t remaining, uint64_t total) {
       self->state.progress = (total - double(remaining)) / total;
@@ -155,8 +195,8 @@ behavior exporter(stateful_actor<exporter_state>* self, expression expr,
       VAST_DEBUG(self, "completed index interaction in", runtime);
       if (self->state.accountant)
         self->send(self->state.accountant, "exporter.hits.runtime", runtime);
-      if (rank(self->state.unprocessed) == 0 && self->state.results.empty())
-        complete(self);
+      self->state.index_done = true;
+      try_complete(self);
     },
   };
   return {
@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include "vast/concept/printable/vast/error.hpp"
 #include "vast/logger.hpp"
 
@@ -9,6 +11,62 @@ using namespace caf;
 namespace vast {
 namespace system {
 
+namespace {
+
+// Reports the depth of the queues between IMPORTER and its neighbors.
+void report(stateful_actor<importer_state>* self) {
+  auto& st = self->state;
+  if (!st.accountant)
+    return;
+  self->send(st.accountant, "importer.archive.in_flight",
+             st.archive_in_flight);
+  self->send(st.accountant, "importer.index.in_flight", st.index_in_flight);
+  self->send(st.accountant, "importer.stalled", uint64_t{st.stalled.size()});
+}
+
+// Grants credit to waiting SOURCEs as long as ARCHIVE and INDEX keep up.
+void release(stateful_actor<importer_state>* self) {
+  auto& st = self->state;
+  while (!st.stalled.empty()
+         && std::max(st.archive_in_flight, st.index_in_flight)
+              < importer_state::max_in_flight) {
+    st.stalled.front().deliver(ok_atom::value);
+    st.stalled.pop_front();
+  }
+}
+
+// Relays events to ARCHIVE and INDEX and waits for their acknowledgement.
+void ship(stateful_actor<importer_state>* self, std::vector<event>&& events) {
+  auto& st = self->state;
+  auto n = uint64_t{events.size()};
+  auto msg = make_message(std::move(events));
+  st.archive_in_flight += n;
+  st.index_in_flight += n;
+  auto on_error = [=](error& e) {
+    VAST_ERROR(self, "failed to relay events:", self->system().render(e));
+    self->quit(std::move(e));
+  };
+  // FIXME: how to make this type-safe?
+  auto archive = actor_cast<actor>(st.archive);
+  self->request(archive, infinite, msg).then(
+    [=](ok_atom) {
+      self->state.archive_in_flight -= n;
+      release(self);
+    },
+    on_error
+  );
+  self->request(st.index, infinite, msg).then(
+    [=](ok_atom) {
+      self->state.index_in_flight -= n;
+      release(self);
+    },
+    on_error
+  );
+  report(self);
+}
+
+} // namespace <anonymous>
+
 behavior importer(stateful_actor<importer_state>* self) {
   return {
     [=](down_msg const& msg) {
@@ -34,6 +92,10 @@ behavior importer(stateful_actor<importer_state>* self) {
       self->monitor(a);
       self->state.index = a;
     },
+    [=](accountant_type const& acc) {
+      VAST_DEBUG(self, "registers accountant", acc);
+      self->state.accountant = acc;
+    },
     [=](std::vector<event>& events) {
       VAST_DEBUG(self, "got", events.size(), "events");
       if (!self->state.identifier) {
@@ -48,6 +110,9 @@ behavior importer(stateful_actor<importer_state>* self) {
         self->quit(make_error(ec::unspecified, "no index configured"));
         return;
       }
+      // The SOURCE gets credit for its next batch once ARCHIVE and INDEX have
+      // caught up.
+      self->state.stalled.push_back(self->make_response_promise());
       event_id needed = events.size();
       self->state.batch = std::move(events);
       self->send(self->state.identifier, request_atom::value, needed);
@@ -67,11 +132,7 @@ behavior importer(stateful_actor<importer_state>* self) {
                 std::make_move_iterator(self->state.batch.begin() + n),
                 std::make_move_iterator(self->state.batch.end()));
               self->state.batch.resize(n);
-              auto msg = make_message(std::move(self->state.batch));
-              // FIXME: how to make this type-safe?
-              auto archive = actor_cast<actor>(self->state.archive);
-              self->send(archive, msg);
-              self->send(self->state.index, msg);
+              ship(self, std::move(self->state.batch));
               self->state.batch = std::move(remainder);
             }
             VAST_DEBUG(self, "asks for more IDs: got", self->state.got,
@@ -80,13 +141,11 @@ behavior importer(stateful_actor<importer_state>* self) {
                        needed - self->state.got);
           } else {
             // Ship the batch directly if we got enough IDs.
-            auto msg = make_message(std::move(self->state.batch));
-            // FIXME: how to make this type-safe?
-            auto archive = actor_cast<actor>(self->state.archive);
-            self->send(archive, msg);
-            self->send(self->state.index, msg);
+            ship(self, std::move(self->state.batch));
+            self->state.batch = {};
             self->state.got = 0;
             self->unbecome();
+            release(self);
           }
         }
       );
@@ -1,3 +1,5 @@
+#include <fstream>
+
 #include <caf/all.hpp>
 
 #include "vast/concept/printable/to_string.hpp"
@@ -27,97 +29,127 @@ namespace system {
 
 namespace {
 
+// The number of completed historical queries whose results we keep.
+constexpr size_t max_cached_results = 64;
+
+// The meta data file begins with a magic number and version, so that files
+// in an older format fail to load cleanly.
+constexpr uint32_t meta_magic = 0x766d6574; // "vmet"
+constexpr uint32_t meta_version = 2;
+
+// Spawns a passive partition and puts it into the cache.
+actor spawn_passive(stateful_actor<index_state>* self, uuid const& part) {
+  VAST_DEBUG(self, "spawns passive partition", part);
+  auto p = self->spawn<monitored>(partition,
+                                  self->state.dir / to_string(part), self);
+  if (self->state.accountant)
+    self->send(p, self->state.accountant);
+  self->state.passive.insert(part, p);
+  return p;
+}
+
+// Ensures that there is room for another passive partition. If all slots are
+// taken, we unload a passive partition without outstanding queries. Returns
+// `false` if every passive partition is still busy.
+bool make_room(stateful_actor<index_state>* self) {
+  auto& passive = self->state.passive;
+  if (passive.size() < passive.capacity())
+    return true;
+  for (auto x : passive) {
+    if (self->state.running.count(x.first) > 0)
+      continue;
+    VAST_DEBUG(self, "unloads idle partition", x.first);
+    auto id = x.first;
+    auto p = x.second;
+    passive.erase(id);
+    self->send(p, shutdown_atom::value);
+    return true;
+  }
+  return false;
+}
+
+// Returns the partition that can answer a historical query right away. If the
+// partition is neither in memory nor loadable, the query waits for it in the
+// scheduler.
 actor dispatch(stateful_actor<index_state>* self, uuid const& part,
-               expression const& expr) {
+               expression const& expr, query_scheduler::priority prio) {
   if (self->state.partitions[part].events == 0)
     return {};
-  // If the partition is already scheduled, we add the expression to the set of
-  // to-be-queried expressions.
-  auto i = std::find_if(self->state.schedule.begin(),
-                        self->state.schedule.end(),
-                        [&](auto& s) { return s.part == part; });
-  if (i == self->state.schedule.end()) {
-    VAST_DEBUG(self, "enqueues partition", part, "with", expr);
-    self->state.schedule.push_back(schedule_state{part, {expr}});
-  } else {
-    VAST_DEBUG(self, "adds expression to", part << ":", expr);
-    i->queries.insert(expr);
-  }
-  // If the partition is in memory, we send it the expression directly.
+  actor result;
   if (part == self->state.active_id)
-    return self->state.active;
-  if (auto p = self->state.passive.lookup(part))
-    return *p;
-  // If we have not fully maxed out our available passive partitions, we can
-  // spawn the partition directly.
-  if (self->state.passive.size() < self->state.passive.capacity()) {
-    VAST_DEBUG(self, "spawns passive partition", part);
-    auto p = self->spawn<monitored>(partition,
-                                    self->state.dir / to_string(part), self);
-    if (self->state.accountant)
-      self->send(p, self->state.accountant);
-    self->state.passive.insert(part, p);
-    return p;
+    result = self->state.active;
+  else if (auto p = self->state.passive.lookup(part))
+    result = *p;
+  // As long as other queries wait for partitions, free slots go to them.
+  else if (self->state.scheduler.empty() && make_room(self))
+    result = spawn_passive(self, part);
+  if (!result) {
+    VAST_DEBUG(self, "enqueues partition", part, "for", expr);
+    self->state.scheduler.enqueue(part, expr, prio);
+    return {};
+  }
+  VAST_DEBUG(self, "adds expression to", part << ':', expr);
+  self->state.running[part].insert(expr);
+  return result;
+}
+
+// Loads the next partitions from the scheduler while there is room for them
+// and relays all waiting queries to each of them.
+void schedule(stateful_actor<index_state>* self) {
+  auto& st = self->state;
+  while (!st.scheduler.empty() && make_room(self)) {
+    auto job = st.scheduler.next();
+    VAST_ASSERT(job);
+    VAST_DEBUG(self, "schedules partition", job->partition, "for",
+               job->queries.size(), "queries");
+    auto p = spawn_passive(self, job->partition);
+    auto& running = st.running[job->partition];
+    for (auto& x : job->queries) {
+      auto q = st.queries.find(x.first);
+      VAST_ASSERT(q != st.queries.end());
+      VAST_ASSERT(q->second.hist);
+      auto& hist = *q->second.hist;
+      running.insert(x.first);
+      hist.parts.emplace(p->address(), job->partition);
+      hist.sealed.insert(job->partition);
+      self->send(hist.task, p);
+      self->send(p, x.first, historical_atom::value);
+      // The index stops holding the task open once the query no longer waits
+      // for partitions.
+      if (!st.scheduler.contains(x.first))
+        self->send(hist.task, done_atom::value, self->address());
+      if (st.accountant)
+        self->send(st.accountant, "index.scheduler.wait", x.second);
+    }
   }
-  return {};
+  if (st.accountant)
+    self->send(st.accountant, "index.scheduler.queue",
+               uint64_t{st.scheduler.size()});
 }
 
 void consolidate(stateful_actor<index_state>* self, uuid const& part,
                  expression const& expr) {
   VAST_DEBUG(self, "consolidates", part, "for", expr);
-  auto i = std::find_if(self->state.schedule.begin(),
-                        self->state.schedule.end(),
-                        [&](auto& s) { return s.part == part; });
-  // Remove the completed query expression from the schedule.
-  VAST_ASSERT(i != self->state.schedule.end());
-  VAST_ASSERT(!i->queries.empty());
-  auto x = i->queries.find(expr);
-  VAST_ASSERT(x != i->queries.end());
-  i->queries.erase(x);
-  // We keep the partition in the schedule as long it has outstanding queries.
-  if (!i->queries.empty()) {
+  // Remove the completed query expression from the running partition.
+  auto i = self->state.running.find(part);
+  VAST_ASSERT(i != self->state.running.end());
+  VAST_ASSERT(i->second.count(expr) > 0);
+  i->second.erase(expr);
+  // The partition keeps its slot as long as it has outstanding queries.
+  if (!i->second.empty()) {
     VAST_DEBUG(self, "got completed query", expr, "for partition",
-                  part << ',', i->queries.size(), "remaining");
-    return;
-  }
-  VAST_DEBUG(self, "removes partition from schedule:", part);
-  self->state.schedule.erase(i);
-  if (self->state.schedule.empty())
-    VAST_DEBUG(self, "finished with entire schedule");
-  // We never unload active partitions.
-  if (part == self->state.active_id)
+                  part << ',', i->second.size(), "remaining");
     return;
-  // If we're not dealing with the active partition, it must exist in the
-  // passive list, unless we dispatched an expression to an active partition
-  // and that got replaced with a new one. In the latter case the replaced
-  // partition is neither in the active nor passive set and has already being
-  // taken care of, so we can safely ignore this consolidation request.
-  if (self->state.passive.lookup(part) == nullptr)
-    return;
-  // For each consolidated passive partition, we load another new one. Because
-  // partitions can complete in any order, we have to walk through the schedule
-  // from the beginning again to find the next passive partition to load.
-  for (auto& entry : self->state.schedule) {
-    if (entry.part != self->state.active_id
-        && !self->state.passive.contains(entry.part)) {
-      VAST_DEBUG(self, "schedules next passive partition", entry.part);
-      auto p = self->spawn<monitored>(partition,
-                                      self->state.dir / to_string(entry.part),
-                                      self);
-      if (self->state.accountant)
-        self->send(p, self->state.accountant);
-      self->state.passive.insert(entry.part, p); // automatically evicts 'part'.
-      for (auto& next_expr : entry.queries) {
-        auto q = self->state.queries.find(next_expr);
-        VAST_ASSERT(q != self->state.queries.end());
-        VAST_ASSERT(q->second.hist);
-        q->second.hist->parts.emplace(p->address(), entry.part);
-        self->send(q->second.hist->task, p);
-        self->send(p, next_expr, historical_atom::value);
-      }
-      break;
-    }
   }
+  VAST_DEBUG(self, "has no more queries for partition", part);
+  self->state.running.erase(i);
+  // An idle passive partition merges its batches, unless it has done so
+  // already.
+  if (part != self->state.active_id)
+    if (auto p = self->state.passive.lookup(part))
+      self->send(*p, seal_atom::value);
+  // An idle passive partition yields its slot to waiting queries.
+  schedule(self);
 }
 
 template <class Actor>
@@ -132,7 +164,8 @@ void flush(Actor* self) {
   }
   for (auto& p : self->state.partitions)
     if (p.second.events > 0) {
-      auto res = save(self->state.dir / "meta", self->state.partitions);
+      auto res = save(self->state.dir / "meta", meta_magic, meta_version,
+                      self->state.partitions, self->state.meta);
       if (!res) {
         VAST_ERROR(self, "failed to save meta data:",
                    self->system().render(res.error()));
@@ -154,11 +187,26 @@ behavior index(stateful_actor<index_state>* self, path const& dir,
     VAST_DEBUG(self, "evicts partition", id);
     self->send(p, shutdown_atom::value);
   });
+  self->state.results.capacity(max_cached_results);
   VAST_DEBUG(self, "caps partitions at", max_events, "events");
   VAST_DEBUG(self, "uses at most", passive, "passive partitions");
   // Load partition meta data.
   if (exists(self->state.dir / "meta")) {
-    auto t = load(self->state.dir / "meta", self->state.partitions);
+    auto t = [&]() -> expected<void> {
+      auto filename = self->state.dir / "meta";
+      std::ifstream fs{filename.str()};
+      if (!fs)
+        return make_error(ec::filesystem_error, "failed to open", filename);
+      uint32_t magic = 0;
+      uint32_t version = 0;
+      auto r = load(*fs.rdbuf(), magic, version);
+      if (!r || magic != meta_magic)
+        return make_error(ec::version_error, "unversioned meta data",
+                          filename);
+      if (version != meta_version)
+        return make_error(ec::version_error, version, meta_version);
+      return load(*fs.rdbuf(), self->state.partitions, self->state.meta);
+    }();
     if (!t) {
       VAST_ERROR(self, "failed to load meta data:",
                  self->system().render(t.error()));
@@ -205,9 +253,12 @@ behavior index(stateful_actor<index_state>* self, path const& dir,
       auto& passive = self->state.passive;
       for (auto i = passive.begin(); i != passive.end(); ++i) {
         if (i->second.address() == msg.source) {
-          passive.erase(i->first);
+          auto id = i->first;
+          passive.erase(id);
+          self->state.running.erase(id);
           VAST_DEBUG(self, "shrinks passive partitions to",
                      passive.size() << '/' << passive.capacity());
+          schedule(self);
           return;
         }
       }
@@ -215,8 +266,11 @@ behavior index(stateful_actor<index_state>* self, path const& dir,
   );
   return {
     [=](std::vector<event> const& events) {
+      // The active partition acknowledges the batch on our behalf.
+      auto rp = self->make_response_promise();
       if (events.empty()) {
         VAST_WARNING(self, "got batch of empty events");
+        rp.deliver(ok_atom::value);
         return;
       }
       auto make_partition = [&] {
@@ -244,6 +298,8 @@ behavior index(stateful_actor<index_state>* self, path const& dir,
       // a single batch.
       if (active->events > 0 && active->events + events.size() > max_events) {
         VAST_DEBUG(self, "replaces active partition ", self->state.active_id);
+        self->send(self->state.active, seal_atom::value);
+        self->state.meta.seal(self->state.active_id);
         self->state.passive.insert(self->state.active_id, self->state.active);
         active = make_partition();
       }
@@ -251,30 +307,26 @@ behavior index(stateful_actor<index_state>* self, path const& dir,
       // before doing so, extract event meta data to speed up partition finding
       // when querying.
       vast::detail::flat_set<type> types;
-      auto earliest = events.front().timestamp();
-      auto latest = events.front().timestamp();
       auto find_skip_attr = [](const type& t) {
         auto i = std::find(t.attributes().begin(), t.attributes().end(),
                            attribute{"skip"});
         return i != t.attributes().end();
       };
-      for (auto& e : events) {
+      for (auto& e : events)
         if (!find_skip_attr(e.type()))
           types.insert(e.type());
-        if (e.timestamp() < earliest)
-          earliest = e.timestamp();
-        if (e.timestamp() > latest)
-          latest = e.timestamp();
-      }
       if (types.empty()) {
         VAST_WARNING(self, "received non-indexable events");
+        rp.deliver(ok_atom::value);
         return;
       }
       schema sch;
       for (auto& t : types)
         if (!sch.add(t)) {
           VAST_ERROR(self, "failed to derive valid schema from event data");
-          self->quit(make_error(ec::type_clash, "schema incompatibility"));
+          auto e = make_error(ec::type_clash, "schema incompatibility");
+          rp.deliver(e);
+          self->quit(e);
           return;
         }
       // Update partition meta data.
@@ -285,22 +337,20 @@ behavior index(stateful_actor<index_state>* self, path const& dir,
         // a new one, and send the events there. This will ensure that a
         // partition uniquely represents an event.
         VAST_ERROR(self, "failed to merge new with existing schema");
-        self->quit(make_error(ec::type_clash, "failed to merge schemata"));
+        auto e = make_error(ec::type_clash, "failed to merge schemata");
+        rp.deliver(e);
+        self->quit(e);
         return;
       }
       active->schema = std::move(*merged);
       active->events += events.size();
-      // Update meta index.
-      if (earliest < active->from)
-        active->from = earliest;
-      if (latest > active->to)
-        active->to = latest;
+      self->state.meta.add(self->state.active_id, events);
       // Relay events to active partition.
       VAST_DEBUG(self, "forwards", events.size(), "events ["
                  << events.front().id() << ',' << (events.back().id() + 1)
                  << ')', "to", self->state.active_id);
       auto msg = self->current_mailbox_element()->move_content_to_message();
-      self->send(self->state.active, msg + make_message(std::move(sch)));
+      rp.delegate(self->state.active, msg + make_message(std::move(sch)));
     },
     [=](expression const& expr, query_options opts, actor const& subscriber) {
       VAST_DEBUG(self, "got query:", expr);
@@ -315,27 +365,55 @@ behavior index(stateful_actor<index_state>* self, path const& dir,
         if (!qs.hist) {
           VAST_DEBUG(self, "instantiates historical query");
           qs.hist = historical_query_state();
+          if (has_low_priority_option(opts))
+            qs.hist->priority = query_scheduler::priority::batch;
         }
+        auto idle = false;
         if (!qs.hist->task) {
           VAST_DEBUG(self, "enables historical query");
           qs.hist->task = self->spawn(
             task<steady_clock::time_point, expression, historical_atom>,
             steady_clock::now(), expr, historical_atom::value);
           self->send(qs.hist->task, supervisor_atom::value, self);
-          // Test whether this query matches any partition and relay it where
-          // possible.
-          // TODO: this is technically the task of the meta index.
-          for (auto& p : self->state.partitions)
-            if (visit(time_restrictor{p.second.from, p.second.to}, expr))
-              if (auto a = dispatch(self, p.first, expr)) {
-                qs.hist->parts.emplace(a->address(), p.first);
-                self->send(qs.hist->task, a);
-                self->send(a, expr, historical_atom::value);
-              }
-          if (qs.hist->parts.empty()) {
+          // A cached result of an earlier run saves us from asking the sealed
+          // partitions it covers again.
+          if (auto r = self->state.results.lookup(to_string(normalize(expr)))) {
+            VAST_DEBUG(self, "starts from cached result with",
+                       r->coverage.size(), "partitions");
+            qs.hist->hits = r->hits;
+            qs.hist->coverage = r->coverage;
+          }
+          // Relay the query to all partitions that may contain matching
+          // events according to the meta index.
+          auto candidates = self->state.meta.lookup(expr);
+          VAST_DEBUG(self, "selected", candidates.size(), "of",
+                     self->state.partitions.size(), "partitions");
+          for (auto& part : candidates) {
+            if (qs.hist->coverage.count(part) > 0)
+              continue;
+            if (auto a = dispatch(self, part, expr, qs.hist->priority)) {
+              qs.hist->parts.emplace(a->address(), part);
+              self->send(qs.hist->task, a);
+              self->send(a, expr, historical_atom::value);
+              // The hits of passive partitions are final, whereas the active
+              // partition may still grow.
+              if (part != self->state.active_id)
+                qs.hist->sealed.insert(part);
+            }
+          }
+          if (self->state.scheduler.contains(expr)) {
+            // The task must not complete while the query still waits for
+            // partitions, so the index registers itself as worker until the
+            // scheduler has handed out the last partition.
+            VAST_DEBUG(self, "defers", self->state.scheduler.size(),
+                       "partition lookups");
+            self->send(qs.hist->task, actor_cast<actor>(self));
+            if (self->state.accountant)
+              self->send(self->state.accountant, "index.scheduler.queue",
+                         uint64_t{self->state.scheduler.size()});
+          } else if (qs.hist->parts.empty()) {
             VAST_DEBUG(self, "did not find a partition for query");
-            self->send_exit(qs.hist->task, exit_reason::user_shutdown);
-            qs.hist->task = {};
+            idle = true;
           }
         }
         self->send(subscriber, qs.hist->task);
@@ -343,6 +421,10 @@ behavior index(stateful_actor<index_state>* self, path const& dir,
           VAST_DEBUG(self, "relays", rank(qs.hist->hits), "cached hits");
           self->send(subscriber, qs.hist->hits);
         }
+        // Without work, the task completes right after the subscriber got
+        // the cached hits.
+        if (idle)
+          self->send_exit(qs.hist->task, exit_reason::user_shutdown);
       }
       if (has_continuous_option(opts)) {
         if (!qs.cont) {
@@ -375,6 +457,9 @@ behavior index(stateful_actor<index_state>* self, path const& dir,
         VAST_DEBUG(self, "disables continuous query:", expr);
         self->send(q->second.cont->task, done_atom::value);
         q->second.cont->task = {};
+        if (self->state.active)
+          self->send(self->state.active, expr, continuous_atom::value,
+                     disable_atom::value);
       }
     },
     [=](done_atom, steady_clock::time_point start, expression const& expr) {
@@ -387,6 +472,8 @@ behavior index(stateful_actor<index_state>* self, path const& dir,
       auto sender_addr = actor_cast<actor_addr>(self->current_sender());
       auto p = q->second.hist->parts.find(sender_addr);
       VAST_ASSERT(p != q->second.hist->parts.end());
+      if (q->second.hist->sealed.erase(p->second) > 0)
+        q->second.hist->coverage.insert(p->second);
       consolidate(self, p->second, expr);
       self->send(q->second.hist->task, done_atom::value, p->first);
       q->second.hist->parts.erase(p);
@@ -403,11 +490,16 @@ behavior index(stateful_actor<index_state>* self, path const& dir,
       // Notify subscribers about completion.
       for (auto& s : q->second.subscribers)
         self->send(s, done_atom::value, timespan{runtime}, expr);
-      // Remove query state.
-      // TODO: consider caching it for a while and also record its coverage
-      // so that future queries don't need to start over again.
-      q->second.hist->task = {};
-      self->state.queries.erase(q);
+      // Keep the result for the next run of the same query.
+      auto& hist = *q->second.hist;
+      VAST_DEBUG(self, "caches", rank(hist.hits), "hits from",
+                 hist.coverage.size(), "partitions");
+      self->state.results[to_string(normalize(expr))] =
+        query_result{std::move(hist.hits), std::move(hist.coverage)};
+      // Remove query state, unless the query continues.
+      q->second.hist = {};
+      if (!q->second.cont)
+        self->state.queries.erase(q);
     },
     [=](expression const& expr, bitmap& hits, historical_atom) {
       VAST_DEBUG(self, "received", rank(hits), "historical hits from",
@@ -425,11 +517,13 @@ behavior index(stateful_actor<index_state>* self, path const& dir,
     [=](expression const& expr, bitmap& hits, continuous_atom) {
       VAST_DEBUG(self, "received", rank(hits), "continuous hits from",
                  self->current_sender(), "for query:", expr);
-      auto& qs = self->state.queries[expr];
-      VAST_ASSERT(qs.cont);
-      qs.cont->hits |= hits;
+      // Hits may still arrive after disabling the query.
+      auto q = self->state.queries.find(expr);
+      if (q == self->state.queries.end() || !q->second.cont)
+        return;
+      q->second.cont->hits |= hits;
       auto msg = make_message(std::move(hits));
-      for (auto& s : qs.subscribers)
+      for (auto& s : q->second.subscribers)
         self->send(s, msg);
     },
     [=](flush_atom) {
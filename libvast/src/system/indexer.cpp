@@ -1,3 +1,5 @@
+#include <fstream>
+
 #include <caf/all.hpp>
 
 #include "vast/concept/parseable/to.hpp"
@@ -25,143 +27,46 @@ namespace vast {
 namespace system {
 namespace {
 
-struct value_indexer_state {
-  path filename;
-  vast::type type;
-  std::unique_ptr<value_index> idx;
-  value_index::size_type last_flush = 0;
-  const char* name = "value-indexer";
-};
-
-// Wraps a value index into an actor.
-template <class Extract>
-behavior value_indexer(stateful_actor<value_indexer_state>* self,
-                       path filename, type index_type, Extract extract) {
-  self->state.type = std::move(index_type);
-  self->state.filename = std::move(filename);
-  if (exists(self->state.filename)) {
-    // Materialize an existing index when encountering persistent state.
-    detail::value_index_inspect_helper tmp{self->state.type, self->state.idx};
-    auto result = load(self->state.filename, self->state.last_flush, tmp);
-    if (!result) {
-      VAST_ERROR(self, "failed to load bitmap index:",
-                 self->system().render(result.error()));
-      self->quit(result.error());
-    } else {
-      VAST_DEBUG(self, "loaded value index with offset",
-                 self->state.idx->offset());
-    }
-  } else {
-    // Construct a new index.
-    self->state.idx = value_index::make(self->state.type);
-    if (!self->state.idx)
-      self->quit(make_error(ec::unspecified, "failed to construct index"));
-  }
-  // Flush bitmap index to disk.
-  auto dir = self->state.filename.parent();
-  auto flush = [=]() -> expected<void> {
-    auto& last = self->state.last_flush;
-    auto offset = self->state.idx->offset();
-    if (offset == last)
-      return {};
-    // Create parent directory if it doesn't exist.
-    if (!exists(dir)) {
-      auto result = mkdir(dir);
-      if (!result)
-        return result.error();
-    }
-    VAST_DEBUG(self, "flushes index", "(" << (offset - last) << '/' << offset,
-               "new/total bits)");
-    last = offset;
-    detail::value_index_inspect_helper tmp{self->state.type, self->state.idx};
-    return save(self->state.filename, self->state.last_flush, tmp);
-  };
-  return {
-    [=](shutdown_atom) {
-      auto result = flush();
-      if (result)
-        self->quit(exit_reason::user_shutdown);
-      else
-        self->quit(result.error());
-    },
-    [=](flush_atom, actor const& task) {
-      auto result = flush();
-      self->send(task, done_atom::value);
-      if (!result)
-        self->quit(result.error());
-    },
-    [=](std::vector<event> const& events, actor const& task) {
-      VAST_TRACE(self, "got", events.size(), "events");
-      for (auto& e : events) {
-        VAST_ASSERT(e.id() != invalid_event_id);
-        if (auto data = extract(e)) {
-          auto result = self->state.idx->push_back(*data, e.id());
-          if (!result) {
-            VAST_ERROR(self->system().render(result.error()));
-            self->quit(result.error());
-            break;
-          }
-        }
-      }
-      self->send(task, done_atom::value);
-    },
-    [=](predicate const& pred, actor const& sink, actor const& task) {
-      VAST_TRACE(self, "got predicate:", pred);
-      auto result = self->state.idx->lookup(pred.op, get<data>(pred.rhs));
-      if (result) {
-        self->send(sink, pred, std::move(*result));
-      } else {
-        VAST_ERROR(self, "failed to lookup:", pred,
-                   '(' << self->system().render(result.error()) << ')');
-        self->quit(result.error());
-      }
-      self->send(task, done_atom::value);
-    }
-  };
-}
-
-// In the current event indexing design, all indexers receive all events and
-// pick the aspect of the event that's relevant to them. For event meta data
-// indexers, every event is relevant. Event data indexers concern themselves
-// only a specific aspect of a specific event type.
+// Value indexes can grow large, so we compress them in large blocks when
+// flushing them to disk. We do so sequentially, since indexers flush on the
+// threads of the actor system, which other indexers keep busy already.
+constexpr size_t index_block_size = 256 << 10;
 
-behavior time_indexer(stateful_actor<value_indexer_state>* self,
-                           path const& p) {
-  // TODO: add type attributes to tune index, e.g., for seconds granularity.
-  auto t = timestamp_type{};
-  auto extract = [](event const& e) { return optional<data>{e.timestamp()}; };
-  return value_indexer(self, p, t, extract);
-}
+// Index files begin with an uncompressed magic number and version, so that
+// files in an older format fail to load cleanly rather than as corrupt LZ4
+// data.
+constexpr uint32_t index_magic = 0x76696478; // "vidx"
+constexpr uint32_t index_version = 1;
 
-// Indexes the data from non-record event type.
-behavior flat_data_indexer(stateful_actor<value_indexer_state>* self,
-                           path dir, type event_type) {
-  auto extract = [=](event const& e) -> optional<data const&> {
-    if (e.type() != event_type)
-      return {};
-    return e.data();
-  };
-  return value_indexer(self, dir, event_type, extract);
+// Writes a value index and its meta data to a file.
+template <class... Ts>
+expected<void> save_index(path const& filename, Ts&&... xs) {
+  std::ofstream fs{filename.str()};
+  if (!fs)
+    return make_error(ec::filesystem_error, "failed to create filestream",
+                      filename);
+  auto r = save(*fs.rdbuf(), index_magic, index_version);
+  if (!r)
+    return r;
+  return save<compression::lz4, index_block_size>(*fs.rdbuf(),
+                                                  std::forward<Ts>(xs)...);
 }
 
-// Indexes a field of data from record event type.
-behavior field_data_indexer(stateful_actor<value_indexer_state>* self,
-                            path dir, type event_type, type value_type,
-                            offset off) {
-  auto extract = [=](event const& e) -> optional<data const&> {
-    if (e.type() != event_type)
-      return {};
-    auto v = get_if<vector>(e.data());
-    if (!v)
-      return {};
-    if (auto x = get(*v, off))
-      return *x;
-    // If there is no data at a given offset, it means that an intermediate
-    // record is nil but we're trying to access a deeper field.
-    static const auto nil_data = data{nil};
-    return nil_data;
-  };
-  return value_indexer(self, dir, value_type, extract);
+// Reads a value index and its meta data from a file.
+template <class... Ts>
+expected<void> load_index(path const& filename, Ts&&... xs) {
+  std::ifstream fs{filename.str()};
+  if (!fs)
+    return make_error(ec::filesystem_error, "failed to create filestream",
+                      filename);
+  uint32_t magic = 0;
+  uint32_t version = 0;
+  auto r = load(*fs.rdbuf(), magic, version);
+  if (!r || magic != index_magic)
+    return make_error(ec::version_error, "unversioned index file", filename);
+  if (version != index_version)
+    return make_error(ec::version_error, version, index_version);
+  return load<compression::lz4>(*fs.rdbuf(), std::forward<Ts>(xs)...);
 }
 
 // Tests whether a type has a "skip" attribute.
@@ -171,9 +76,93 @@ bool skip(type const& t) {
   return std::find_if(attrs.begin(), attrs.end(), pred) != attrs.end();
 }
 
-// Loads indexes for a predicate.
+// Enumerates the columns of an event type below a directory. The event
+// timestamp always gets a column, whereas event data ends up in one column per
+// record field or in a single column for non-record types.
+std::vector<column_index> layout(path const& dir, type const& event_type) {
+  std::vector<column_index> result;
+  result.push_back({column_index::time_column, {}, timestamp_type{},
+                    dir / "meta" / "time"});
+  if (skip(event_type))
+    return result;
+  if (auto r = get_if<record_type>(event_type)) {
+    for (auto& f : record_type::each{*r}) {
+      auto& value_type = f.trace.back()->type;
+      if (skip(value_type))
+        continue;
+      auto p = dir / "data";
+      for (auto& k : f.key())
+        p /= k;
+      result.push_back({column_index::field_column, f.offset, value_type, p});
+    }
+  } else {
+    result.push_back({column_index::data_column, {}, event_type, dir / "data"});
+  }
+  return result;
+}
+
+// Materializes the value index of a column from persistent state, or
+// constructs a new one.
+expected<void> materialize(column_index& col) {
+  if (exists(col.filename)) {
+    detail::value_index_inspect_helper tmp{col.type, col.idx};
+    return load_index(col.filename, col.last_flush, tmp);
+  }
+  col.idx = value_index::make(col.type);
+  if (!col.idx)
+    return make_error(ec::unspecified, "failed to construct index");
+  return {};
+}
+
+// Writes the value index of a column to disk if it has grown since the last
+// flush.
+expected<void> flush(column_index& col) {
+  if (col.idx->offset() == col.last_flush)
+    return {};
+  auto dir = col.filename.parent();
+  if (!exists(dir)) {
+    auto result = mkdir(dir);
+    if (!result)
+      return result.error();
+  }
+  col.last_flush = col.idx->offset();
+  detail::value_index_inspect_helper tmp{col.type, col.idx};
+  return save_index(col.filename, col.last_flush, tmp);
+}
+
+// Appends the values of a column for a batch of events. We branch on the
+// column kind once per batch rather than once per event.
+expected<void> append(column_index& col, std::vector<event const*> const& xs) {
+  auto each = [&](auto extract) -> expected<void> {
+    for (auto x : xs) {
+      VAST_ASSERT(x->id() != invalid_event_id);
+      auto result = col.idx->push_back(extract(*x), x->id());
+      if (!result)
+        return result;
+    }
+    return {};
+  };
+  switch (col.kind) {
+    default:
+      VAST_ASSERT(col.kind == column_index::time_column);
+      return each([](event const& e) { return data{e.timestamp()}; });
+    case column_index::data_column:
+      return each([](event const& e) -> data const& { return e.data(); });
+    case column_index::field_column:
+      return each([&](event const& e) -> data const& {
+        // If there is no data at a given offset, it means that an
+        // intermediate record is nil but we're trying to access a deeper
+        // field.
+        static const auto nil_data = data{nil};
+        auto x = get(e.data(), col.field);
+        return x ? *x : nil_data;
+      });
+  }
+}
+
+// Loads the columns for a predicate.
 struct loader {
-  using result_type = std::vector<actor>;
+  using result_type = std::vector<column_index*>;
 
   template <class T, class U>
   result_type operator()(T const&, U const&) {
@@ -182,18 +171,12 @@ struct loader {
 
   result_type operator()(attribute_extractor const& ex, data const& x) {
     result_type result;
-    auto p = self->state.dir / "meta";
     if (ex.attr == "time") {
-      if (!is<timestamp>(x)) {
+      if (!is<timestamp>(x))
         VAST_WARNING(self, "got time attribute but no timestamp:", x);
-      } else {
-        p /= "time";
-        VAST_DEBUG(self, "loads value index at", p);
-        auto& a = self->state.indexers[p];
-        if (!a)
-          a = self->spawn<monitored>(time_indexer, p);
-        result.push_back(a);
-      }
+      else
+        fetch({column_index::time_column, {}, timestamp_type{},
+              self->state.dir / "meta" / "time"}, result);
     } else {
       VAST_WARNING(self, "got unsupported attribute:", ex.attr);
     }
@@ -203,35 +186,26 @@ struct loader {
   result_type operator()(key_extractor const& ex, data const& x) {
     result_type result;
     VAST_ASSERT(!ex.key.empty());
+    auto& event_type = self->state.event_type;
     // TODO: this branching logic is identical to the one used during index
     // lookup in src/expression_visitors.cpp. We should factor it.
     // First, try to interpret the key as a type.
     if (auto t = to<type>(ex.key[0])) {
       if (ex.key.size() == 1) {
-        if (auto r = get_if<record_type>(self->state.event_type)) {
+        if (auto r = get_if<record_type>(event_type)) {
           for (auto& f : record_type::each{*r}) {
             auto& value_type = f.trace.back()->type;
             if (congruent(value_type, *t)) {
               auto p = self->state.dir / "data";
               for (auto& k : f.key())
                 p /= k;
-              VAST_DEBUG(self, "loads value index at", p);
-              auto& a = self->state.indexers[p];
-              if (!a)
-                a = self->spawn<monitored>(field_data_indexer, p,
-                                           self->state.event_type,
-                                           value_type, f.offset);
-              result.push_back(a);
+              fetch({column_index::field_column, f.offset, value_type, p},
+                   result);
             }
           }
-        } else if (congruent(self->state.event_type, *t)) {
-          auto p = self->state.dir / "data";
-          VAST_DEBUG(self, "loads value index at", p);
-          auto& a = self->state.indexers[p];
-          if (!a)
-            a = self->spawn<monitored>(flat_data_indexer, p,
-                                       self->state.event_type);
-          result.push_back(a);
+        } else if (congruent(event_type, *t)) {
+          fetch({column_index::data_column, {}, event_type,
+                self->state.dir / "data"}, result);
         }
       } else {
         // Keys that look like types, but have more than one component don't
@@ -239,7 +213,7 @@ struct loader {
         VAST_WARNING(self, "got weird key:", ex.key);
       }
     // Second, interpret the key as a suffix of a record field name.
-    } else if (auto r = get_if<record_type>(self->state.event_type)) {
+    } else if (auto r = get_if<record_type>(event_type)) {
       auto suffixes = r->find_suffix(ex.key);
       // All suffixes must pass the type check, otherwise the RHS of a
       // predicate would be ambiguous.
@@ -260,32 +234,38 @@ struct loader {
           for (auto i = pair.second.begin() + 1; i != pair.second.end(); ++i)
             p /= *i;
         }
-        VAST_DEBUG(self, "loads value index at", p);
-        auto& a = self->state.indexers[p];
-        if (!a)
-          a = self->spawn<monitored>(field_data_indexer, p,
-                                     self->state.event_type,
-                                     *r->at(pair.first), pair.first);
-        result.push_back(a);
+        fetch({column_index::field_column, pair.first, *r->at(pair.first), p},
+             result);
       }
     // Third, try to interpret the key as the name of a single type.
-    } else if (ex.key[0] == self->state.event_type.name()) {
-      if (!compatible(self->state.event_type, op, x)) {
-          VAST_WARNING(self, "encountered type clash: ",
-                       self->state.event_type, op, x);
-      } else {
-        auto p = self->state.dir / "data";
-        VAST_DEBUG(self, "loads value index at", p);
-        auto& a = self->state.indexers[p];
-        if (!a)
-          a = self->spawn<monitored>(flat_data_indexer, p,
-                                     self->state.event_type);
-        result.push_back(a);
-      }
+    } else if (ex.key[0] == event_type.name()) {
+      if (!compatible(event_type, op, x))
+        VAST_WARNING(self, "encountered type clash: ", event_type, op, x);
+      else
+        fetch({column_index::data_column, {}, event_type,
+              self->state.dir / "data"}, result);
     }
     return result;
   }
 
+  // Looks up a column by its file name and materializes it if needed.
+  void fetch(column_index col, result_type& result) {
+    auto i = self->state.columns.find(col.filename);
+    if (i == self->state.columns.end()) {
+      VAST_DEBUG(self, "loads value index at", col.filename);
+      auto m = materialize(col);
+      if (!m) {
+        VAST_ERROR(self, "failed to load value index:",
+                   self->system().render(m.error()));
+        return;
+      }
+      auto filename = col.filename;
+      i = self->state.columns.emplace(std::move(filename),
+                                      std::move(col)).first;
+    }
+    result.push_back(&i->second);
+  }
+
   stateful_actor<event_indexer_state>* self;
   relational_operator op;
 };
@@ -297,102 +277,147 @@ behavior event_indexer(stateful_actor<event_indexer_state>* self,
   self->state.dir = dir;
   self->state.event_type = event_type;
   VAST_DEBUG(self, "operates for type", event_type.name(), "in", dir);
-  // If the directory doesn't exist yet, we're in "construction" mode,
-  // where we spawn all indexers to be able to handle incoming events directly.
-  // Otherwise we deal with a "frozen" indexer that only spawns indexers as
-  // needed for answering queries.
+  // If the directory doesn't exist yet, we're in "construction" mode, where
+  // we create the indexes of all columns to be able to handle incoming events
+  // directly. Otherwise we deal with a "frozen" indexer that only loads
+  // columns as needed for answering queries.
   if (!exists(dir)) {
-    VAST_DEBUG(self, "has no persistent state, spawning indexers");
-    // Spawn indexers for event meta data.
-    auto p = dir / "meta" / "time";
-    auto a = self->spawn<monitored>(time_indexer, p);
-    self->state.indexers.emplace(p, a);
-    // Spawn indexers for event data.
-    if (!skip(event_type)) {
-      auto r = get_if<record_type>(event_type);
-      if (!r) {
-        p = dir / "data";
-        VAST_DEBUG(self, "spawns new value index at", p);
-        a = self->spawn<monitored>(flat_data_indexer, p, event_type);
-        self->state.indexers.emplace(p, a);
-      } else {
-        for (auto& f : record_type::each{*r}) {
-          auto& value_type = f.trace.back()->type;
-          if (!skip(value_type)) {
-            p = dir / "data";
-            for (auto& k : f.key())
-              p /= k;
-            VAST_DEBUG(self, "spawns new value index at", p);
-            a = self->spawn<monitored>(field_data_indexer, p, event_type,
-                                       value_type, f.offset);
-            self->state.indexers.emplace(p, a);
-          }
-        }
+    VAST_DEBUG(self, "has no persistent state, creating indexes");
+    for (auto& col : layout(dir, event_type)) {
+      auto m = materialize(col);
+      if (!m) {
+        VAST_ERROR(self, self->system().render(m.error()));
+        self->quit(m.error());
+        return {};
       }
+      auto filename = col.filename;
+      self->state.columns.emplace(std::move(filename), std::move(col));
     }
   }
-  // We monitor all indexers so that we can control the shutdown process
-  // explicitly.
-  auto remove_indexer = [=](auto& indexer) {
-    auto i = std::find_if(self->state.indexers.begin(),
-                          self->state.indexers.end(),
-                          [&](auto& p) { return p.second == indexer; });
-    VAST_ASSERT(i != self->state.indexers.end());
-    self->state.indexers.erase(i);
+  auto flush_all = [=]() -> expected<void> {
+    VAST_DEBUG(self, "flushes", self->state.columns.size(), "indexes");
+    for (auto& x : self->state.columns) {
+      auto result = flush(x.second);
+      if (!result)
+        return result;
+    }
+    return {};
+  };
+  // Looks up a predicate in all matching columns and sends the hits to the
+  // sink. Given candidates, the columns evaluate only those IDs.
+  auto lookup = [=](predicate const& pred, bitmap const* candidates,
+                    actor const& sink) {
+    // For now, we require that the predicate is part of a normalized
+    // expression, i.e., LHS an extractor type and RHS of type data.
+    VAST_DEBUG(self, "got predicate:", pred);
+    auto rhs = get_if<data>(pred.rhs);
+    VAST_ASSERT(rhs);
+    auto columns = visit(loader{self, pred.op}, pred.lhs, pred.rhs);
+    if (columns.empty()) {
+      VAST_DEBUG(self, "did not find matching indexes for", pred);
+      return;
+    }
+    VAST_DEBUG(self, "found", columns.size(), "matching indexes");
+    bitmap hits;
+    for (auto col : columns) {
+      auto result = candidates ? col->idx->lookup(pred.op, *rhs, *candidates)
+                               : col->idx->lookup(pred.op, *rhs);
+      if (result)
+        hits |= *result;
+      else
+        VAST_ERROR(self, "failed to lookup:", pred,
+                   '(' << self->system().render(result.error()) << ')');
+    }
+    self->send(sink, pred, std::move(hits));
   };
-  self->set_down_handler(
-    [=](down_msg const& msg) { remove_indexer(msg.source); }
-  );
   return {
     [=](shutdown_atom) {
-      for (auto& i : self->state.indexers)
-        self->send(i.second, shutdown_atom::value);
-      // Wait until all indexers have terminated.
-      self->set_down_handler(
-        [=](down_msg const& msg) {
-          remove_indexer(msg.source);
-          if (self->state.indexers.empty())
-            self->quit(exit_reason::user_shutdown);
-        }
-      );
+      auto result = flush_all();
+      if (result)
+        self->quit(exit_reason::user_shutdown);
+      else
+        self->quit(result.error());
     },
-    [=](std::vector<event> const&, actor task) {
-      auto msg = self->current_mailbox_element()->move_content_to_message();
-      for (auto& i : self->state.indexers) {
-        self->send(task, i.second);
-        self->send(i.second, msg);
+    [=](std::vector<event> const& events, actor const& task) {
+      VAST_TRACE(self, "got", events.size(), "events");
+      // PARTITION sends us only the events of our type.
+      std::vector<event const*> xs;
+      xs.reserve(events.size());
+      for (auto& e : events) {
+        VAST_ASSERT(e.type() == self->state.event_type);
+        xs.push_back(&e);
       }
+      if (!xs.empty())
+        for (auto& x : self->state.columns) {
+          auto result = append(x.second, xs);
+          if (!result) {
+            VAST_ERROR(self, self->system().render(result.error()));
+            self->send(task, done_atom::value);
+            self->quit(result.error());
+            return;
+          }
+        }
       self->send(task, done_atom::value);
     },
     [=](flush_atom, actor const& task) {
-      VAST_DEBUG(self, "flushes", self->state.indexers.size(), "indexers");
-      for (auto& i : self->state.indexers) {
-        self->send(task, i.second);
-        self->send(i.second, flush_atom::value, task);
+      auto result = flush_all();
+      self->send(task, done_atom::value);
+      if (!result) {
+        VAST_ERROR(self, self->system().render(result.error()));
+        self->quit(result.error());
       }
+    },
+    [=](predicate const& pred, actor const& sink, actor const& task) {
+      lookup(pred, nullptr, sink);
       self->send(task, done_atom::value);
     },
-    [=](predicate const& pred, actor const& /* sink */, actor task) {
-      // For now, we require that the predicate is part of a normalized
-      // expression, i.e., LHS an extractor type and RHS of type data.
-      VAST_DEBUG(self, "got predicate:", pred);
-      auto rhs = get_if<data>(pred.rhs);
-      VAST_ASSERT(rhs);
-      auto indexers = visit(loader{self, pred.op}, pred.lhs, pred.rhs);
-      // Forward predicate to all available indexers.
-      if (indexers.empty())
-        VAST_DEBUG(self, "did not find matching indexers for", pred);
-      else
-        VAST_DEBUG(self, "found", indexers.size(), "matching indexers");
-      auto msg = self->current_mailbox_element()->move_content_to_message();
-      for (auto& i : indexers) {
-        self->send(task, i);
-        self->send(i, msg);
-      }
+    [=](predicate const& pred, bitmap const& candidates, actor const& sink,
+        actor const& task) {
+      lookup(pred, &candidates, sink);
       self->send(task, done_atom::value);
     }
   };
 }
 
+expected<void> merge_indexes(std::vector<path> const& inputs,
+                             path const& output, type const& event_type) {
+  // Enumerate the columns relative to the directory of an EVENT INDEXER.
+  for (auto& col : layout({}, event_type)) {
+    std::unique_ptr<value_index> result;
+    for (auto& input : inputs) {
+      auto filename = input / col.filename;
+      if (!exists(filename))
+        continue;
+      std::unique_ptr<value_index> idx;
+      value_index::size_type last_flush;
+      detail::value_index_inspect_helper tmp{col.type, idx};
+      auto t = load_index(filename, last_flush, tmp);
+      if (!t)
+        return t.error();
+      if (!result) {
+        result = std::move(idx);
+        continue;
+      }
+      auto m = result->merge(*idx);
+      if (!m)
+        return m.error();
+    }
+    if (!result)
+      continue;
+    auto filename = output / col.filename;
+    if (!exists(filename.parent())) {
+      auto m = mkdir(filename.parent());
+      if (!m)
+        return m.error();
+    }
+    auto last_flush = result->offset();
+    detail::value_index_inspect_helper tmp{col.type, result};
+    auto t = save_index(filename, last_flush, tmp);
+    if (!t)
+      return t.error();
+  }
+  return {};
+}
+
 } // namespace system
 } // namespace vast
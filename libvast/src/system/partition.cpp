@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <set>
+
 #include <caf/all.hpp>
 
 #include "vast/concept/parseable/numeric/integral.hpp"
@@ -8,6 +11,7 @@
 #include "vast/concept/printable/vast/expression.hpp"
 #include "vast/concept/printable/vast/filesystem.hpp"
 #include "vast/concept/printable/vast/event.hpp"
+#include "vast/bitmap_algorithms.hpp"
 #include "vast/detail/assert.hpp"
 #include "vast/event.hpp"
 #include "vast/expression_visitors.hpp"
@@ -29,103 +33,150 @@ CAF_ALLOW_UNSAFE_MESSAGE_TYPE(steady_clock::time_point)
 namespace vast {
 namespace system {
 
-// namespace {
-//
-// struct accumulator_state {
-//   bitmap evaluate(expression const& expr) const {
-//     struct evaluator : bitmap_evaluator<evaluator, bitmap> {
-//       evaluator(state const* s) : this_{s} { }
-//       bitmap const* lookup(predicate const& pred) const {
-//         auto i = this_->hits.find(pred);
-//         return i == this_->hits.end() ? nullptr : &i->second;
-//       }
-//       state const* this_;
-//     };
-//     return visit(evaluator{this}, expr);
-//   }
-//
-//   std::map<predicate, bitmap> hits;
-// };
-//
-// // Receives hits from INDEXERs and evaluates a set of expression over them.
-// behavior accumulator(stateful_actor<accumulator_state>* self,
-//                      std::vector<expression> exprs, actor const& sink) {
-//   return {
-//     [=](predicate& pred, bitmap& hits) {
-//       self->state.hits.emplace(std::move(pred), std::move(hits));
-//     },
-//     [self, exprs=std::move(exprs), sink](done_atom) {
-//       for (auto& expr : exprs) {
-//         VAST_DEBUG(self, "evalutes continuous query:", expr);
-//         self->send(sink, expr, self->state.evaluate(expr));
-//       }
-//       self->quit();
-//       // TODO: relay the hits back to PARTITION if the query is also
-//       // historical. Caveat: we should not re-evaluate the historical query
-//       // with these hits to avoid that the sink receives duplicate hits.
-//     }
-//   };
-// };
-//
-// struct proxy_state {
-//   detail::flat_set<expression> exprs;
-//   detail::flat_set<predicate> preds;
-//   char const* name = "cq-proxy";
-// };
-//
-// // Accumulates all hits from an event batch, evalutes a query, and sends the
-// // result of the evaluation back to PARTITION.
-// behavior cq_proxy(stateful_actor<state>* self, actor const& sink) {
-//   return {
-//     [=](expression const& expr) {
-//       self->state.exprs.insert(expr);
-//       for (auto& p : visit(predicatizer{}, expr))
-//         self->state.preds.insert(std::move(p));
-//     },
-//     [=](expression const& expr, disable_atom) {
-//       self->state.exprs.erase(expr);
-//       self->state.preds.clear();
-//       if (self->state.exprs.empty())
-//         self->quit();
-//       else
-//         for (auto& ex : self->state.exprs)
-//           for (auto& p : visit(predicatizer{}, ex))
-//             self->state.preds.insert(std::move(p));
-//     },
-//     [=](predicate const&, bitmap const& hits) {
-//       VAST_DEBUG(self, "relays", rank(hits), "hits");
-//       auto msg = self->current_message() + make_message(continuous_atom::value);
-//       self->send(sink, std::move(msg));
-//     },
-//     [=](std::vector<actor> const& indexers) {
-//       VAST_DEBUG(self, "got", indexers.size(), "indexers");
-//       if (self->state.exprs.empty()) {
-//         VAST_WARNING(self, "got indexers but has no queries");
-//         return;
-//       }
-//       // FIXME: do not stupidly send every predicate to every indexer,
-//       // rather, pick the minimal subset intelligently.
-//       auto acc = self->spawn(accumulator,
-//                              self->state.exprs.as_vector(), self);
-//       auto t = self->spawn(task<>);
-//       self->send(t, supervisor_atom::value, acc);
-//       for (auto& indexer : indexers) {
-//         self->send(t, indexer, uint64_t{self->state.preds.size()});
-//         for (auto& p : self->state.preds)
-//           self->send(indexer, expression{p}, acc, t);
-//       }
-//     }
-//   };
-// }
-//
-// } // namespace <anonymous>
+namespace {
+
+// The directory in which PARTITION assembles merged batches.
+constexpr char const* staging_dir = ".merge";
+
+// Collects the type directories of all persistent batches.
+template <class Actor>
+std::multimap<event_id, path> scan(Actor* self, path const& dir,
+                                   schema const& sch) {
+  std::multimap<event_id, path> result;
+  for (auto& batch_dir : directory{dir}) {
+    auto interval = batch_dir.basename().str();
+    if (!batch_dir.is_directory() || interval == staging_dir)
+      continue;
+    // Extract the base ID from the path. Directories have the form a-b
+    // to represent the batch [a,b).
+    auto dash = interval.find('-');
+    if (dash < 1 || dash == std::string::npos) {
+      VAST_WARNING(self, "ignores invalid batch directory:", interval);
+      continue;
+    }
+    auto left = interval.substr(0, dash);
+    auto base = to<event_id>(left);
+    if (!base) {
+      VAST_WARNING(self, "ignores directory with invalid base ID:", left);
+      continue;
+    }
+    for (auto& type_dir : directory{batch_dir}) {
+      if (!sch.find(type_dir.basename().str())) {
+        VAST_WARNING(self, "ignores directory with unknown type:",
+                     interval / type_dir.basename());
+        continue;
+      }
+      result.emplace(*base, type_dir);
+    }
+  }
+  return result;
+}
+
+// Merges the indexes of all persistent batches into a single batch. We move
+// the merged batch into place before deleting the original ones. Should we
+// crash in between, a query gets the same hits twice, which is harmless.
+template <class Actor>
+expected<void> consolidate(Actor* self, path const& dir, schema const& sch) {
+  if (!exists(dir))
+    return {};
+  auto batches = scan(self, dir, sch);
+  if (batches.empty() || batches.begin()->first == batches.rbegin()->first)
+    return {};
+  auto interval = batches.rbegin()->second.parent().basename().str();
+  auto last = to<event_id>(interval.substr(interval.find('-') + 1));
+  if (!last)
+    return make_error(ec::parse_error, "invalid batch directory", interval);
+  // Group the batches by type, in the order of their IDs.
+  std::map<std::string, std::vector<path>> inputs;
+  for (auto& x : batches)
+    inputs[x.second.basename().str()].push_back(x.second);
+  auto staging = dir / staging_dir;
+  if (exists(staging) && !rm(staging))
+    return make_error(ec::filesystem_error, "failed to remove", staging.str());
+  for (auto& x : inputs) {
+    auto t = sch.find(x.first);
+    VAST_ASSERT(t != nullptr);
+    auto result = merge_indexes(x.second, staging / x.first, *t);
+    if (!result) {
+      rm(staging);
+      return result;
+    }
+  }
+  if (!exists(staging))
+    return {};
+  auto first = batches.begin()->first;
+  auto target = dir / (to_string(first) + "-" + to_string(*last));
+  if (!mv(staging, target))
+    return make_error(ec::filesystem_error, "failed to move", staging.str());
+  auto prev = path{};
+  for (auto& x : batches) {
+    auto batch_dir = x.second.parent();
+    if (batch_dir != prev && !rm(batch_dir))
+      VAST_WARNING(self, "failed to remove merged batch", batch_dir);
+    prev = batch_dir;
+  }
+  VAST_DEBUG(self, "merged batches into", target.basename());
+  return {};
+}
+
+// Merges the batches of a partition on a thread of its own, so that PARTITION
+// keeps processing its mailbox in the meantime. The MERGER terminates after
+// answering.
+behavior merger(event_based_actor* self, path dir, schema sch) {
+  return {
+    [=](run_atom) -> result<ok_atom> {
+      auto merged = consolidate(self, dir, sch);
+      self->quit();
+      if (!merged)
+        return merged.error();
+      return ok_atom::value;
+    }
+  };
+}
+
+// Estimates the relative cost of looking up a predicate in the value indexes.
+// A point lookup touches a single bitmap, whereas a range lookup combines
+// several. Substring and pattern lookups have to examine every distinct value
+// of the index.
+size_t cost(predicate const& pred) {
+  switch (pred.op) {
+    default:
+      return 4;
+    case equal:
+      return 1;
+    case not_equal:
+      return 2;
+    case in:
+    case not_in:
+    case ni:
+    case not_ni:
+      return 16;
+    case match:
+    case not_match:
+      return 32;
+  }
+}
+
+// Checks whether a bitmap has at least one 1-bit in [first, last).
+bool intersects(bitmap const& bm, event_id first, event_id last) {
+  last = std::min(last, bm.size());
+  if (first >= last)
+    return false;
+  bitmap range;
+  range.append_bits(false, first);
+  range.append_bits(true, last - first);
+  range &= bm;
+  return !all<0>(range);
+}
+
+} // namespace <anonymous>
 
 behavior partition(stateful_actor<partition_state>* self, path dir,
                    actor sink) {
   VAST_ASSERT(sink);
-  // If the directory exists already, we must have some state and are loading
-  // all INDEXERs.
-  // TODO: it's cheaper to load them on demand.
+  // If the directory exists already, we must have some state. We only record
+  // the type directories of each batch in a catalog and load the INDEXERs on
+  // demand when a query arrives.
   if (exists(dir)) {
     // Load PARTITION meta data.
     auto t = load(dir / "schema", self->state.schema);
@@ -133,36 +184,170 @@ behavior partition(stateful_actor<partition_state>* self, path dir,
       VAST_ERROR(self, self->system().render(t.error()));
       self->quit(t.error());
     } else {
-      // Load INDXERs for each batch.
       VAST_ASSERT(!self->state.schema.empty());
-      for (auto& batch_dir : directory{dir}) {
-        auto interval = batch_dir.basename().str();
-        if (batch_dir.is_directory()) {
-          // Extract the base ID from the path. Directories have the form a-b
-          // to represent the batch [a,b).
-          auto dash = interval.find('-');
-          if (dash < 1 || dash == std::string::npos) {
-            VAST_WARNING(self, "ignores invalid batch directory:", interval);
-            continue;
-          }
-          auto left = interval.substr(0, dash);
-          auto base = to<event_id>(left);
-          if (!base) {
-            VAST_WARNING(self, "ignores directory with invalid base ID:", left);
-            continue;
-          }
-          // Load the INDEXERs for each type in the batch.
-          for (auto& type_dir : directory{batch_dir}) {
-            VAST_DEBUG(self, "loads", interval / type_dir.basename());
-            auto t = self->state.schema.find(type_dir.basename().str());
-            VAST_ASSERT(t != nullptr);
-            auto a = self->spawn<monitored>(event_indexer, type_dir, *t);
-            self->state.indexers.emplace(*base, a);
+      self->state.catalog = scan(self, dir, self->state.schema);
+      VAST_DEBUG(self, "found", self->state.catalog.size(),
+                 "persistent indexers");
+    }
+  }
+  // Loads the INDEXERs from the catalog whose type may satisfy a predicate.
+  // All other INDEXERs remain on the file system until a predicate needs them.
+  auto load_indexers = [=](predicate const& pred) {
+    auto& catalog = self->state.catalog;
+    std::map<std::string, bool> applies;
+    auto loaded = uint64_t{0};
+    auto i = catalog.begin();
+    while (i != catalog.end()) {
+      auto name = i->second.basename().str();
+      auto t = self->state.schema.find(name);
+      VAST_ASSERT(t != nullptr);
+      auto a = applies.find(name);
+      if (a == applies.end()) {
+        auto resolved = visit(key_resolver{*t}, expression{pred});
+        auto x = resolved && !is<none>(*resolved);
+        a = applies.emplace(std::move(name), x).first;
+      }
+      if (!a->second) {
+        ++i;
+        continue;
+      }
+      VAST_DEBUG(self, "loads", i->second);
+      auto indexer = self->spawn<monitored>(event_indexer, i->second, *t);
+      self->state.indexers.emplace(i->first, indexer);
+      i = catalog.erase(i);
+      ++loaded;
+    }
+    if (loaded > 0 && self->state.accountant)
+      self->send(self->state.accountant, "partition.indexers.loaded", loaded);
+  };
+  // Estimates the cost of an expression as the sum of the costs of its
+  // predicates. A predicate that all loaded INDEXERs have looked up already
+  // comes for free.
+  auto estimate = [=](expression const& expr) {
+    auto result = size_t{0};
+    for (auto& pred : visit(predicatizer{}, expr)) {
+      auto p = self->state.predicates.find(pred);
+      if (p != self->state.predicates.end() && !p->second.task
+          && self->state.catalog.empty()) {
+        auto& indexers = self->state.indexers;
+        auto cached = std::all_of(
+          indexers.begin(), indexers.end(),
+          [&](auto& x) { return p->second.cache.contains(x.first); });
+        if (cached)
+          continue;
+      }
+      result += cost(pred);
+    }
+    return result;
+  };
+  // Forwards a predicate of a query to all INDEXERs that have not looked it
+  // up yet. Given a mask, only the batches with at least one candidate event
+  // see the predicate, and their INDEXERs only evaluate the candidates.
+  // Returns whether hits of the predicate are outstanding.
+  auto dispatch = [=](expression const& expr, predicate const& pred,
+                      bitmap const* mask) {
+    VAST_DEBUG(self, "dispatches predicate", pred);
+    auto& qs = self->state.queries[expr];
+    auto p = self->state.predicates.emplace(pred, predicate_state()).first;
+    VAST_ASSERT(p->first == pred);
+    p->second.queries.insert(&expr);
+    load_indexers(pred);
+    auto& indexers = self->state.indexers;
+    auto i = indexers.begin();
+    while (i != indexers.end()) {
+      auto base = i->first;
+      auto next = indexers.upper_bound(base);
+      // The batch extends at most to the next base ID.
+      auto last = next == indexers.end() ? max_events : next->first;
+      if (p->second.cache.contains(base)) {
+        // If an indexer has already looked up this predicate in the past, it
+        // must have sent the hits back to this partition, or is in the
+        // process of doing so.
+        VAST_DEBUG(self, "skips indexers for base", base);
+      } else if (mask && !intersects(*mask, base, last)) {
+        // We do not record the base in the cache, because a later query
+        // without a mask must still visit this batch. The same holds for
+        // restricted lookups below, which yield only a subset of the hits.
+        VAST_DEBUG(self, "skips indexers for base without candidates", base);
+      } else {
+        // Forward the predicate to the subset of indexers which we haven't
+        // asked yet.
+        VAST_DEBUG(self, "relays predicate for base", base);
+        for (; i != next; ++i) {
+          VAST_DEBUG(self, " - forwards predicate to indexer", i->second);
+          if (!mask)
+            p->second.cache.insert(i->first);
+          if (!p->second.task) {
+            p->second.task =
+              self->spawn(task<steady_clock::time_point, predicate>,
+                          steady_clock::now(), pred);
+            self->send(p->second.task, supervisor_atom::value, self);
           }
+          self->send(qs.task, p->second.task);
+          self->send(p->second.task, i->second);
+          if (mask)
+            self->send(i->second, pred, *mask, self, p->second.task);
+          else
+            self->send(i->second, pred, self, p->second.task);
         }
       }
+      i = next;
     }
-  }
+    return static_cast<bool>(p->second.task);
+  };
+  // Dispatches the operands of a query one after another, each once the hits
+  // of its predecessor are complete. After the last operand, we evaluate the
+  // query and release the query task, for which PARTITION acts as a worker
+  // until then. The argument must be a key of the query map.
+  auto advance = [=](expression const& expr) {
+    auto& qs = self->state.queries[expr];
+    auto evaluator = make_bitmap_evaluator<bitmap>(
+      [&](predicate const& p) -> bitmap const* {
+        auto i = self->state.predicates.find(p);
+        return i == self->state.predicates.end() ? nullptr : &i->second.hits;
+      }
+    );
+    while (qs.pending.empty()) {
+      if (!is<none>(qs.stage) && !qs.stages.empty()) {
+        auto hits = visit(evaluator, qs.stage);
+        if (qs.mask)
+          *qs.mask &= hits;
+        else
+          qs.mask = std::move(hits);
+        if (qs.mask->empty() || all<0>(*qs.mask)) {
+          VAST_DEBUG(self, "skips", qs.stages.size(),
+                     "operands after empty intersection");
+          qs.stages.clear();
+        }
+      }
+      qs.stage = expression{};
+      if (qs.stages.empty())
+        break;
+      // Only dispatching must wait for the merged batches. A query whose hits
+      // are all in completes right away.
+      if (self->state.merging) {
+        VAST_DEBUG(self, "stalls query until merging completes");
+        self->state.stalled.push_back(&expr);
+        return;
+      }
+      qs.stage = std::move(qs.stages.front());
+      qs.stages.erase(qs.stages.begin());
+      VAST_DEBUG(self, "evaluates operand", qs.stage);
+      for (auto& pred : visit(predicatizer{}, qs.stage))
+        if (dispatch(expr, pred, qs.mask ? &*qs.mask : nullptr))
+          qs.pending.insert(pred);
+    }
+    if (!qs.pending.empty())
+      return;
+    qs.mask = {};
+    auto hits = visit(evaluator, expr);
+    if (!hits.empty() && !all<0>(hits) && hits != qs.hits) {
+      VAST_DEBUG(self, "relays", rank(hits), "hits");
+      qs.hits = hits;
+      self->send(sink, expr, std::move(hits), historical_atom::value);
+    }
+    self->send(qs.task, done_atom::value);
+  };
   // Write schema to disk.
   auto flush = [=]() -> expected<void> {
     if (self->state.schema.empty())
@@ -175,6 +360,80 @@ behavior partition(stateful_actor<partition_state>* self, path dir,
     }
     return save(dir / "schema", self->state.schema);
   };
+  // Basic DOWN handler, used again during shutdown.
+  auto on_down = [=](down_msg const& msg) {
+    auto pred = [&](auto& p) { return p.second.address() == msg.source; };
+    auto i = std::find_if(self->state.indexers.begin(),
+                          self->state.indexers.end(), pred);
+    if (i != self->state.indexers.end())
+      self->state.indexers.erase(i);
+  };
+  self->set_down_handler(on_down);
+  // Merges the batches of a sealed partition once it has indexed all events
+  // and has no query in progress. Because the merged indexes replace the
+  // per-batch indexes, we first let all INDEXERs persist their state and
+  // terminate, and then hand the directory to a MERGER. In the meantime, we
+  // defer queries that need INDEXERs.
+  auto merge = [=] {
+    auto& st = self->state;
+    auto running = [](auto& q) { return static_cast<bool>(q.second.task); };
+    auto busy = std::any_of(st.queries.begin(), st.queries.end(), running);
+    if (!st.sealed || st.merging || st.pending_events > 0 || busy)
+      return;
+    std::set<event_id> batches;
+    for (auto& x : st.indexers)
+      batches.insert(x.first);
+    for (auto& x : st.catalog)
+      batches.insert(x.first);
+    if (batches.size() < 2)
+      return;
+    VAST_DEBUG(self, "merges", batches.size(), "batches");
+    st.merging = true;
+    auto finish = [=] {
+      self->state.catalog = scan(self, dir, self->state.schema);
+      // The base IDs of the batches have changed, so predicates must visit
+      // the merged batch again. Their accumulated hits remain valid.
+      for (auto& p : self->state.predicates)
+        p.second.cache.clear();
+      self->state.merging = false;
+      self->set_down_handler(on_down);
+      for (auto& expr : self->state.deferred)
+        self->send(self, expr, historical_atom::value);
+      self->state.deferred.clear();
+      auto stalled = std::move(self->state.stalled);
+      self->state.stalled.clear();
+      for (auto expr : stalled)
+        advance(*expr);
+      if (self->state.shutting_down)
+        self->send(self, shutdown_atom::value);
+    };
+    auto run = [=] {
+      auto m = self->spawn<detached + linked>(merger, dir, self->state.schema);
+      self->request(m, infinite, run_atom::value).then(
+        [=](ok_atom) {
+          finish();
+        },
+        [=](caf::error& e) {
+          VAST_WARNING(self, "failed to merge batches:",
+                       self->system().render(e));
+          finish();
+        }
+      );
+    };
+    if (st.indexers.empty()) {
+      run();
+      return;
+    }
+    for (auto& i : st.indexers)
+      self->send(i.second, shutdown_atom::value);
+    self->set_down_handler(
+      [=](down_msg const& msg) {
+        on_down(msg);
+        if (self->state.indexers.empty())
+          run();
+      }
+    );
+  };
   // Handler executing after indexing a batch of events.
   auto on_done = [=](done_atom, steady_clock::time_point start,
                      uint64_t events) {
@@ -198,25 +457,23 @@ behavior partition(stateful_actor<partition_state>* self, path dir,
     }
     VAST_ASSERT(self->state.pending_events >= events);
     self->state.pending_events -= events;
-  };
-  // Basic DOWN handler, used again during shutdown.
-  auto on_down = [=](down_msg const& msg) {
-    if (msg.source == self->state.proxy) {
-      self->state.proxy = {};
-      return;
+    auto ack = self->state.acks.find(
+      actor_cast<actor_addr>(self->current_sender()));
+    if (ack != self->state.acks.end()) {
+      ack->second.deliver(ok_atom::value);
+      self->state.acks.erase(ack);
     }
-    auto pred = [&](auto& p) { return p.second.address() == msg.source; };
-    auto i = std::find_if(self->state.indexers.begin(),
-                          self->state.indexers.end(), pred);
-    if (i != self->state.indexers.end())
-      self->state.indexers.erase(i);
   };
-  self->set_down_handler(on_down);
   return {
     [=](shutdown_atom) {
+      // A PARTITION that opens the same directory later must not find half
+      // merged batches.
+      if (self->state.merging) {
+        VAST_DEBUG(self, "defers shutdown until merging completes");
+        self->state.shutting_down = true;
+        return;
+      }
       auto msg = self->current_mailbox_element()->move_content_to_message();
-      if (self->state.proxy)
-        self->send(self->state.proxy, msg);
       for (auto& q : self->state.queries)
         self->send(q.second.task, msg);
       if (self->state.indexers.empty()) {
@@ -246,122 +503,118 @@ behavior partition(stateful_actor<partition_state>* self, path dir,
       VAST_DEBUG(self, "registers accountant#" << accountant->id());
       self->state.accountant = accountant;
     },
-    [=](std::vector<event> const& events, schema const& sch) {
+    [=](std::vector<event>& events, schema const& sch) {
       VAST_ASSERT(!events.empty());
       auto first_id = events.front().id();
       auto last_id = events.back().id();
       auto n = events.size();
       VAST_DEBUG(self, "got", n,
                  "events [" << first_id << ',' << (last_id + 1) << ')');
+      // Continuous queries see the events before they reach the indexers, so
+      // that their hits do not have to wait for indexing.
+      if (!self->state.continuous.empty()) {
+        VAST_DEBUG(self, "evaluates", self->state.continuous.size(),
+                   "continuous queries with",
+                   self->state.continuous.predicates(), "predicates");
+        for (auto& x : self->state.continuous.evaluate(events))
+          self->send(sink, std::move(x.first), std::move(x.second),
+                     continuous_atom::value);
+      }
       auto t = self->spawn(task<steady_clock::time_point, uint64_t>,
                            steady_clock::now(), events.size());
       self->send(t, supervisor_atom::value, self);
+      self->state.acks.emplace(t.address(), self->make_response_promise());
       // Merge new schema into the existing one.
       auto result = schema::merge(self->state.schema, sch);
       VAST_ASSERT(result);
       self->state.schema = std::move(*result);
-      // Create one indexer per type.
+      // Split the batch by type in a single pass, so that each INDEXER only
+      // sees the events of its type. Events of types outside the schema do
+      // not get indexed.
+      std::map<std::string, std::vector<event>> slices;
+      for (auto& x : sch)
+        slices[x.name()];
+      for (auto& e : events) {
+        auto i = slices.find(e.type().name());
+        if (i != slices.end())
+          i->second.push_back(std::move(e));
+      }
+      // Create one indexer per type and forward its slice of events.
       auto base = first_id;
       auto interval = to_string(base) + "-" + to_string(base + n);
-      std::vector<actor> indexers;
-      indexers.reserve(sch.size());
-      for (auto& t : sch) {
-        auto p = dir / interval / t.name();
-        auto i = self->spawn<monitored>(event_indexer, p, t);
+      for (auto& x : sch) {
+        auto& slice = slices[x.name()];
+        if (slice.empty())
+          continue;
+        auto p = dir / interval / x.name();
+        auto i = self->spawn<monitored>(event_indexer, p, x);
         self->state.indexers.emplace(base, i);
-        indexers.push_back(i);
+        self->send(t, i);
+        self->send(i, std::move(slice), t);
       }
-      // Forward events to all indexers.
-      auto msg = self->current_mailbox_element()->move_content_to_message();
-      msg = msg.take(1) + make_message(t);
-      for (auto indexer : indexers) {
-        self->send(t, indexer);
-        self->send(indexer, msg);
-      }
-      // Relay indexers to continuous query proxy.
-      if (self->state.proxy)
-        self->send(self->state.proxy, std::move(indexers));
       // Update per-partition statistics.
       self->state.pending_events += n;
       VAST_DEBUG(self, "currently indexes", self->state.pending_events,
                  "events");
+      if (self->state.accountant)
+        self->send(self->state.accountant, "partition.indexing.pending",
+                   uint64_t{self->state.pending_events});
+    },
+    [=](done_atom, steady_clock::time_point start, uint64_t events) {
+      on_done(done_atom::value, start, events);
+      merge();
+    },
+    [=](seal_atom) {
+      VAST_DEBUG(self, "got sealed");
+      self->state.sealed = true;
+      merge();
+    },
+    [=](expression const& expr, continuous_atom) {
+      VAST_DEBUG(self, "got continuous query:", expr);
+      if (!self->state.continuous.add(expr))
+        VAST_DEBUG(self, "has continuous query already:", expr);
+    },
+    [=](expression const& expr, continuous_atom, disable_atom) {
+      VAST_DEBUG(self, "disables continuous query:", expr);
+      if (!self->state.continuous.remove(expr))
+        VAST_WARNING(self, "ignores disable request for unknown query:", expr);
     },
-    on_done,
-    //[=](expression const& expr, continuous_atom) {
-    //  VAST_DEBUG(self, "got continuous query:", expr);
-    //  if (!self->state.proxy)
-    //    self->state.proxy = self->spawn<monitored>(cq_proxy, sink);
-    //  self->send(self->state.proxy, expr);
-    //},
-    //[=](expression const& expr, continuous_atom, disable_atom) {
-    //  VAST_DEBUG(self, "got continuous query:", expr);
-    //  if (!self->state.proxy)
-    //    VAST_WARNING(self, "ignores disable request, no continuous queries");
-    //  else
-    //    self->send(self->state.proxy, expr, disable_atom::value);
-    //},
     [=](expression const& expr, historical_atom) {
       VAST_DEBUG(self, "got historical query:", expr);
-      auto q = self->state.queries.emplace(expr, partition_query_state{}).first;
-      if (!q->second.task) {
-        // Even if we still have evaluated this query in the past, we still
-        // spin up a new task to ensure that we incorporate results from events
-        // that have arrived in the meantime.
-        VAST_DEBUG(self, "spawns new query task");
-        q->second.task = self->spawn(task<steady_clock::time_point, expression>,
-                                     steady_clock::now(), q->first);
-        self->send(q->second.task, supervisor_atom::value, self);
-        self->send(q->second.task, self);
-        // Split up the query into predicates and handle each separately.
-        bitmap cached_hits;
-        for (auto& pred : visit(predicatizer{}, expr)) {
-          VAST_DEBUG(self, "dispatches predicate", pred);
-          auto p =
-            self->state.predicates.emplace(pred, predicate_state()).first;
-          VAST_ASSERT(p->first == pred);
-          p->second.queries.insert(&q->first);
-          auto i = self->state.indexers.begin();
-          while (i != self->state.indexers.end()) {
-            auto base = i->first;
-            if (p->second.cache.contains(base)) {
-              // If an indexer has already looked up this predicate in the
-              // past, it must have sent the hits back to this partition, or is
-              // in the process of doing so.
-              VAST_DEBUG(self, "skips indexers for base", base);
-              while (i->first == base && i != self->state.indexers.end())
-                ++i;
-              // If hits for this predicate exist already, we must send them
-              // back to INDEX. Otherwise INDEX will produce false negatives.
-              if (!p->second.hits.empty() && !all<0>(p->second.hits))
-                cached_hits |= p->second.hits;
-            } else {
-              // Forward the predicate to the subset of indexers which we
-              // haven't asked yet.
-              VAST_DEBUG(self, "relays predicate for base", base);
-              while (i->first == base && i != self->state.indexers.end()) {
-                VAST_DEBUG(self, " - forwards predicate to indexer", i->second);
-                p->second.cache.insert(i->first);
-                if (!p->second.task) {
-                  p->second.task =
-                    self->spawn(task<steady_clock::time_point, predicate>,
-                                steady_clock::now(), pred);
-                  self->send(p->second.task, supervisor_atom::value, self);
-                }
-                self->send(q->second.task, p->second.task);
-                self->send(p->second.task, i->second);
-                self->send(i->second, pred, self, p->second.task);
-                ++i;
-              }
-            }
-          }
-        }
-        if (!cached_hits.empty() && !all<0>(cached_hits))
-          self->send(sink, expr, std::move(cached_hits),
-                     historical_atom::value);
-        self->send(q->second.task, done_atom::value);
+      if (self->state.merging) {
+        VAST_DEBUG(self, "defers query until merging completes");
+        self->state.deferred.push_back(expr);
+        return;
       }
+      auto q = self->state.queries.emplace(expr, partition_query_state{}).first;
       if (!q->second.hits.empty() && !all<0>(q->second.hits))
         self->send(sink, expr, q->second.hits, historical_atom::value);
+      if (q->second.task)
+        return;
+      // Even if we still have evaluated this query in the past, we still
+      // spin up a new task to ensure that we incorporate results from events
+      // that have arrived in the meantime.
+      VAST_DEBUG(self, "spawns new query task");
+      q->second.task = self->spawn(task<steady_clock::time_point, expression>,
+                                   steady_clock::now(), q->first);
+      self->send(q->second.task, supervisor_atom::value, self);
+      self->send(q->second.task, self);
+      // We evaluate the operands of a conjunction in the order of their
+      // estimated cost, so that the cheap ones restrict the expensive ones.
+      auto& stages = q->second.stages;
+      if (auto c = get_if<conjunction>(expr)) {
+        std::vector<std::pair<size_t, expression const*>> operands;
+        for (auto& op : *c)
+          operands.emplace_back(estimate(op), &op);
+        std::stable_sort(
+          operands.begin(), operands.end(),
+          [](auto& x, auto& y) { return x.first < y.first; });
+        for (auto& op : operands)
+          stages.push_back(*op.second);
+      } else {
+        stages.push_back(expr);
+      }
+      advance(q->first);
     },
     [=](predicate const& pred, bitmap const& hits) {
       VAST_DEBUG(self, "got", rank(hits), "hits for predicate:", pred);
@@ -379,10 +632,20 @@ behavior partition(stateful_actor<partition_state>* self, path dir,
       auto& ps = self->state.predicates[pred];
       VAST_DEBUG(self, "took", steady_clock::now() - start,
                  "to answer predicate for", ps.cache.size(), "indexers:", pred);
-      for (auto& q : ps.queries) {
+      // A later operand of a query may need the same predicate again, in which
+      // case it requires a new task.
+      ps.task = {};
+      auto queries = ps.queries;
+      for (auto& q : queries) {
         VAST_ASSERT(q);
-        VAST_DEBUG(self, "evaluates", *q);
         auto& qs = self->state.queries[*q];
+        if (qs.pending.count(pred) > 0) {
+          qs.pending.erase(pred);
+          if (qs.pending.empty())
+            advance(*q);
+          continue;
+        }
+        VAST_DEBUG(self, "evaluates", *q);
         auto hits = visit(evaluator, *q);
         if (!hits.empty() && !all<0>(hits) && hits != qs.hits) {
           VAST_DEBUG(self, "relays", rank(hits), "hits");
@@ -390,7 +653,6 @@ behavior partition(stateful_actor<partition_state>* self, path dir,
           self->send(sink, *q, std::move(hits), historical_atom::value);
         }
       }
-      ps.task = {};
     },
     [=](done_atom, steady_clock::time_point start, expression const& expr) {
       VAST_DEBUG(self, "completed query", expr, "in",
@@ -398,6 +660,7 @@ behavior partition(stateful_actor<partition_state>* self, path dir,
       self->state.queries[expr].task = {};
       auto msg = self->current_mailbox_element()->move_content_to_message();
       self->send(sink, msg);
+      merge();
     },
     [=](flush_atom, actor const& task) {
       VAST_DEBUG(self, "peforms flush");
@@ -0,0 +1,70 @@
+#include <algorithm>
+#include <tuple>
+
+#include "vast/detail/assert.hpp"
+
+#include "vast/system/query_scheduler.hpp"
+
+namespace vast {
+namespace system {
+
+void query_scheduler::enqueue(uuid const& part, expression const& expr,
+                              priority prio, clock::time_point now) {
+  if (!waiting_[part].emplace(expr, now).second)
+    return;
+  auto i = queries_.find(expr);
+  if (i == queries_.end())
+    // A new query has not been served yet and thus gets precedence over the
+    // running queries of the same priority.
+    i = queries_.emplace(expr, query_state{prio, {}, 0}).first;
+  i->second.parts.push_back(part);
+  ++size_;
+}
+
+optional<query_scheduler::job> query_scheduler::next(clock::time_point now) {
+  auto rank = [](auto& x) {
+    return std::make_tuple(x.second.prio, x.second.last_served);
+  };
+  auto i = std::min_element(
+    queries_.begin(), queries_.end(),
+    [&](auto& x, auto& y) { return rank(x) < rank(y); });
+  if (i == queries_.end())
+    return {};
+  VAST_ASSERT(!i->second.parts.empty());
+  i->second.last_served = ++round_;
+  auto w = waiting_.find(i->second.parts.front());
+  VAST_ASSERT(w != waiting_.end());
+  job result;
+  result.partition = w->first;
+  // Every query waiting for the partition gets it now.
+  for (auto& x : w->second) {
+    auto wait = std::chrono::duration_cast<timespan>(now - x.second);
+    result.queries.emplace_back(x.first, wait);
+    auto q = queries_.find(x.first);
+    VAST_ASSERT(q != queries_.end());
+    auto& parts = q->second.parts;
+    auto p = std::find(parts.begin(), parts.end(), w->first);
+    VAST_ASSERT(p != parts.end());
+    parts.erase(p);
+    if (parts.empty())
+      queries_.erase(q);
+  }
+  size_ -= w->second.size();
+  waiting_.erase(w);
+  return result;
+}
+
+bool query_scheduler::contains(expression const& expr) const {
+  return queries_.count(expr) > 0;
+}
+
+size_t query_scheduler::size() const {
+  return size_;
+}
+
+bool query_scheduler::empty() const {
+  return queries_.empty();
+}
+
+} // namespace system
+} // namespace vast
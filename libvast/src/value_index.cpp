@@ -25,6 +25,15 @@ optional<base> parse_base(type const& t) {
   return base::uniform<64>(10);
 }
 
+// Computes the intersection of two bitmaps. Unlike operator&, which returns
+// the other operand when one of them is empty, an empty operand yields an
+// empty result.
+bitmap intersect(bitmap const& x, bitmap const& y) {
+  if (x.empty() || y.empty())
+    return {};
+  return x & y;
+}
+
 } // namespace <anonymous>
 
 std::unique_ptr<value_index> value_index::make(type const& t) {
@@ -174,6 +183,58 @@ value_index::lookup(relational_operator op, data const& x) const {
   return (*result - none_) & mask_;
 }
 
+expected<bitmap>
+value_index::lookup(relational_operator op, data const& x,
+                    bitmap const& candidates) const {
+  // The result spans the entire index, regardless of the candidates.
+  auto fill = [&](bitmap bm) {
+    if (bm.size() < offset())
+      bm.append_bits(false, offset() - bm.size());
+    return bm;
+  };
+  if (is<none>(x)) {
+    if (!(op == equal || op == not_equal))
+      return make_error(ec::unsupported_operator, op);
+    auto nils = op == equal ? none_ & mask_ : ~none_ & mask_;
+    return fill(intersect(nils, candidates));
+  }
+  auto restriction = intersect(mask_ - none_, candidates);
+  if (restriction.empty() || all<0>(restriction))
+    return fill(std::move(restriction));
+  auto result = masked_lookup_impl(op, x, restriction);
+  if (!result)
+    return result;
+  return fill(intersect(*result, restriction));
+}
+
+expected<bitmap>
+value_index::masked_lookup_impl(relational_operator op, data const& x,
+                                bitmap const& candidates) const {
+  auto result = lookup_impl(op, x);
+  if (!result)
+    return result;
+  return intersect(*result, candidates);
+}
+
+expected<void> value_index::merge(value_index const& other) {
+  if (other.offset() == 0)
+    return {};
+  auto off = offset();
+  if (other.offset() < off || select(other.mask_, 1) < off)
+    return make_error(ec::unspecified, "cannot merge overlapping indexes");
+  if (!merge_impl(other))
+    return make_error(ec::type_clash, "cannot merge different indexes");
+  mask_ = splice(mask_, other.mask_, off, other.offset(), false);
+  none_ = splice(none_, other.none_, off, other.offset(), false);
+  // Trailing nils of this index become skipped entries if the other index
+  // contains values.
+  if (rank(other.mask_ - other.none_) > 0)
+    nils_ = other.nils_;
+  else
+    nils_ += other.nils_;
+  return {};
+}
+
 value_index::size_type value_index::offset() const {
   return mask_.size(); // none_ would work just as well.
 }
@@ -211,67 +272,93 @@ bool string_index::push_back_impl(data const& x, size_type skip) {
 
 expected<bitmap>
 string_index::lookup_impl(relational_operator op, data const& x) const {
+  return masked_lookup_impl(op, x, bitmap{length_.size(), true});
+}
+
+expected<bitmap>
+string_index::masked_lookup_impl(relational_operator op, data const& x,
+                                 bitmap const& candidates) const {
   auto str = get_if<std::string>(x);
   if (!str)
     return make_error(ec::type_clash, x);
   auto str_size = str->size();
   if (str_size > max_length_)
     str_size = max_length_;
+  auto zeros = bitmap{length_.size(), false};
   switch (op) {
     default:
       return make_error(ec::unsupported_operator, op);
     case equal:
     case not_equal: {
       if (str_size == 0) {
-        auto result = length_.lookup(equal, 0);
+        auto result = intersect(length_.lookup(equal, 0), candidates);
         if (op == not_equal)
-          result.flip();
+          return candidates - result;
         return result;
       }
       if (str_size > chars_.size())
-        return bitmap{length_.size(), op == not_equal};
-      auto result = length_.lookup(less_equal, str_size);
-      if (all<0>(result))
-        return bitmap{length_.size(), op == not_equal};
+        return op == not_equal ? candidates : zeros;
+      // Starting from the candidates, the conjunction over the characters
+      // only ever shrinks, and each character only evaluates its bit slices
+      // for the remaining candidates.
+      auto length = intersect(length_.lookup(less_equal, str_size), candidates);
+      if (all<0>(length))
+        return op == not_equal ? candidates : zeros;
+      ewah_bitmap result;
+      result.append(length);
       for (auto i = 0u; i < str_size; ++i) {
-        auto b = chars_[i].lookup(equal, static_cast<uint8_t>((*str)[i]));
-        result &= b;
-        if (all<0>(result))
-          return bitmap{length_.size(), op == not_equal};
+        auto c = static_cast<uint8_t>((*str)[i]);
+        result = chars_[i].lookup(equal, c, result);
+        if (result.empty() || all<0>(result))
+          return op == not_equal ? candidates : zeros;
       }
       if (op == not_equal)
-        result.flip();
+        return candidates - result;
       return result;
     }
     case ni:
     case not_ni: {
       if (str_size == 0)
-        return bitmap{length_.size(), op == ni};
+        return op == ni ? candidates : zeros;
       if (str_size > chars_.size())
-        return bitmap{length_.size(), op == not_ni};
+        return op == not_ni ? candidates : zeros;
       // TODO: Be more clever than iterating over all k-grams (#45).
-      bitmap result{length_.size(), false};
+      // Each k-gram only considers the candidates that no previous k-gram
+      // has matched yet.
+      auto remaining = candidates;
       for (auto i = 0u; i < chars_.size() - str_size + 1; ++i) {
-        bitmap substr{length_.size(), 1};
-        auto skip = false;
+        auto substr = remaining;
         for (auto j = 0u; j < str_size; ++j) {
           auto bm = chars_[i + j].lookup(equal, (*str)[j]);
-          if (all<0>(bm)) {
-            skip = true;
+          substr = intersect(substr, bm);
+          if (substr.empty() || all<0>(substr))
+            break;
+        }
+        if (!substr.empty() && !all<0>(substr)) {
+          remaining -= substr;
+          if (all<0>(remaining))
             break;
-          }
-          substr &= bm;
         }
-        if (!skip)
-          result |= substr;
       }
-      if (op == not_ni)
-        result.flip();
-      return result;
+      if (op == ni)
+        return candidates - remaining;
+      return remaining;
     }
   }
 }
 
+bool string_index::merge_impl(value_index const& other) {
+  auto x = dynamic_cast<string_index const*>(&other);
+  if (!x)
+    return false;
+  length_.merge(x->length_);
+  if (x->chars_.size() > chars_.size())
+    chars_.resize(x->chars_.size(), char_bitmap_index{8});
+  for (auto i = 0u; i < x->chars_.size(); ++i)
+    chars_[i].merge(x->chars_[i]);
+  return true;
+}
+
 void address_index::init() {
   if (bytes_[0].coder().storage().empty())
     // Initialize on first to make deserialization feasible.
@@ -300,20 +387,29 @@ bool address_index::push_back_impl(data const& x, size_type skip) {
 
 expected<bitmap>
 address_index::lookup_impl(relational_operator op, data const& x) const {
+  return masked_lookup_impl(op, x, bitmap{v4_.size(), true});
+}
+
+expected<bitmap>
+address_index::masked_lookup_impl(relational_operator op, data const& x,
+                                  bitmap const& candidates) const {
   auto size = v4_.size();
   if (auto addr = get_if<address>(x)) {
     if (!(op == equal || op == not_equal))
       return make_error(ec::unsupported_operator, op);
     auto& bytes = addr->data();
-    auto result = addr->is_v4() ? v4_.coder().storage() : bitmap{size, true};
+    // Each byte only evaluates its bit slices for the remaining candidates.
+    ewah_bitmap result;
+    result.append(addr->is_v4()
+                    ? intersect(v4_.coder().storage(), candidates)
+                    : candidates);
     for (auto i = addr->is_v4() ? 12u : 0u; i < 16; ++i) {
-      auto bm = bytes_[i].lookup(equal, bytes[i]);
-      result &= bm;
-      if (all<0>(result))
-        return bitmap{size, op == not_equal};
+      result = bytes_[i].lookup(equal, bytes[i], result);
+      if (result.empty() || all<0>(result))
+        return op == not_equal ? candidates : bitmap{size, false};
     }
     if (op == not_equal)
-      result.flip();
+      return candidates - result;
     return result;
   } else if (auto sn = get_if<subnet>(x)) {
     if (!(op == in || op == not_in))
@@ -325,24 +421,37 @@ address_index::lookup_impl(relational_operator op, data const& x) const {
     auto is_v4 = net.is_v4();
     if ((is_v4 ? topk + 96 : topk) == 128)
       // Asking for /32 or /128 membership is equivalent to an equality lookup.
-      return lookup_impl(op == in ? equal : not_equal, sn->network());
-    auto result = is_v4 ? v4_.coder().storage() : bitmap{size, true};
+      return masked_lookup_impl(op == in ? equal : not_equal, sn->network(),
+                                candidates);
+    auto result = is_v4
+      ? intersect(v4_.coder().storage(), candidates)
+      : candidates;
     auto& bytes = net.data();
     size_t i = is_v4 ? 12 : 0;
     for ( ; i < 16 && topk >= 8; ++i, topk -= 8)
-      result &= bytes_[i].lookup(equal, bytes[i]);
+      result = intersect(result, bytes_[i].lookup(equal, bytes[i]));
     for (auto j = 0u; j < topk; ++j) {
       auto bit = 7 - j;
       auto& bm = bytes_[i].coder().storage()[bit];
-      result &= (bytes[i] >> bit) & 1 ? ~bm : bm;
+      result = intersect(result, (bytes[i] >> bit) & 1 ? ~bm : bm);
     }
     if (op == not_in)
-      result.flip();
+      return candidates - result;
     return result;
   }
   return make_error(ec::type_clash, x);
 }
 
+bool address_index::merge_impl(value_index const& other) {
+  auto x = dynamic_cast<address_index const*>(&other);
+  if (!x)
+    return false;
+  for (auto i = 0u; i < bytes_.size(); ++i)
+    bytes_[i].merge(x->bytes_[i]);
+  v4_.merge(x->v4_);
+  return true;
+}
+
 void subnet_index::init() {
   if (length_.coder().storage().empty())
     length_ = prefix_index{128 + 1}; // Valid prefixes range from /0 to /128.
@@ -375,6 +484,14 @@ subnet_index::lookup_impl(relational_operator op, data const& x) const {
   return result;
 }
 
+bool subnet_index::merge_impl(value_index const& other) {
+  auto x = dynamic_cast<subnet_index const*>(&other);
+  if (!x)
+    return false;
+  length_.merge(x->length_);
+  return !!network_.merge(x->network_);
+}
+
 
 void port_index::init() {
   if (num_.coder().storage().empty()) {
@@ -410,6 +527,34 @@ port_index::lookup_impl(relational_operator op, data const& x) const {
   return n;
 }
 
+expected<bitmap>
+port_index::masked_lookup_impl(relational_operator op, data const& x,
+                               bitmap const& candidates) const {
+  if (op == in || op == not_in)
+    return make_error(ec::unsupported_operator, op);
+  auto p = get_if<port>(x);
+  if (!p)
+    return make_error(ec::type_clash, x);
+  // The protocol takes a single bitmap, so we apply it first to narrow down
+  // the candidates for the number.
+  ewah_bitmap seed;
+  seed.append(candidates);
+  if (p->type() != port::unknown)
+    seed &= proto_.lookup(equal, p->type());
+  if (all<0>(seed))
+    return bitmap{offset(), false};
+  return num_.lookup(op, p->number(), seed);
+}
+
+bool port_index::merge_impl(value_index const& other) {
+  auto x = dynamic_cast<port_index const*>(&other);
+  if (!x)
+    return false;
+  num_.merge(x->num_);
+  proto_.merge(x->proto_);
+  return true;
+}
+
 
 sequence_index::sequence_index(vast::type t, size_t max_size)
   : max_size_{max_size},
@@ -460,6 +605,50 @@ sequence_index::lookup_impl(relational_operator op, data const& x) const {
   return result;
 }
 
+expected<bitmap>
+sequence_index::masked_lookup_impl(relational_operator op, data const& x,
+                                   bitmap const& candidates) const {
+  if (op == ni)
+    op = in;
+  else if (op == not_ni)
+    op = not_in;
+  if (!(op == in || op == not_in))
+    return make_error(ec::unsupported_operator, op);
+  if (elements_.empty())
+    return bitmap{};
+  // Each element position only considers the candidates that no previous
+  // position has matched yet.
+  auto remaining = candidates;
+  for (auto& element : elements_) {
+    auto hits = element->lookup(equal, x, remaining);
+    if (!hits)
+      return hits;
+    remaining -= *hits;
+    if (all<0>(remaining))
+      break;
+  }
+  if (op == in)
+    return candidates - remaining;
+  return remaining;
+}
+
+bool sequence_index::merge_impl(value_index const& other) {
+  auto x = dynamic_cast<sequence_index const*>(&other);
+  if (!x)
+    return false;
+  size_.merge(x->size_);
+  for (auto i = 0u; i < x->elements_.size(); ++i) {
+    if (i == elements_.size()) {
+      elements_.push_back(value_index::make(value_type_));
+      if (!elements_.back())
+        return false;
+    }
+    if (!elements_[i]->merge(*x->elements_[i]))
+      return false;
+  }
+  return true;
+}
+
 void serialize(caf::serializer& sink, sequence_index const& idx) {
   sink & static_cast<value_index const&>(idx);
   sink & idx.value_type_;
@@ -57,6 +57,100 @@ TEST(events with IDs) {
   REQUIRE_EQUAL(xs->size(), 91u);
   CHECK_EQUAL(xs->front().id(), 666u);
   CHECK_EQUAL(xs->back().id(), 666u + 990);
+  MESSAGE("read batch with external type table");
+  auto types = b.types();
+  REQUIRE_EQUAL(types.size(), 1u);
+  b.types({});
+  batch::reader external{b, types};
+  xs = external.read();
+  REQUIRE(xs);
+  CHECK(*xs == events);
+}
+
+TEST(sparse read across blocks) {
+  MESSAGE("write a batch with tiny blocks");
+  batch::writer writer{compression::lz4, 64};
+  for (auto& e : events)
+    if (!writer.write(e))
+      REQUIRE(!"failed to write event");
+  auto b = writer.seal();
+  b.ids(666, 666 + 1000);
+  MESSAGE("read single events from distant blocks");
+  bitmap ids;
+  ids.append_bits(false, 666 + 500);
+  ids.append_bit(true);
+  ids.append_bits(false, 498);
+  ids.append_bit(true);
+  batch::reader reader{b};
+  auto xs = reader.read(ids);
+  REQUIRE(xs);
+  REQUIRE_EQUAL(xs->size(), 2u);
+  CHECK_EQUAL(xs->front(), events[500]);
+  CHECK_EQUAL(xs->back(), events[999]);
+  MESSAGE("read all events");
+  batch::reader full{b};
+  xs = full.read();
+  REQUIRE(xs);
+  CHECK(*xs == events);
+}
+
+TEST(columnar layout) {
+  MESSAGE("create records spanning multiple columnar blocks");
+  auto conn = type{record_type{
+    {"ts", timestamp_type{}},
+    {"id", record_type{{"orig_h", string_type{}}, {"resp_h", string_type{}}}},
+    {"service", string_type{}},
+    {"bytes", count_type{}}
+  }};
+  conn.name("conn");
+  auto n = batch::columnar_block_events * 2 + 42;
+  std::vector<event> xs;
+  auto t0 = timestamp{timespan{1500000000000000000}};
+  for (auto i = 0u; i < n; ++i) {
+    auto ts = t0 + std::chrono::milliseconds(i * 7);
+    auto service = i % 3 == 0 ? data{} : data{i % 2 ? "http" : "dns"};
+    auto id = vector{"10.0.0." + std::to_string(i % 5), "192.168.0.1"};
+    auto d = vector{ts, std::move(id), std::move(service), count{i * 100}};
+    xs.emplace_back(value{std::move(d), conn});
+    xs.back().timestamp(ts);
+    xs.back().id(i);
+  }
+  MESSAGE("interleave events of another type");
+  xs[100] = event{value{42, event_type}};
+  xs[100].id(100);
+  MESSAGE("include a record that doesn't have the structure of its type");
+  xs[5000] = event{value{vector{t0, nil, "ssh", count{1}}, conn}};
+  xs[5000].id(5000);
+  batch::writer writer{compression::lz4,
+                       detail::compressedbuf::default_block_size,
+                       batch::layout::columnar};
+  for (auto& x : xs)
+    if (!writer.write(x))
+      REQUIRE(!"failed to write event");
+  auto b = writer.seal();
+  REQUIRE(b.ids(0, n));
+  MESSAGE("read all events");
+  batch::reader reader{b};
+  auto ys = reader.read();
+  REQUIRE(ys);
+  REQUIRE_EQUAL(ys->size(), n);
+  CHECK(*ys == xs);
+  CHECK_EQUAL((*ys)[42].timestamp(), xs[42].timestamp());
+  MESSAGE("read sparse events across columnar blocks");
+  bitmap ids;
+  ids.append_bits(false, 100);
+  ids.append_bit(true);
+  ids.append_bits(false, 4899);
+  ids.append_bit(true);
+  ids.append_bits(false, n - 5001 - 1);
+  ids.append_bit(true);
+  batch::reader sparse{b};
+  ys = sparse.read(ids);
+  REQUIRE(ys);
+  REQUIRE_EQUAL(ys->size(), 3u);
+  CHECK_EQUAL((*ys)[0], xs[100]);
+  CHECK_EQUAL((*ys)[1], xs[5000]);
+  CHECK_EQUAL((*ys)[2], xs[n - 1]);
 }
 
 TEST(events without IDs) {
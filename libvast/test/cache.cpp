@@ -62,3 +62,34 @@ TEST(MRU cache) {
   CHECK(!c.contains("foo"));
   CHECK(c.contains("fu"));
 }
+
+TEST(weighted cache) {
+  cache<std::string, std::string> c{10};
+  c.weigh([](std::string const& x) { return x.size(); });
+  size_t evictions = 0;
+  c.on_evict([&](std::string const&, std::string&) { ++evictions; });
+  CHECK(c.insert("a", "xxxx").second);
+  CHECK(c.insert("b", "xxxx").second);
+  CHECK_EQUAL(c.weight(), 8u);
+  CHECK_EQUAL(evictions, 0u);
+  MESSAGE("exceeding the budget evicts the least recently used entry");
+  CHECK(c.lookup("a"));
+  CHECK(c.insert("c", "xxxx").second);
+  CHECK_EQUAL(evictions, 1u);
+  CHECK(!c.contains("b"));
+  CHECK_EQUAL(c.weight(), 8u);
+  MESSAGE("an oversized entry displaces everything else");
+  CHECK(c.insert("d", std::string(20, 'x')).second);
+  CHECK_EQUAL(c.size(), 1u);
+  CHECK_EQUAL(c.weight(), 20u);
+  CHECK_EQUAL(c.erase("d"), 1u);
+  CHECK_EQUAL(c.weight(), 0u);
+  MESSAGE("an entry that grows in place evicts others");
+  CHECK(c.insert("e", "xxxx").second);
+  CHECK(c.insert("f", "xx").second);
+  *c.lookup("f") += "xxxxxx";
+  CHECK(c.reweigh("f"));
+  CHECK(!c.contains("e"));
+  CHECK_EQUAL(c.weight(), 8u);
+  CHECK(!c.reweigh("e"));
+}
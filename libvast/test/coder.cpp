@@ -1,3 +1,5 @@
+#include <set>
+
 #include "vast/base.hpp"
 #include "vast/coder.hpp"
 #include "vast/concept/printable/to_string.hpp"
@@ -29,6 +31,87 @@ std::string dump(double x) {
   return dump(detail::order(x));
 }
 
+// Records the instances that get read, so that we can tell how many bitmaps
+// of a coder a lookup touches.
+std::set<void const*>& reads() {
+  static std::set<void const*> result;
+  return result;
+}
+
+class counting_bitmap : public bitmap_base<counting_bitmap> {
+public:
+  counting_bitmap() = default;
+
+  counting_bitmap(size_type n, bool bit = false) : bits_{n, bit} {
+  }
+
+  counting_bitmap(counting_bitmap const& other) : bits_{other.read()} {
+  }
+
+  counting_bitmap(counting_bitmap&&) = default;
+
+  counting_bitmap& operator=(counting_bitmap const& other) {
+    bits_ = other.read();
+    return *this;
+  }
+
+  counting_bitmap& operator=(counting_bitmap&&) = default;
+
+  bool empty() const {
+    return bits_.empty();
+  }
+
+  size_type size() const {
+    return bits_.size();
+  }
+
+  void append_bit(bool bit) {
+    bits_.append_bit(bit);
+  }
+
+  void append_bits(bool bit, size_type n) {
+    bits_.append_bits(bit, n);
+  }
+
+  void append_block(block_type bits, size_type n = word_type::width) {
+    bits_.append_block(bits, n);
+  }
+
+  void flip() {
+    bits_.flip();
+  }
+
+  friend null_bitmap_range bit_range(counting_bitmap const& bm) {
+    return bit_range(bm.read());
+  }
+
+private:
+  null_bitmap const& read() const {
+    reads().insert(this);
+    return bits_;
+  }
+
+  null_bitmap bits_;
+};
+
+// Counts the bitmaps of a multi-level coder read since the last call.
+template <class Coder>
+size_t touched(Coder const& c) {
+  size_t result = 0;
+  for (auto& component : c.storage())
+    for (auto& bm : component.storage())
+      result += reads().count(&bm);
+  reads().clear();
+  return result;
+}
+
+null_bitmap every(size_t n, size_t k) {
+  null_bitmap result;
+  for (auto i = 0u; i < n; ++i)
+    result.append_bit(i % k == 0);
+  return result;
+}
+
 } // namespace <anonymous>
 
 TEST(bitwise total ordering (integral)) {
@@ -311,6 +394,57 @@ TEST(multi-level range coder) {
   }
 }
 
+TEST(multi-level range coder with candidates) {
+  auto c = multi_level_coder<range_coder<null_bitmap>>{base::uniform(10, 3)};
+  for (auto i = 0u; i < 300; ++i)
+    c.encode(i * 37 % 1000);
+  auto candidates = every(300, 3);
+  for (auto op : {less, less_equal, greater, greater_equal, equal, not_equal})
+    for (auto x : {0, 1, 9, 10, 37, 99, 100, 444, 555, 998, 999}) {
+      auto expected = c.decode(op, x) & candidates;
+      CHECK_EQUAL(to_string(c.decode(op, x, candidates)), to_string(expected));
+    }
+}
+
+TEST(bitslice-coder with candidates) {
+  bitslice_coder<null_bitmap> c{8};
+  for (auto i = 0u; i < 300; ++i)
+    c.encode(i * 37 % 256);
+  auto candidates = every(300, 3);
+  for (auto op : {equal, not_equal})
+    for (auto x : {0, 1, 37, 74, 128, 255}) {
+      auto expected = c.decode(op, x) & candidates;
+      CHECK_EQUAL(to_string(c.decode(op, x, candidates)), to_string(expected));
+    }
+}
+
+TEST(multi-level range coder touches fewer bitmaps for candidates) {
+  using coder_type = multi_level_coder<range_coder<counting_bitmap>>;
+  auto c = coder_type{base::uniform(10, 3)};
+  for (auto i = 0u; i < 1000; ++i)
+    c.encode(i);
+  // A few candidates whose most significant digit differs from the one of
+  // the value to look up.
+  counting_bitmap candidates;
+  for (auto i = 0u; i < 1000; ++i)
+    candidates.append_bit(i == 123 || i == 789);
+  touched(c);
+  MESSAGE("point lookup");
+  auto full = c.decode(equal, 555);
+  CHECK_EQUAL(rank(full), 1u);
+  CHECK_EQUAL(touched(c), 6u);
+  auto restricted = c.decode(equal, 555, candidates);
+  CHECK_EQUAL(rank(restricted), 0u);
+  CHECK_EQUAL(touched(c), 2u);
+  MESSAGE("range lookup");
+  full = c.decode(less_equal, 555);
+  CHECK_EQUAL(rank(full), 556u);
+  CHECK_EQUAL(touched(c), 5u);
+  restricted = c.decode(less_equal, 555, candidates);
+  CHECK_EQUAL(rank(restricted), 1u);
+  CHECK_EQUAL(touched(c), 2u);
+}
+
 TEST(serialization range coder) {
   range_coder<null_bitmap> x{100}, y;
   x.encode(42);
@@ -94,3 +94,58 @@ TEST(compressedbuf - xsgetn) {
   CHECK_EQUAL(n, static_cast<std::streamsize>(data.size()));
   CHECK_EQUAL(str, data);
 }
+
+TEST(compressedbuf - levels and dictionary) {
+  auto data = "Im Kampf zwischen dir und der Welt sekundiere der Welt."s;
+  std::vector<char> dictionary;
+  for (auto i = 0; i < 100; ++i)
+    dictionary.insert(dictionary.end(), data.begin(), data.end());
+  auto compressed_size = [&](int level, std::vector<char> const* dict) {
+    std::stringbuf buf;
+    compressedbuf sink{buf, compression::lz4, 1024, level, dict};
+    std::ostream os{&sink};
+    os << data;
+    os.flush();
+    auto size = buf.str().size();
+    compressedbuf source{buf, compression::lz4, 1024, 0, dict};
+    std::istream is{&source};
+    std::stringstream ss;
+    ss << is.rdbuf();
+    CHECK_EQUAL(ss.str(), data);
+    return size;
+  };
+  for (auto level : {0, 1, 9, lz4::max_level}) {
+    MESSAGE("level " << level);
+    auto plain = compressed_size(level, nullptr);
+    auto primed = compressed_size(level, &dictionary);
+    CHECK_LESS(primed, plain);
+  }
+}
+
+TEST(compressedbuf - parallel compression) {
+  std::string data;
+  for (auto i = 0; i < 10000; ++i)
+    data += std::to_string(i) + " Welt ";
+  auto compress = [&](size_t threads) {
+    std::stringbuf buf;
+    compressedbuf sink{buf, compression::lz4, 1024, 0, nullptr, threads};
+    std::ostream os{&sink};
+    os << data.substr(0, 12345);
+    os.flush();
+    os << data.substr(12345);
+    os.flush();
+    return buf.str();
+  };
+  auto sequential = compress(1);
+  for (auto threads : {2u, 3u, 0u}) {
+    MESSAGE(threads << " threads");
+    auto parallel = compress(threads);
+    CHECK(parallel == sequential);
+    std::stringbuf buf{parallel};
+    compressedbuf source{buf, compression::lz4, 1024};
+    std::istream is{&source};
+    std::stringstream ss;
+    ss << is.rdbuf();
+    CHECK(ss.str() == data);
+  }
+}
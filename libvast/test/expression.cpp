@@ -1,5 +1,6 @@
 #include "vast/event.hpp"
 #include "vast/expression.hpp"
+#include "vast/expression_visitors.hpp"
 #include "vast/load.hpp"
 #include "vast/save.hpp"
 #include "vast/schema.hpp"
@@ -69,6 +70,33 @@ TEST(serialization) {
   CHECK_EQUAL(p->op, equal);
 }
 
+TEST(time bounds) {
+  auto bounds = [](auto str) {
+    auto expr = to<expression>(str);
+    REQUIRE(expr);
+    return visit(time_bounder{}, normalize(*expr));
+  };
+  auto t0 = to<timestamp>("2014-01-16+05:30:12");
+  auto t1 = to<timestamp>("2014-01-17+05:30:12");
+  REQUIRE(t0);
+  REQUIRE(t1);
+  MESSAGE("unconstrained");
+  auto x = bounds("x == 42");
+  CHECK(x.first == timestamp::min());
+  CHECK(x.second == timestamp::max());
+  MESSAGE("conjunction");
+  x = bounds("&time > 2014-01-16+05:30:12 && &time < 2014-01-17+05:30:12"
+             " && x == 42");
+  CHECK(x.first == *t0);
+  CHECK(x.second == *t1);
+  MESSAGE("disjunction");
+  x = bounds("&time == 2014-01-16+05:30:12 || &time == 2014-01-17+05:30:12");
+  CHECK(x.first == *t0);
+  CHECK(x.second == *t1);
+  x = bounds("&time < 2014-01-16+05:30:12 || x == 42");
+  CHECK(x.second == timestamp::max());
+}
+
 TEST(normalization) {
   MESSAGE("extractor on LHS");
   auto expr = to<expression>("\"foo\" in bar");
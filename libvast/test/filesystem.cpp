@@ -160,6 +160,11 @@ TEST(file_and_directory_manipulation) {
   CHECK(mkdir(p));
   CHECK(exists(p));
   CHECK(p.is_directory());
+  auto q = p.parent() / "moved";
+  CHECK(mv(p, q));
+  CHECK(!exists(p));
+  CHECK(q.is_directory());
+  CHECK(mv(q, p));
   CHECK(rm(p));
   CHECK(!p.is_directory());
   CHECK(p.parent().is_directory());
@@ -0,0 +1,177 @@
+#include "vast/event.hpp"
+#include "vast/load.hpp"
+#include "vast/meta_index.hpp"
+#include "vast/save.hpp"
+#include "vast/schema.hpp"
+#include "vast/concept/parseable/to.hpp"
+#include "vast/concept/parseable/vast/address.hpp"
+#include "vast/concept/parseable/vast/expression.hpp"
+#include "vast/concept/parseable/vast/schema.hpp"
+#include "vast/concept/parseable/vast/time.hpp"
+
+#define SUITE meta_index
+#include "test.hpp"
+
+using namespace vast;
+
+namespace {
+
+struct fixture {
+  fixture() {
+    auto s = to<schema>(R"__(
+      type conn = record{
+        orig_h: addr,
+        resp_p: port,
+        service: string,
+        bytes: count
+      }
+    )__");
+    REQUIRE(s);
+    sch = std::move(*s);
+    auto t = sch.find("conn");
+    REQUIRE(t);
+    auto make = [&](char const* addr, port p, char const* service,
+                    count bytes, char const* ts) {
+      auto a = to<address>(addr);
+      auto tp = to<timestamp>(ts);
+      REQUIRE(a);
+      REQUIRE(tp);
+      auto e = event::make(vector{*a, p, service, bytes}, *t);
+      e.timestamp(*tp);
+      return e;
+    };
+    first = uuid::random();
+    second = uuid::random();
+    auto http = port{80, port::tcp};
+    auto https = port{443, port::tcp};
+    auto dns = port{53, port::udp};
+    meta.add(first, {
+      make("10.0.0.1", http, "http", 10u, "2014-01-16+05:30:12"),
+      make("10.0.0.2", https, "http", 100u, "2014-01-16+05:31:12")
+    });
+    meta.add(second, {
+      make("10.0.0.3", dns, "dns", 2000u, "2015-01-16+05:30:12"),
+      make("10.0.0.2", dns, "dns", 3000u, "2015-01-16+05:31:12")
+    });
+  }
+
+  std::vector<uuid> lookup(char const* str) {
+    auto expr = to<expression>(str);
+    REQUIRE(expr);
+    auto result = meta.lookup(*expr);
+    std::sort(result.begin(), result.end());
+    return result;
+  }
+
+  std::vector<uuid> both() {
+    std::vector<uuid> result{first, second};
+    std::sort(result.begin(), result.end());
+    return result;
+  }
+
+  schema sch;
+  meta_index meta;
+  uuid first;
+  uuid second;
+};
+
+} // namespace <anonymous>
+
+FIXTURE_SCOPE(meta_index_tests, fixture)
+
+TEST(meta_index - pruning) {
+  using uuids = std::vector<uuid>;
+  MESSAGE("Bloom filters");
+  CHECK(lookup("orig_h == 10.0.0.1") == uuids{first});
+  CHECK(lookup("orig_h == 10.0.0.2") == both());
+  CHECK(lookup("orig_h == 10.0.0.4") == uuids{});
+  CHECK(lookup("service == \"dns\"") == uuids{second});
+  CHECK(lookup("service in [\"ftp\", \"http\"]") == uuids{first});
+  MESSAGE("port sets");
+  CHECK(lookup("resp_p == 53/udp") == uuids{second});
+  CHECK(lookup("resp_p == 53/tcp") == uuids{});
+  CHECK(lookup("resp_p == 443/?") == uuids{first});
+  MESSAGE("minimum and maximum");
+  CHECK(lookup("bytes > 1000") == uuids{second});
+  CHECK(lookup("bytes <= 10") == uuids{first});
+  CHECK(lookup("bytes == 500") == uuids{});
+  MESSAGE("time and type");
+  CHECK(lookup("&time < 2015-01-01+00:00:00") == uuids{first});
+  CHECK(lookup("&type == \"foo\"") == uuids{});
+  MESSAGE("compound expressions");
+  CHECK(lookup("service == \"dns\" && bytes < 1000") == uuids{});
+  CHECK(lookup("service == \"dns\" || bytes < 50") == both());
+  MESSAGE("undecidable predicates");
+  CHECK(lookup("service != \"http\"") == both());
+  CHECK(lookup("orig_h in 10.0.0.0/8") == both());
+}
+
+TEST(meta_index - sealing) {
+  using uuids = std::vector<uuid>;
+  auto bloom_bits = [&] {
+    auto part = meta.find(first);
+    REQUIRE(part);
+    auto& fields = part->types.at("conn").fields;
+    auto s = get_if<bloom_synopsis>(fields.begin()->second);
+    REQUIRE(s);
+    return s->size();
+  };
+  MESSAGE("filters of active partitions start small");
+  auto before = bloom_bits();
+  CHECK_GREATER_EQUAL(before, bloom_synopsis::default_values * 9);
+  CHECK_LESS_EQUAL(before, bloom_synopsis::default_values * 16);
+  MESSAGE("sealing shrinks filters to the observed values");
+  meta.seal(first);
+  auto after = bloom_bits();
+  CHECK_LESS(after, before);
+  CHECK_EQUAL(after, 64u);
+  CHECK(lookup("orig_h == 10.0.0.1") == uuids{first});
+  CHECK(lookup("service == \"http\"") == uuids{first});
+  CHECK(lookup("orig_h == 10.0.0.3") == uuids{second});
+}
+
+TEST(meta_index - growing Bloom filters) {
+  bloom_synopsis s;
+  CHECK_EQUAL(s.size(), 0u);
+  MESSAGE("a fresh filter has room for the default number of values");
+  s.add("foo");
+  auto initial = s.size();
+  CHECK_LESS_EQUAL(initial, bloom_synopsis::default_values * 16);
+  MESSAGE("repeated values do not grow the filter");
+  for (auto i = 0; i < 10000; ++i)
+    s.add("foo");
+  CHECK_EQUAL(s.size(), initial);
+  MESSAGE("distinct values add stages");
+  auto n = 100000;
+  for (auto i = 0; i < n; ++i)
+    s.add(std::to_string(i));
+  CHECK_GREATER(s.stages.size(), 1u);
+  CHECK_LESS(s.size(), n * 32u);
+  auto missing = 0;
+  for (auto i = 0; i < n; ++i)
+    if (!s.lookup(equal, std::to_string(i)))
+      ++missing;
+  CHECK_EQUAL(missing, 0);
+  MESSAGE("the false positive rate stays below 2%");
+  auto false_positives = 0;
+  for (auto i = n; i < 2 * n; ++i)
+    if (s.lookup(equal, std::to_string(i)))
+      ++false_positives;
+  CHECK_LESS(false_positives, n / 50);
+  MESSAGE("shrinking keeps all values");
+  s.shrink();
+  CHECK(s.lookup(equal, "foo"));
+  CHECK(s.lookup(equal, std::to_string(n - 1)));
+}
+
+TEST(meta_index - serialization) {
+  std::vector<char> buf;
+  REQUIRE(save(buf, meta));
+  meta_index other;
+  REQUIRE(load(buf, other));
+  auto expr = to<expression>("orig_h == 10.0.0.1 && resp_p == 80/tcp");
+  REQUIRE(expr);
+  CHECK(other.lookup(*expr) == std::vector<uuid>{first});
+}
+
+FIXTURE_SCOPE_END()
@@ -22,6 +22,8 @@ TEST(memory-mapped streambuffer) {
   MESSAGE("performing streambuffer tests");
   detail::mmapbuf sb{filename.str()};
   CHECK_EQUAL(sb.size(), data.size());
+  REQUIRE(sb.data() != nullptr);
+  CHECK_EQUAL(std::string(sb.data(), sb.size()), data);
   CHECK_EQUAL(sb.in_avail(), static_cast<std::streamsize>(sb.size()));
   std::string buf;
   buf.resize(3);
@@ -169,6 +169,33 @@ TEST(range_map erasure) {
   CHECK(!i);
 }
 
+TEST(range_map ordered search) {
+  range_map<size_t, char> rm;
+  rm.insert(20, 30, 'a');
+  rm.insert(50, 60, 'b');
+  rm.insert(80, 90, 'c');
+  MESSAGE("lower bound");
+  CHECK_EQUAL(rm.lower_bound(10)->left, 20u);
+  CHECK_EQUAL(rm.lower_bound(25)->left, 20u);
+  CHECK_EQUAL(rm.lower_bound(30)->left, 50u);
+  CHECK(rm.lower_bound(90) == rm.end());
+  MESSAGE("upper bound");
+  CHECK_EQUAL(rm.upper_bound(10)->left, 20u);
+  CHECK_EQUAL(rm.upper_bound(20)->left, 50u);
+  CHECK_EQUAL(rm.upper_bound(79)->left, 80u);
+  CHECK(rm.upper_bound(80) == rm.end());
+  MESSAGE("overlapping ranges");
+  auto r = rm.find_overlapping(25, 81);
+  REQUIRE(r.first != r.second);
+  CHECK_EQUAL(r.first->value, 'a');
+  CHECK_EQUAL(std::distance(r.first, r.second), 3);
+  r = rm.find_overlapping(30, 50);
+  CHECK(r.first == r.second);
+  r = rm.find_overlapping(59, 80);
+  REQUIRE_EQUAL(std::distance(r.first, r.second), 1);
+  CHECK_EQUAL(r.first->value, 'b');
+}
+
 TEST(range_map serialization) {
   range_map<size_t, char> x, y;
   x.insert(50, 60, 'a');
@@ -1,5 +1,7 @@
 #include "vast/concept/printable/stream.hpp"
 #include "vast/concept/printable/vast/event.hpp"
+#include "vast/concept/printable/vast/uuid.hpp"
+#include "vast/detail/compressedbuf.hpp"
 #include "vast/system/archive.hpp"
 
 #define SUITE archive
@@ -9,10 +11,78 @@
 using namespace caf;
 using namespace vast;
 
+namespace {
+
+constexpr auto block_size = detail::compressedbuf::default_block_size;
+
+} // namespace <anonymous>
+
 FIXTURE_SCOPE(archive_tests, fixtures::actor_system_and_events)
 
+TEST(segment extraction) {
+  MESSAGE("chopping conn log into batches of 100 events");
+  system::segment s;
+  auto n = bro_conn_log.size() - bro_conn_log.size() % 100;
+  REQUIRE(n >= 300);
+  for (auto i = 0u; i < n; i += 100) {
+    batch::writer writer{compression::lz4};
+    for (auto j = i; j < i + 100; ++j)
+      REQUIRE(writer.write(bro_conn_log[j]));
+    auto b = writer.seal();
+    b.ids(i, i + 100);
+    s.add(std::move(b));
+  }
+  MESSAGE("extracting sparse IDs across batches");
+  bitmap bm;
+  bm.append_bits(false, 42);
+  bm.append_bit(true);
+  bm.append_bits(false, 157);
+  bm.append_bits(true, 3);
+  bm.append_bits(false, n - bm.size() - 1);
+  bm.append_bit(true);
+  auto xs = s.extract(bm);
+  REQUIRE(xs);
+  REQUIRE_EQUAL(xs->size(), 5u);
+  CHECK_EQUAL((*xs)[0].id(), 42u);
+  CHECK_EQUAL((*xs)[1].id(), 200u);
+  CHECK_EQUAL((*xs)[3].id(), 202u);
+  CHECK_EQUAL((*xs)[4].id(), n - 1);
+  CHECK_EQUAL((*xs)[4], bro_conn_log[n - 1]);
+  MESSAGE("extracting IDs outside the segment");
+  auto outside = bitmap{};
+  outside.append_bits(false, n);
+  outside.append_bits(true, 10);
+  xs = s.extract(outside);
+  REQUIRE(xs);
+  CHECK(xs->empty());
+  MESSAGE("writing and memory-mapping the segment");
+  if (!exists(directory))
+    REQUIRE(mkdir(directory));
+  auto filename = directory / "segment";
+  REQUIRE(s.write(filename));
+  auto mapped = system::segment::open(filename);
+  REQUIRE(mapped);
+  CHECK_EQUAL(mapped->id(), s.id());
+  CHECK_EQUAL(bytes(*mapped), bytes(s));
+  CHECK_EQUAL(resident(s), bytes(s));
+  auto header = resident(*mapped);
+  CHECK_LESS(header, bytes(*mapped));
+  mapped->prefetch(bm);
+  auto ys = mapped->extract(bm);
+  REQUIRE(ys);
+  MESSAGE("only decoded batches count as resident");
+  CHECK_GREATER(resident(*mapped), header);
+  CHECK_LESS(resident(*mapped), bytes(*mapped));
+  REQUIRE_EQUAL(ys->size(), 5u);
+  CHECK_EQUAL((*ys)[2].id(), 201u);
+  CHECK_EQUAL((*ys)[4], bro_conn_log[n - 1]);
+}
+
 TEST(archiving and querying) {
-  auto a = self->spawn(system::archive, directory, 10, 1024 * 1024);
+  auto capacity = 64 * 1024 * 1024;
+  auto a = self->spawn(system::archive, directory, capacity, 1024 * 1024, 2,
+                       compression::lz4, 0, true, block_size,
+                       batch::layout::row);
   MESSAGE("sending events");
   self->send(a, bro_conn_log);
   self->send(a, bro_dns_log);
@@ -44,4 +114,312 @@ TEST(archiving and querying) {
   self->send(a, system::shutdown_atom::value);
 }
 
+TEST(high compression with dictionaries) {
+  auto capacity = 64 * 1024 * 1024;
+  auto a = self->spawn(system::archive, directory, capacity, 1024 * 1024, 2,
+                       compression::lz4, 9, true, block_size,
+                       batch::layout::row);
+  MESSAGE("sending events");
+  self->send(a, bro_conn_log);
+  self->send(a, bro_dns_log);
+  MESSAGE("querying event set {[8400,8500)}");
+  bitmap bm;
+  bm.append_bits(false, 8400);
+  bm.append_bits(true, 100);
+  std::vector<event> result;
+  self->request(a, infinite, bm).receive(
+    [&](std::vector<event>& xs) { result = std::move(xs); },
+    error_handler()
+  );
+  REQUIRE_EQUAL(result.size(), 100u);
+  std::sort(result.begin(), result.end());
+  CHECK_EQUAL(result[0], bro_conn_log[8400]);
+  CHECK_EQUAL(result[61], bro_conn_log.back());
+  CHECK_EQUAL(result[62], bro_dns_log.front());
+  self->send(a, system::shutdown_atom::value);
+}
+
+TEST(columnar batches) {
+  auto capacity = 64 * 1024 * 1024;
+  auto a = self->spawn(system::archive, directory, capacity, 1024 * 1024, 2,
+                       compression::lz4, 0, true, block_size,
+                       batch::layout::columnar);
+  MESSAGE("writing conn.log to disk");
+  self->send(a, bro_conn_log);
+  self->request(a, infinite, flush_atom::value).receive(
+    [&](ok_atom) { /* nop */ },
+    error_handler()
+  );
+  self->monitor(a);
+  self->send(a, system::shutdown_atom::value);
+  self->receive([&](down_msg const& msg) { CHECK(msg.source == a); });
+  MESSAGE("querying event set {[8400,8462)} after restart");
+  a = self->spawn(system::archive, directory, capacity, 1024 * 1024, 2,
+                  compression::lz4, 0, true, block_size,
+                  batch::layout::columnar);
+  bitmap bm;
+  bm.append_bits(false, 8400);
+  bm.append_bits(true, 100);
+  std::vector<event> result;
+  self->request(a, infinite, bm).receive(
+    [&](std::vector<event>& xs) { result = std::move(xs); },
+    error_handler()
+  );
+  REQUIRE_EQUAL(result.size(), 62u);
+  std::sort(result.begin(), result.end());
+  CHECK_EQUAL(result[0], bro_conn_log[8400]);
+  CHECK_EQUAL(result[61], bro_conn_log.back());
+  self->send(a, system::shutdown_atom::value);
+}
+
+TEST(streaming lookup) {
+  auto capacity = 64 * 1024 * 1024;
+  auto a = self->spawn(system::archive, directory, capacity, 1024, 2,
+                       compression::lz4, 0, true, block_size,
+                       batch::layout::row);
+  MESSAGE("sending events");
+  self->send(a, bro_conn_log);
+  self->send(a, bro_dns_log);
+  MESSAGE("querying event set {[100,150), [10150,10200)}");
+  bitmap bm;
+  bm.append_bits(false, 100);
+  bm.append_bits(true, 50);
+  bm.append_bits(false, 10000);
+  bm.append_bits(true, 50);
+  self->send(a, bm, actor_cast<actor>(self));
+  std::vector<event> result;
+  auto chunks = 0;
+  auto done = false;
+  self->do_receive(
+    [&](std::vector<event>& xs) {
+      ++chunks;
+      std::move(xs.begin(), xs.end(), std::back_inserter(result));
+    },
+    [&](system::done_atom, uint64_t shipped) {
+      CHECK_EQUAL(shipped, result.size());
+      done = true;
+    },
+    error_handler()
+  ).until([&] { return done; });
+  MESSAGE("small segments yield one chunk per segment");
+  CHECK_GREATER(chunks, 1);
+  REQUIRE_EQUAL(result.size(), 100u);
+  std::sort(result.begin(), result.end());
+  CHECK_EQUAL(result[0].id(), 100u);
+  CHECK_EQUAL(result[99].id(), 10199u);
+  self->send(a, system::shutdown_atom::value);
+}
+
+TEST(time-restricted lookup) {
+  auto capacity = 64 * 1024 * 1024;
+  auto a = self->spawn(system::archive, directory, capacity, 1024, 0,
+                       compression::lz4, 0, true, block_size,
+                       batch::layout::row);
+  MESSAGE("sending events and awaiting acknowledgement");
+  self->request(a, infinite, bro_conn_log).receive(
+    [](ok_atom) {},
+    error_handler()
+  );
+  bitmap bm;
+  bm.append_bits(true, bro_conn_log.size());
+  auto from = bro_conn_log[100].timestamp();
+  auto to = bro_conn_log[200].timestamp();
+  REQUIRE(from <= to);
+  auto expected = std::count_if(
+    bro_conn_log.begin(), bro_conn_log.end(),
+    [&](auto& x) { return x.timestamp() >= from && x.timestamp() <= to; });
+  MESSAGE("querying all events in an interval");
+  std::vector<event> result;
+  self->request(a, infinite, bm, from, to).receive(
+    [&](std::vector<event>& xs) { result = std::move(xs); },
+    error_handler()
+  );
+  REQUIRE_EQUAL(result.size(), static_cast<size_t>(expected));
+  for (auto& x : result) {
+    CHECK(x.timestamp() >= from);
+    CHECK(x.timestamp() <= to);
+  }
+  MESSAGE("querying an interval before all events");
+  auto earliest = std::min_element(
+    bro_conn_log.begin(), bro_conn_log.end(),
+    [](auto& x, auto& y) { return x.timestamp() < y.timestamp(); });
+  auto before = earliest->timestamp() - std::chrono::seconds(1);
+  self->request(a, infinite, bm, timestamp::min(), before).receive(
+    [&](std::vector<event>& xs) { result = std::move(xs); },
+    error_handler()
+  );
+  CHECK(result.empty());
+  self->send(a, system::shutdown_atom::value);
+}
+
+TEST(compaction) {
+  auto capacity = 64 * 1024 * 1024;
+  auto a = self->spawn(system::archive, directory, capacity, capacity, 0,
+                       compression::lz4, 0, true, block_size,
+                       batch::layout::row);
+  MESSAGE("flushing after each log to create undersized segments");
+  for (auto xs : {&bro_conn_log, &bro_dns_log, &bro_http_log}) {
+    self->send(a, *xs);
+    self->request(a, infinite, flush_atom::value).receive(
+      [&](ok_atom) { /* nop */ },
+      error_handler()
+    );
+  }
+  MESSAGE("querying across all segments");
+  bitmap bm;
+  bm.append_bits(false, 100);
+  bm.append_bits(true, 10);
+  bm.append_bits(false, 10000);
+  bm.append_bits(true, 10);
+  bm.append_bits(false, 5000);
+  bm.append_bits(true, 10);
+  std::vector<event> result;
+  self->request(a, infinite, bm).receive(
+    [&](std::vector<event>& xs) { result = std::move(xs); },
+    error_handler()
+  );
+  CHECK_EQUAL(result.size(), 30u);
+  MESSAGE("waiting for termination");
+  self->monitor(a);
+  self->send(a, system::shutdown_atom::value);
+  self->receive([&](down_msg const& msg) { CHECK(msg.source == a); });
+  auto segments = 0;
+  for (auto& entry : vast::directory{directory})
+    if (entry.basename().str() != "meta"
+        && entry.basename().str() != "journal")
+      ++segments;
+  CHECK_LESS(segments, 3);
+}
+
+TEST(compaction of disjoint ranges) {
+  auto capacity = 64 * 1024 * 1024;
+  auto a = self->spawn(system::archive, directory, capacity, capacity, 0,
+                       compression::lz4, 0, true, block_size,
+                       batch::layout::row);
+  MESSAGE("creating a segment with the ID ranges [0,100) and [200,300)");
+  auto first = bro_conn_log.begin();
+  for (auto xs : {std::vector<event>(first, first + 100),
+                  std::vector<event>(first + 200, first + 300)})
+    self->request(a, infinite, xs).receive(
+      [](ok_atom) { /* nop */ },
+      error_handler()
+    );
+  self->request(a, infinite, flush_atom::value).receive(
+    [&](ok_atom) { /* nop */ },
+    error_handler()
+  );
+  MESSAGE("creating an undersized segment to merge with");
+  self->send(a, bro_dns_log);
+  self->request(a, infinite, flush_atom::value).receive(
+    [&](ok_atom) { /* nop */ },
+    error_handler()
+  );
+  self->monitor(a);
+  self->send(a, system::shutdown_atom::value);
+  self->receive([&](down_msg const& msg) { CHECK(msg.source == a); });
+  auto segments = 0;
+  for (auto& entry : vast::directory{directory})
+    if (entry.basename().str() != "meta"
+        && entry.basename().str() != "journal"
+        && entry.basename().str() != "profiler")
+      ++segments;
+  CHECK_EQUAL(segments, 1);
+  MESSAGE("querying both ranges of the merged segment after restart");
+  a = self->spawn(system::archive, directory, capacity, capacity, 0,
+                  compression::lz4, 0, true, block_size,
+                  batch::layout::row);
+  bitmap bm;
+  bm.append_bits(false, 50);
+  bm.append_bits(true, 50);
+  bm.append_bits(false, 100);
+  bm.append_bits(true, 50);
+  bm.append_bits(false, bro_dns_log.front().id() - bm.size());
+  bm.append_bits(true, 10);
+  std::vector<event> result;
+  self->request(a, infinite, bm).receive(
+    [&](std::vector<event>& xs) { result = std::move(xs); },
+    error_handler()
+  );
+  REQUIRE_EQUAL(result.size(), 110u);
+  std::sort(result.begin(), result.end());
+  CHECK_EQUAL(result[0], bro_conn_log[50]);
+  CHECK_EQUAL(result[50], bro_conn_log[200]);
+  CHECK_EQUAL(result[99], bro_conn_log[249]);
+  CHECK_EQUAL(result[100], bro_dns_log[0]);
+  self->send(a, system::shutdown_atom::value);
+}
+
+TEST(compaction syncs directory before removing segments) {
+  auto capacity = 64 * 1024 * 1024;
+  auto a = self->spawn(system::archive, directory, capacity, capacity, 0,
+                       compression::lz4, 0, true, block_size,
+                       batch::layout::row);
+  self->send(a, actor_cast<system::accountant_type>(self));
+  MESSAGE("flushing after each log to create undersized segments");
+  for (auto xs : {&bro_conn_log, &bro_dns_log, &bro_http_log}) {
+    self->send(a, *xs);
+    self->request(a, infinite, flush_atom::value).receive(
+      [&](ok_atom) { /* nop */ },
+      error_handler()
+    );
+  }
+  MESSAGE("checking the order of syncs and removals");
+  self->monitor(a);
+  self->send(a, system::shutdown_atom::value);
+  // The number of segments that the last directory sync covers.
+  auto covered = uint64_t{0};
+  auto removed = uint64_t{0};
+  auto down = false;
+  self->do_receive(
+    [&](std::string const& key, uint64_t n) {
+      if (key == "archive.sync.directory") {
+        covered = n;
+      } else if (key == "archive.segments.removed") {
+        CHECK_EQUAL(n, covered);
+        covered = 0;
+        removed += n;
+      }
+    },
+    [&](std::string const&, double) { /* nop */ },
+    [&](down_msg const& msg) {
+      CHECK(msg.source == a);
+      down = true;
+    }
+  ).until([&] { return down; });
+  CHECK_GREATER(removed, 0u);
+}
+
+TEST(journal recovery) {
+  auto capacity = 64 * 1024 * 1024;
+  auto a = self->spawn(system::archive, directory, capacity, 1024, 0,
+                       compression::lz4, 0, true, block_size,
+                       batch::layout::row);
+  MESSAGE("flushing a segment to disk");
+  self->send(a, bro_conn_log);
+  self->request(a, infinite, flush_atom::value).receive(
+    [&](ok_atom) { /* nop */ },
+    error_handler()
+  );
+  CHECK(exists(directory / "journal"));
+  self->monitor(a);
+  self->send(a, system::shutdown_atom::value);
+  self->receive([&](down_msg const& msg) { CHECK(msg.source == a); });
+  MESSAGE("restarting from the journal");
+  a = self->spawn(system::archive, directory, capacity, 1024, 0,
+                       compression::lz4, 0, true, block_size,
+                       batch::layout::row);
+  bitmap bm;
+  bm.append_bits(false, 100);
+  bm.append_bits(true, 50);
+  std::vector<event> result;
+  self->request(a, infinite, bm).receive(
+    [&](std::vector<event>& xs) { result = std::move(xs); },
+    error_handler()
+  );
+  REQUIRE_EQUAL(result.size(), 50u);
+  std::sort(result.begin(), result.end());
+  CHECK_EQUAL(result[0].id(), 100u);
+  self->send(a, system::shutdown_atom::value);
+}
+
 FIXTURE_SCOPE_END()
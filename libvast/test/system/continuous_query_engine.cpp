@@ -0,0 +1,101 @@
+#include "vast/bitmap.hpp"
+#include "vast/event.hpp"
+#include "vast/schema.hpp"
+#include "vast/concept/parseable/to.hpp"
+#include "vast/concept/parseable/vast/address.hpp"
+#include "vast/concept/parseable/vast/expression.hpp"
+#include "vast/concept/parseable/vast/schema.hpp"
+
+#include "vast/system/continuous_query_engine.hpp"
+
+#define SUITE system
+#include "test.hpp"
+
+using namespace vast;
+using namespace vast::system;
+
+namespace {
+
+struct fixture {
+  fixture() {
+    auto s = to<schema>(R"__(
+      type conn = record{
+        orig_h: addr,
+        resp_p: port,
+        service: string
+      }
+    )__");
+    REQUIRE(s);
+    auto t = s->find("conn");
+    REQUIRE(t);
+    auto make = [&](char const* addr, port p, char const* service) {
+      auto a = to<address>(addr);
+      REQUIRE(a);
+      auto e = event::make(vector{*a, p, service}, *t);
+      e.id(100 + events.size());
+      events.push_back(std::move(e));
+    };
+    make("10.0.0.1", port{80, port::tcp}, "http");
+    make("10.0.0.2", port{443, port::tcp}, "http");
+    make("10.0.0.3", port{53, port::udp}, "dns");
+  }
+
+  expression query(char const* str) {
+    auto expr = to<expression>(str);
+    REQUIRE(expr);
+    return *expr;
+  }
+
+  std::vector<event> events;
+};
+
+std::vector<event_id> ids(bitmap const& bm) {
+  std::vector<event_id> result;
+  for (auto i : select(bm))
+    result.push_back(i);
+  return result;
+}
+
+} // namespace <anonymous>
+
+FIXTURE_SCOPE(continuous_query_engine_tests, fixture)
+
+TEST(continuous query engine) {
+  continuous_query_engine engine;
+  auto http = query("service == \"http\"");
+  auto https = query("service == \"http\" && resp_p == 443/?");
+  auto other = query("service != \"http\"");
+  auto none = query("orig_h == 10.0.0.9");
+  CHECK(engine.add(http));
+  CHECK(engine.add(https));
+  CHECK(engine.add(other));
+  CHECK(engine.add(none));
+  CHECK(!engine.add(http));
+  CHECK_EQUAL(engine.size(), 4u);
+  MESSAGE("queries share predicates");
+  CHECK_EQUAL(engine.predicates(), 4u);
+  MESSAGE("evaluating a batch");
+  auto result = engine.evaluate(events);
+  REQUIRE_EQUAL(result.size(), 3u);
+  for (auto& x : result)
+    if (x.first == http)
+      CHECK(ids(x.second) == (std::vector<event_id>{100, 101}));
+    else if (x.first == https)
+      CHECK(ids(x.second) == std::vector<event_id>{101});
+    else if (x.first == other)
+      CHECK(ids(x.second) == std::vector<event_id>{102});
+    else
+      FAIL("unexpected query");
+  MESSAGE("removing queries");
+  CHECK(engine.remove(https));
+  CHECK(!engine.remove(https));
+  CHECK_EQUAL(engine.predicates(), 3u);
+  CHECK(engine.remove(http));
+  CHECK(engine.remove(other));
+  CHECK(engine.remove(none));
+  CHECK(engine.empty());
+  CHECK_EQUAL(engine.predicates(), 0u);
+  CHECK(engine.evaluate(events).empty());
+}
+
+FIXTURE_SCOPE_END()
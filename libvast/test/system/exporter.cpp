@@ -2,6 +2,7 @@
 #include "vast/concept/parseable/vast/expression.hpp"
 #include "vast/query_options.hpp"
 
+#include "vast/detail/compressedbuf.hpp"
 #include "vast/system/archive.hpp"
 #include "vast/system/archive.hpp"
 #include "vast/system/exporter.hpp"
@@ -15,11 +16,19 @@ using namespace caf;
 using namespace vast;
 using namespace std::chrono;
 
+namespace {
+
+constexpr auto block_size = detail::compressedbuf::default_block_size;
+
+} // namespace <anonymous>
+
 FIXTURE_SCOPE(exporter_tests, fixtures::actor_system_and_events)
 
 TEST(exporter) {
   auto i = self->spawn(system::index, directory / "index", 1000, 2);
-  auto a = self->spawn(system::archive, directory / "archive", 1, 1024);
+  auto a = self->spawn(system::archive, directory / "archive",
+                       1024 * 1024, 1024, 0, compression::lz4, 0,
+                       true, block_size, batch::layout::row);
   MESSAGE("ingesting conn.log");
   self->send(i, bro_conn_log);
   self->send(a, bro_conn_log);
@@ -44,6 +53,69 @@ TEST(exporter) {
   CHECK_EQUAL(results.front().id(), 105u);
   CHECK_EQUAL(results.front().type().name(), "bro::conn");
   CHECK_EQUAL(results.back().id(), 8354u);
+  MESSAGE("waiting for completion");
+  auto done = false;
+  self->do_receive(
+    [&](uuid const&, system::progress_atom, double, uint64_t) { /* nop */ },
+    [&](uuid const&, system::done_atom, timespan) { done = true; },
+    error_handler()
+  ).until([&] { return done; });
+  self->send(i, system::shutdown_atom::value);
+  self->send(a, system::shutdown_atom::value);
+}
+
+TEST(exporter with missing segments) {
+  auto i = self->spawn(system::index, directory / "index", 1000, 2);
+  auto a = self->spawn(system::archive, directory / "archive",
+                       1024 * 1024, 1024, 0, compression::lz4, 0,
+                       true, block_size, batch::layout::row);
+  MESSAGE("ingesting conn.log and writing it to disk");
+  self->send(i, bro_conn_log);
+  self->send(a, bro_conn_log);
+  self->request(a, infinite, flush_atom::value).receive(
+    [&](ok_atom) { /* nop */ },
+    error_handler()
+  );
+  self->monitor(a);
+  self->send(a, system::shutdown_atom::value);
+  self->receive([&](down_msg const& msg) { CHECK(msg.source == a); });
+  MESSAGE("deleting all segments");
+  std::vector<path> segments;
+  for (auto& entry : vast::directory{directory / "archive"})
+    if (entry.basename().str() != "meta"
+        && entry.basename().str() != "journal")
+      segments.push_back(entry);
+  REQUIRE(!segments.empty());
+  for (auto& x : segments)
+    REQUIRE(rm(x));
+  a = self->spawn(system::archive, directory / "archive",
+                  1024 * 1024, 1024, 0, compression::lz4, 0,
+                  true, block_size, batch::layout::row);
+  MESSAGE("issueing query");
+  auto expr = to<expression>("service == \"http\" && addr == 212.227.96.110");
+  REQUIRE(expr);
+  auto e = self->spawn<monitored>(system::exporter, *expr, historical);
+  self->send(e, a);
+  self->send(e, system::put_atom::value, system::index_atom::value, i);
+  self->send(e, system::put_atom::value, system::sink_atom::value, self);
+  self->send(e, system::run_atom::value);
+  self->send(e, system::extract_atom::value);
+  MESSAGE("waiting for the lookup to fail");
+  auto failed = false;
+  auto down = false;
+  self->do_receive(
+    [&](uuid const&, system::progress_atom, double, uint64_t) { /* nop */ },
+    [&](std::vector<event> const&) { FAIL("got events of deleted segments"); },
+    [&](uuid const&, system::done_atom, timespan) {
+      FAIL("completed query despite failed lookup");
+    },
+    [&](caf::error const&) { failed = true; },
+    [&](down_msg const& msg) {
+      CHECK(msg.source == e);
+      CHECK(msg.reason != exit_reason::normal);
+      down = true;
+    }
+  ).until([&] { return failed && down; });
   self->send(i, system::shutdown_atom::value);
   self->send(a, system::shutdown_atom::value);
 }
@@ -16,6 +16,7 @@ FIXTURE_SCOPE(index_tests, fixtures::actor_system_and_events)
 
 namespace {
 
+// Returns the hits of the query along with the exit reason of its task.
 auto issue_query = [](auto& self, auto& idx, auto error_handler) {
   auto expr = to<expression>("string == \"SF\" && id.resp_p == 443/?");
   REQUIRE(expr);
@@ -42,10 +43,15 @@ auto issue_query = [](auto& self, auto& idx, auto error_handler) {
     }
   ).until([&] { return done; });
   CHECK_EQUAL(rank(hits), 38u);
+  error reason;
   self->receive(
-    [&](down_msg const& msg) { CHECK(msg.source == task); },
+    [&](down_msg const& msg) {
+      CHECK(msg.source == task);
+      reason = msg.reason;
+    },
     error_handler
   );
+  return std::make_pair(hits, reason);
 };
 
 } // namespace <anonymous>
@@ -67,7 +73,16 @@ TEST(index) {
   MESSAGE("reloading index");
   idx = self->spawn<monitored>(system::index, directory, 1000, 2);
   MESSAGE("issueing query against passive partition");
-  issue_query(self, idx, error_handler());
+  auto first = issue_query(self, idx, error_handler());
+  // The task completes once all partitions have answered.
+  CHECK(first.second == exit_reason::normal);
+  MESSAGE("issueing the same query against the result cache");
+  auto second = issue_query(self, idx, error_handler());
+  // All partitions belong to the coverage of the cached result. Without a
+  // partition to ask, the index terminates the task right after relaying the
+  // cached hits.
+  CHECK(second.second == exit_reason::user_shutdown);
+  CHECK(second.first == first.first);
   MESSAGE("shutting down index");
   self->send(idx, system::shutdown_atom::value);
   self->receive(
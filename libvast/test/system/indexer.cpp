@@ -94,6 +94,20 @@ TEST(indexer) {
     error_handler()
   );
   CHECK_EQUAL(rank(result), 53u);
+  MESSAGE("querying event meta data");
+  pred = to<predicate>("&time > 2000-01-01+00:00:00");
+  REQUIRE(pred);
+  t = self->spawn<monitored>(system::task<>);
+  self->send(t, i);
+  self->send(i, *pred, self, t);
+  self->receive(
+    [&](predicate const& p, bitmap const& bm) {
+      CHECK(p == *pred);
+      result = bm;
+    },
+    error_handler()
+  );
+  CHECK_EQUAL(rank(result), bro_conn_log.size());
 }
 
 FIXTURE_SCOPE_END()
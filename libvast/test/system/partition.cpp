@@ -18,9 +18,12 @@ FIXTURE_SCOPE(partition_tests, fixtures::actor_system_and_events)
 
 namespace {
 
-auto issue_query = [](auto& self, auto& part) {
-  MESSAGE("sending query");
-  auto expr = to<expression>("string == \"SF\" && id.resp_p == 443/?");
+auto issue_query = [](auto& self, auto& part,
+                      char const* query = "string == \"SF\" && "
+                                          "id.resp_p == 443/?",
+                      size_t expected = 38) {
+  MESSAGE("sending query: " << query);
+  auto expr = to<expression>(query);
   REQUIRE(expr);
   self->send(part, *expr, system::historical_atom::value);
   bool done = false;
@@ -35,7 +38,7 @@ auto issue_query = [](auto& self, auto& part) {
       done = true;
     }
   ).until([&] { return done; });
-  CHECK_EQUAL(rank(hits), 38u);
+  CHECK_EQUAL(rank(hits), expected);
 };
 
 } // namespace <anonymous>
@@ -46,12 +49,17 @@ TEST(partition) {
   auto p = self->spawn<monitored>(system::partition, directory, self);
   schema sch;
   REQUIRE(sch.add(bro_conn_log[0].type()));
-  self->send(p, bro_conn_log, sch);
+  self->request(p, infinite, bro_conn_log, sch).receive(
+    [&](ok_atom) { MESSAGE("partition indexed conn.log"); },
+    error_handler()
+  );
   MESSAGE("ingesting http.log");
   sch = {};
   REQUIRE(sch.add(bro_http_log[0].type()));
   self->send(p, bro_http_log, sch);
   issue_query(self, p);
+  MESSAGE("cutting off a conjunction after an operand without hits");
+  issue_query(self, p, "string ni \"SF\" && id.resp_p == 31337/?", 0);
   MESSAGE("flushing to filesystem");
   auto t = self->spawn<monitored>(system::task<>);
   self->send(t, p);
@@ -72,6 +80,10 @@ TEST(partition) {
   MESSAGE("loading persistent state from file system");
   p = self->spawn<monitored>(system::partition, directory, self);
   issue_query(self, p);
+  MESSAGE("merging batches of sealed partition");
+  self->send(p, system::seal_atom::value);
+  issue_query(self, p);
+  CHECK(!exists(directory / "0-8462"));
   self->send(p, system::shutdown_atom::value);
   self->receive(
     [&](down_msg const& msg) { CHECK(msg.source == p); },
@@ -113,4 +125,72 @@ TEST(partition) {
   //rm(dir);
 }
 
+TEST(partition - loading indexers on demand) {
+  directory /= "partition";
+  MESSAGE("ingesting conn.log and http.log into separate batches");
+  auto p = self->spawn<monitored>(system::partition, directory, self);
+  schema sch;
+  REQUIRE(sch.add(bro_conn_log[0].type()));
+  self->request(p, infinite, bro_conn_log, sch).receive(
+    [&](ok_atom) { /* nop */ },
+    error_handler()
+  );
+  sch = {};
+  REQUIRE(sch.add(bro_http_log[0].type()));
+  self->request(p, infinite, bro_http_log, sch).receive(
+    [&](ok_atom) { /* nop */ },
+    error_handler()
+  );
+  self->send(p, system::shutdown_atom::value);
+  self->receive(
+    [&](down_msg const& msg) { CHECK(msg.source == p); },
+    error_handler()
+  );
+  MESSAGE("reopening the partition with ourselves as accountant");
+  p = self->spawn<monitored>(system::partition, directory, self);
+  self->send(p, actor_cast<system::accountant_type>(self));
+  // Issues a query and returns the number of hits along with the number of
+  // INDEXERs the partition loaded from disk for it.
+  auto query = [&](char const* str) {
+    MESSAGE("sending query: " << str);
+    auto expr = to<expression>(str);
+    REQUIRE(expr);
+    self->send(p, *expr, system::historical_atom::value);
+    auto done = false;
+    auto loaded = uint64_t{0};
+    bitmap hits;
+    self->do_receive(
+      [&](std::string const& key, uint64_t n) {
+        if (key == "partition.indexers.loaded")
+          loaded += n;
+      },
+      [&](expression const&, bitmap const& bm, system::historical_atom) {
+        hits |= bm;
+      },
+      [&](system::done_atom, steady_clock::time_point, expression const&) {
+        done = true;
+      },
+      error_handler()
+    ).until([&] { return done; });
+    return std::make_pair(rank(hits), loaded);
+  };
+  MESSAGE("a field of one type loads only the batch of that type");
+  auto r = query("method == \"POST\"");
+  CHECK_GREATER(r.first, 0u);
+  CHECK_EQUAL(r.second, 1u);
+  MESSAGE("the same field again loads nothing");
+  r = query("method == \"GET\"");
+  CHECK_GREATER(r.first, 0u);
+  CHECK_EQUAL(r.second, 0u);
+  MESSAGE("a field of both types loads the remaining batch");
+  r = query("id.resp_p == 443/?");
+  CHECK_GREATER(r.first, 0u);
+  CHECK_EQUAL(r.second, 1u);
+  self->send(p, system::shutdown_atom::value);
+  self->receive(
+    [&](down_msg const& msg) { CHECK(msg.source == p); },
+    error_handler()
+  );
+}
+
 FIXTURE_SCOPE_END()
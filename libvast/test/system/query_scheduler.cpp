@@ -0,0 +1,99 @@
+#include "vast/concept/parseable/to.hpp"
+#include "vast/concept/parseable/vast/expression.hpp"
+
+#include "vast/system/query_scheduler.hpp"
+
+#define SUITE system
+#include "test.hpp"
+
+using namespace vast;
+using namespace vast::system;
+using namespace std::chrono;
+
+namespace {
+
+struct fixture {
+  fixture() {
+    for (auto i = 0; i < 3; ++i)
+      parts.push_back(uuid::random());
+    auto x = to<expression>("x > 0");
+    auto y = to<expression>("y == 42");
+    REQUIRE(x);
+    REQUIRE(y);
+    broad = std::move(*x);
+    narrow = std::move(*y);
+  }
+
+  std::vector<uuid> parts;
+  expression broad;
+  expression narrow;
+  query_scheduler::clock::time_point t0;
+};
+
+} // namespace <anonymous>
+
+FIXTURE_SCOPE(query_scheduler_tests, fixture)
+
+TEST(query scheduler - batching) {
+  query_scheduler s;
+  CHECK(s.empty());
+  CHECK(!s.next());
+  s.enqueue(parts[0], broad, query_scheduler::priority::interactive, t0);
+  s.enqueue(parts[0], narrow, query_scheduler::priority::interactive,
+            t0 + seconds(1));
+  s.enqueue(parts[0], narrow);
+  CHECK_EQUAL(s.size(), 2u);
+  auto job = s.next(t0 + seconds(3));
+  REQUIRE(job);
+  CHECK(job->partition == parts[0]);
+  REQUIRE_EQUAL(job->queries.size(), 2u);
+  for (auto& x : job->queries)
+    if (x.first == broad)
+      CHECK(x.second == seconds(3));
+    else
+      CHECK(x.second == seconds(2));
+  CHECK(s.empty());
+  CHECK(!s.contains(broad));
+}
+
+TEST(query scheduler - fairness) {
+  query_scheduler s;
+  for (auto& part : parts)
+    s.enqueue(part, broad);
+  auto job = s.next();
+  REQUIRE(job);
+  CHECK(job->partition == parts[0]);
+  // A new query gets the next partition, after which both queries alternate.
+  auto other = uuid::random();
+  s.enqueue(other, narrow);
+  s.enqueue(parts[2], narrow);
+  job = s.next();
+  REQUIRE(job);
+  CHECK(job->partition == other);
+  job = s.next();
+  REQUIRE(job);
+  CHECK(job->partition == parts[1]);
+  job = s.next();
+  REQUIRE(job);
+  CHECK(job->partition == parts[2]);
+  CHECK_EQUAL(job->queries.size(), 2u);
+  CHECK(s.empty());
+}
+
+TEST(query scheduler - priorities) {
+  query_scheduler s;
+  s.enqueue(parts[0], broad, query_scheduler::priority::batch);
+  s.enqueue(parts[1], broad, query_scheduler::priority::batch);
+  s.enqueue(parts[2], narrow);
+  CHECK(s.contains(broad));
+  auto job = s.next();
+  REQUIRE(job);
+  CHECK(job->partition == parts[2]);
+  CHECK(!s.contains(narrow));
+  job = s.next();
+  REQUIRE(job);
+  CHECK(job->partition == parts[0]);
+  CHECK_EQUAL(s.size(), 1u);
+}
+
+FIXTURE_SCOPE_END()
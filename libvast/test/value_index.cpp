@@ -353,6 +353,59 @@ TEST(container) {
   CHECK_EQUAL(to_string(*idx2.lookup(in, "bar")), "10110001");
 }
 
+TEST(restricted lookup) {
+  auto make_bitmap = [](std::string const& str) {
+    bitmap result;
+    for (auto c : str)
+      result.append_bit(c == '1');
+    return result;
+  };
+  MESSAGE("string");
+  string_index s{100};
+  for (auto x : {"foo", "bar", "baz", "foo", "foo", "bar", "", "qux", "corge",
+                 "bazz"})
+    REQUIRE(s.push_back(x));
+  auto candidates = make_bitmap("1111000011");
+  CHECK_EQUAL(to_string(*s.lookup(equal, "foo", candidates)), "1001000000");
+  CHECK_EQUAL(to_string(*s.lookup(not_equal, "foo", candidates)),
+              "0110000011");
+  CHECK_EQUAL(to_string(*s.lookup(ni, "z", candidates)), "0010000001");
+  CHECK_EQUAL(to_string(*s.lookup(not_ni, "o", candidates)), "0110000001");
+  CHECK_EQUAL(to_string(*s.lookup(equal, "foo", bitmap{})), "0000000000");
+  CHECK_EQUAL(to_string(*s.lookup(equal, "foo", bitmap{20, true})),
+              "1001100000");
+  CHECK(!s.lookup(match, "foo", candidates));
+  MESSAGE("address");
+  address_index a;
+  for (auto x : {"192.168.0.1", "192.168.0.2", "192.168.0.3", "192.168.0.1",
+                 "192.168.0.1", "192.168.0.2"})
+    REQUIRE(a.push_back(*to<address>(x)));
+  candidates = make_bitmap("001011");
+  auto addr = *to<address>("192.168.0.1");
+  CHECK_EQUAL(to_string(*a.lookup(equal, addr, candidates)), "000010");
+  CHECK_EQUAL(to_string(*a.lookup(not_equal, addr, candidates)), "001001");
+  auto sub = *to<subnet>("192.168.0.0/24");
+  CHECK_EQUAL(to_string(*a.lookup(in, sub, candidates)), "001011");
+  MESSAGE("container");
+  sequence_index c{string_type{}};
+  REQUIRE(c.push_back(vector{"foo", "bar"}));
+  REQUIRE(c.push_back(vector{"qux", "foo", "baz", "corge"}));
+  REQUIRE(c.push_back(vector{"bar"}));
+  REQUIRE(c.push_back(vector{"bar"}));
+  candidates = make_bitmap("0111");
+  CHECK_EQUAL(to_string(*c.lookup(in, "bar", candidates)), "0011");
+  CHECK_EQUAL(to_string(*c.lookup(not_in, "foo", candidates)), "0011");
+  MESSAGE("arithmetic");
+  arithmetic_index<count> n{base::uniform(10, 20)};
+  REQUIRE(n.push_back(count{42}));
+  REQUIRE(n.push_back(nil));
+  REQUIRE(n.push_back(count{42}));
+  REQUIRE(n.push_back(count{7}));
+  candidates = make_bitmap("0111");
+  CHECK_EQUAL(to_string(*n.lookup(equal, count{42}, candidates)), "0010");
+  CHECK_EQUAL(to_string(*n.lookup(equal, nil, candidates)), "0100");
+}
+
 TEST(polymorphic) {
   type t = set_type{integer_type{}}.attributes({{"max_size", "2"}});
   auto idx = value_index::make(t);
@@ -421,3 +474,43 @@ TEST(polymorphic none values) {
   REQUIRE(bm);
   CHECK_EQUAL(to_string(*bm), "00000001100000001110000");
 }
+
+TEST(merge) {
+  MESSAGE("arithmetic");
+  arithmetic_index<count> x{base::uniform(10, 20)};
+  arithmetic_index<count> y{base::uniform(10, 20)};
+  REQUIRE(x.push_back(count{42}, 0));
+  REQUIRE(x.push_back(count{7}, 1));
+  REQUIRE(x.push_back(nil, 2));
+  REQUIRE(y.push_back(count{42}, 5));
+  REQUIRE(y.push_back(count{8}, 6));
+  REQUIRE(x.merge(y));
+  CHECK_EQUAL(x.offset(), 7u);
+  CHECK_EQUAL(to_string(*x.lookup(equal, count{42})), "1000010");
+  CHECK_EQUAL(to_string(*x.lookup(less, count{10})), "0100001");
+  CHECK_EQUAL(to_string(*x.lookup(equal, nil)), "0010000");
+  REQUIRE(x.push_back(count{42}, 9));
+  CHECK_EQUAL(to_string(*x.lookup(equal, count{42})), "1000010001");
+  CHECK(!x.merge(y));
+  MESSAGE("string");
+  string_index s1;
+  string_index s2;
+  REQUIRE(s1.push_back("foo", 0));
+  REQUIRE(s1.push_back("bar", 1));
+  REQUIRE(s2.push_back("foobar", 3));
+  REQUIRE(s2.push_back("foo", 4));
+  REQUIRE(s1.merge(s2));
+  CHECK_EQUAL(to_string(*s1.lookup(equal, "foo")), "10001");
+  CHECK_EQUAL(to_string(*s1.lookup(ni, "bar")), "01010");
+  CHECK(!s1.merge(x));
+  MESSAGE("address");
+  address_index a1;
+  address_index a2;
+  REQUIRE(a1.push_back(*to<address>("10.0.0.1"), 0));
+  REQUIRE(a2.push_back(*to<address>("10.0.0.1"), 2));
+  REQUIRE(a2.push_back(*to<address>("::1"), 3));
+  REQUIRE(a1.merge(a2));
+  CHECK_EQUAL(to_string(*a1.lookup(equal, *to<address>("10.0.0.1"))), "1010");
+  CHECK_EQUAL(to_string(*a1.lookup(in, *to<subnet>("10.0.0.0/8"))), "1010");
+  CHECK_EQUAL(to_string(*a1.lookup(equal, *to<address>("::1"))), "0001");
+}
@@ -2,6 +2,7 @@
 #define VAST_BATCH_HPP
 
 #include <cstdint>
+#include <memory>
 #include <unordered_map>
 #include <vector>
 
@@ -14,20 +15,51 @@
 #include "vast/bitmap.hpp"
 #include "vast/compression.hpp"
 #include "vast/detail/compressedbuf.hpp"
+#include "vast/event.hpp"
 #include "vast/expected.hpp"
 #include "vast/time.hpp"
 #include "vast/type.hpp"
 
 namespace vast {
 
-class event;
-
 /// A compressed sequence of events.
+///
+/// A batch stores the types of its events once in a type table and the
+/// events themselves as a sequence of compressed blocks. The writer aligns
+/// blocks with event boundaries and records the start of each block, so that
+/// a reader can begin decompressing at any block instead of at the very
+/// beginning.
+///
+/// Within a block, events have either a row or a columnar layout. The row
+/// layout serializes one event after another. The columnar layout splits
+/// record events into one column per leaf field and encodes each column
+/// according to its values: timestamps as deltas, strings via a dictionary,
+/// and everything else as a plain sequence of data.
 class batch {
   using buffer_type = std::vector<char>;
   using size_type = uint64_t;
 
 public:
+  /// Marks the beginning of a block that a reader can seek to.
+  struct block {
+    size_type events; ///< The number of events preceding the block.
+    size_type offset; ///< The byte offset of the block in the data buffer.
+
+    template <class Inspector>
+    friend auto inspect(Inspector& f, block& b) {
+      return f(b.events, b.offset);
+    }
+  };
+
+  /// The physical layout of the events within a block.
+  enum class layout : uint8_t {
+    row,
+    columnar
+  };
+
+  /// The number of events per block in the columnar layout.
+  static constexpr size_t columnar_block_events = 4096;
+
   /// A proxy class to write events into the batch.
   class writer;
 
@@ -56,9 +88,31 @@ public:
   /// @returns The number of events in the batch.
   size_type events() const;
 
+  /// Retrieves the timestamp of the earliest event in the batch.
+  /// @returns The smallest event timestamp or `timestamp::max()` if the batch
+  ///          is empty.
+  timestamp earliest() const;
+
+  /// Retrieves the timestamp of the latest event in the batch.
+  /// @returns The largest event timestamp or `timestamp::min()` if the batch
+  ///          is empty.
+  timestamp latest() const;
+
+  /// Retrieves the type table of the batch, which the serialized events
+  /// reference by their position in the table.
+  /// @returns The types of the events in the batch.
+  std::vector<type> const& types() const;
+
+  /// Replaces the type table of the batch. This allows for storing the type
+  /// tables of many batches in one place, in which case the batch needs an
+  /// external type table for reading.
+  /// @param xs The new type table.
+  void types(std::vector<type> xs);
+
   template <class Inspector>
   friend auto inspect(Inspector& f, batch& b) {
-    return f(b.method_, b.first_, b.last_, b.events_, b.ids_, b.data_);
+    return f(b.method_, b.layout_, b.first_, b.last_, b.events_, b.ids_,
+             b.types_, b.blocks_, b.data_);
   }
 
   // TODO: make this a generic concept that leverages the inspection API.
@@ -66,10 +120,13 @@ public:
 
 private:
   compression method_;
+  layout layout_ = layout::row;
   timestamp first_ = timestamp::max();
   timestamp last_ = timestamp::min();
   size_type events_ = 0;
   bitmap ids_;
+  std::vector<type> types_;
+  std::vector<block> blocks_; // The first block at offset 0 has no entry.
   buffer_type data_;
 };
 
@@ -77,7 +134,19 @@ class batch::writer {
 public:
   /// Constructs a writer from a batch.
   /// @param method The compression method to use.
-  writer(compression method = compression::null);
+  /// @param block_size The number of uncompressed bytes after which the
+  ///                   writer begins a new seekable block in the row layout.
+  /// @param l The layout of the events. In the columnar layout, each block
+  ///          holds `columnar_block_events` events.
+  /// @param level The compression level, where LZ4 selects LZ4-HC for
+  ///              levels above 0.
+  /// @param dictionary The compression dictionary or `nullptr` for none. It
+  ///                   must outlive the writer, and reading the batch
+  ///                   requires the same dictionary.
+  writer(compression method = compression::null,
+         size_t block_size = detail::compressedbuf::default_block_size,
+         layout l = layout::row, int level = 0,
+         std::vector<char> const* dictionary = nullptr);
 
   /// Writes an event into the batch.
   /// @param e The event to serialize.
@@ -87,8 +156,14 @@ public:
   batch seal();
 
 private:
+  // Encodes the buffered events as one columnar block.
+  bool write_columns();
+
   batch batch_;
   std::unordered_map<type, uint32_t> type_cache_;
+  std::vector<uint32_t> buffered_types_;
+  std::vector<event> buffered_events_;
+  size_t block_size_;
   caf::vectorbuf vectorbuf_;
   detail::compressedbuf compressedbuf_;
   caf::stream_serializer<detail::compressedbuf&> serializer_;
@@ -100,25 +175,50 @@ public:
   /// @param b The batch to extract objects from.
   reader(batch const& b);
 
+  /// Constructs a reader from a batch with an external type table.
+  /// @param b The batch to extract objects from.
+  /// @param types The type table that *b* has been written with.
+  /// @param dictionary The compression dictionary that *b* has been written
+  ///                   with, or `nullptr` for none.
+  reader(batch const& b, std::vector<type> const& types,
+         std::vector<char> const* dictionary = nullptr);
+
   /// Extracts all events.
   /// @returns The set events in the corresponding batch.
   expected<std::vector<event>> read();
 
-  /// Extracts events according to a bitmap.
+  /// Extracts events according to a bitmap. The reader skips entire blocks
+  /// that do not contain any of the requested events.
   /// @param ids The set of event IDs encoded as bitmap.
   /// @returns The set events according to *ids*.
   expected<std::vector<event>> read(const bitmap& ids);
 
 private:
+  // The decompression pipeline, which we re-create when seeking to a block.
+  struct input {
+    input(char const* data, size_t size, compression method,
+          std::vector<char> const* dictionary);
+    caf::charbuf charbuf;
+    detail::compressedbuf compressedbuf;
+    caf::stream_deserializer<detail::compressedbuf&> deserializer;
+  };
+
+  // Positions the reader at the first event with an ID not less than *id*.
+  expected<void> seek(event_id id);
+
+  // Decodes the next columnar block.
+  expected<void> read_columns();
+
   expected<event> materialize();
 
-  buffer_type const& data_;
-  std::unordered_map<uint32_t, type> type_cache_;
+  batch const& batch_;
+  std::vector<type> const& types_;
+  std::vector<char> const* dictionary_;
   select_range<bitmap_bit_range> id_range_;
   size_type available_;
-  caf::charbuf charbuf_;
-  detail::compressedbuf compressedbuf_;
-  caf::stream_deserializer<detail::compressedbuf&> deserializer_;
+  std::unique_ptr<input> input_;
+  std::vector<event> block_;
+  size_t block_position_ = 0;
 };
 
 } // namespace vast
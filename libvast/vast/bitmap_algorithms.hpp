@@ -437,6 +437,26 @@ bool all(Bitmap const& bm) {
   return true;
 }
 
+/// Combines the leading bits of one bitmap with the trailing bits of another.
+/// Before combining, both bitmaps get padded to a common size.
+/// @param x The bitmap providing the bits *[0,n)*.
+/// @param y The bitmap providing the bits *[n,size)*.
+/// @param n The position where *y* takes over from *x*.
+/// @param size The size of the result.
+/// @param pad The bit value to pad *x* and *y* with.
+/// @returns The spliced bitmap of *x* and *y*.
+/// @pre `x.size() <= size && y.size() <= size && n <= size`
+template <class Bitmap>
+Bitmap splice(Bitmap x, Bitmap y, typename Bitmap::size_type n,
+              typename Bitmap::size_type size, bool pad) {
+  VAST_ASSERT(x.size() <= size && y.size() <= size && n <= size);
+  x.append_bits(pad, size - x.size());
+  y.append_bits(pad, size - y.size());
+  Bitmap head{n, true};
+  head.append_bits(false, size - n);
+  return (x & head) | (y - head);
+}
+
 } // namespace vast
 
 #endif
@@ -66,6 +66,13 @@ public:
     coder_.append(other.coder_);
   }
 
+  /// Merges another bitmap index over the same ID space into this one.
+  /// @param other The bitmap index whose entries follow the ones of this
+  ///              index.
+  void merge(bitmap_index const& other) {
+    coder_.merge(other.coder_);
+  }
+
   /// Retrieves a bitmap of a given value with respect to a given operator.
   /// @param op The relational operator to use for looking up *x*.
   /// @param x The value to find the bitmap for.
@@ -74,6 +81,18 @@ public:
     return coder_.decode(op, transform(binner_type::bin(x)));
   }
 
+  /// Retrieves the bitmap of a given value with respect to a given operator,
+  /// considering only a subset of the entries.
+  /// @param op The relational operator to use for looking up *x*.
+  /// @param x The value to find the bitmap for.
+  /// @param candidates The entries to consider.
+  /// @returns The bitmap for all values *v* in *candidates* where *op(v,x)*
+  ///          is `true`.
+  bitmap_type lookup(relational_operator op, value_type x,
+                     bitmap_type const& candidates) const {
+    return coder_.decode(op, transform(binner_type::bin(x)), candidates);
+  }
+
   /// Retrieves the bitmap index size.
   /// @returns The number of elements/rows contained in the bitmap index.
   size_type size() const {
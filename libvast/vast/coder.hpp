@@ -11,6 +11,7 @@
 #include <caf/meta/save_callback.hpp>
 
 #include "vast/base.hpp"
+#include "vast/bitmap_algorithms.hpp"
 #include "vast/operator.hpp"
 #include "vast/detail/assert.hpp"
 #include "vast/detail/operators.hpp"
@@ -44,11 +45,28 @@ struct coder {
   ///          the coder.
   Bitmap decode(relational_operator op, value_type x) const;
 
+  /// Decodes a value under a relational operator for a subset of the entries.
+  /// Coders that combine several bitmaps per value start from the candidates
+  /// and stop as soon as the remaining bitmaps cannot change the result.
+  /// @param x The value to decode.
+  /// @param op The relation operator under which to decode *x*.
+  /// @param candidates The entries to consider.
+  /// @returns The subset of *candidates* for lookup *? op x*.
+  Bitmap decode(relational_operator op, value_type x,
+                Bitmap const& candidates) const;
+
   /// Appends another coder to this instance.
   /// @param other The coder to append.
   /// @pre `size() + other.size() < Bitmap::max_size`
   void append(coder const& other);
 
+  /// Merges another coder into this instance. In contrast to ::append, both
+  /// coders must represent the same ID space, with all entries of *other*
+  /// located at or after the end of this coder.
+  /// @param other The coder to merge.
+  /// @pre `size() <= other.size() || other.size() == 0`
+  void merge(coder const& other);
+
   /// Retrieves the number entries in the coder, i.e., the number of rows.
   /// @returns The size of the coder measured in number of entries.
   size_type size() const;
@@ -79,10 +97,24 @@ public:
     return result;
   }
 
+  Bitmap decode(relational_operator op, value_type x,
+                Bitmap const& candidates) const {
+    if (size() == 0)
+      return {};
+    return candidates & decode(op, x);
+  }
+
   void append(singleton_coder const& other) {
     bitmap_.append(other.bitmap_);
   }
 
+  void merge(singleton_coder const& other) {
+    if (other.size() == 0)
+      return;
+    VAST_ASSERT(size() <= other.size());
+    bitmap_ = splice(bitmap_, other.bitmap_, size(), other.size(), false);
+  }
+
   size_type size() const {
     return bitmap_.size();
   }
@@ -121,6 +153,10 @@ public:
     append(other, false);
   }
 
+  void merge(vector_coder const& other) {
+    merge(other, false);
+  }
+
   auto size() const {
     return size_;
   }
@@ -148,6 +184,23 @@ protected:
     size_ += other.size_;
   }
 
+  // Bitmaps may be shorter than the coder, in which case *bit* represents the
+  // missing tail.
+  void merge(vector_coder const& other, bool bit) {
+    if (other.size_ == 0)
+      return;
+    if (size_ == 0) {
+      *this = other;
+      return;
+    }
+    VAST_ASSERT(bitmaps_.size() == other.bitmaps_.size());
+    VAST_ASSERT(size_ <= other.size_);
+    for (auto i = 0u; i < bitmaps_.size(); ++i)
+      bitmaps_[i] = splice(bitmaps_[i], other.bitmaps_[i], size_, other.size_,
+                           bit);
+    size_ = other.size_;
+  }
+
   size_type size_;
   std::vector<Bitmap> bitmaps_;
 };
@@ -293,6 +346,10 @@ public:
   void append(range_coder const& other) {
     vector_coder<Bitmap>::append(other, true);
   }
+
+  void merge(range_coder const& other) {
+    vector_coder<Bitmap>::merge(other, true);
+  }
 };
 
 /// Maintains one bitmap per *bit* of the value to encode.
@@ -369,6 +426,26 @@ public:
     }
     return {this->size_, false};
   }
+
+  // Equality lookups intersect one bitmap per bit, which we can stop once no
+  // candidate remains.
+  Bitmap decode(relational_operator op, value_type x,
+                Bitmap const& candidates) const {
+    if (this->size_ == 0)
+      return {};
+    auto seed = candidates & Bitmap{this->size_, true};
+    if (!(op == equal || op == not_equal))
+      return seed & decode(op, x);
+    auto result = seed;
+    for (auto i = 0u; i < this->bitmaps_.size() && !all<0>(result); ++i)
+      if ((x >> i) & 1)
+        result -= this->bitmaps_[i];
+      else
+        result &= this->bitmaps_[i];
+    if (op == not_equal)
+      return seed - result;
+    return result;
+  }
 };
 
 template <class T>
@@ -427,12 +504,29 @@ public:
     return coders_.empty() ? bitmap_type{} : decode(coders_, op, x);
   }
 
+  auto decode(relational_operator op, value_type x,
+              bitmap_type const& candidates) const {
+    return coders_.empty() ? bitmap_type{} : decode(coders_, op, x, candidates);
+  }
+
   void append(multi_level_coder const& other) {
     VAST_ASSERT(coders_.size() == other.coders_.size());
     for (auto i = 0u; i < coders_.size(); ++i)
       coders_[i].append(other.coders_[i]);
   }
 
+  void merge(multi_level_coder const& other) {
+    if (other.coders_.empty())
+      return;
+    if (coders_.empty()) {
+      *this = other;
+      return;
+    }
+    VAST_ASSERT(coders_.size() == other.coders_.size());
+    for (auto i = 0u; i < coders_.size(); ++i)
+      coders_[i].merge(other.coders_[i]);
+  }
+
   size_type size() const {
     return coders_.empty() ? 0 : coders_[0].size();
   }
@@ -536,6 +630,89 @@ private:
     return result;
   }
 
+  // Range-Eval-Opt over a subset of the entries. Instead of combining the
+  // components from the least significant one upwards, we start with the most
+  // significant component and only carry the candidates whose digits equal
+  // those of x so far. Once no candidate remains undecided, the less
+  // significant components cannot change the result, and we skip their
+  // bitmaps.
+  bitmap_type decode(std::vector<range_coder<bitmap_type>> const& coders,
+                     relational_operator op, value_type x,
+                     bitmap_type const& candidates) const {
+    VAST_ASSERT(!(op == in || op == not_in));
+    if (size() == 0)
+      return {};
+    auto seed = candidates & bitmap_type{size(), true};
+    if (x == 0) {
+      if (op == less) // A < min => false
+        return bitmap_type{size(), false};
+      else if (op == greater_equal) // A >= min => true
+        return seed;
+    } else if (op == less || op == greater_equal) {
+      --x;
+    }
+    base_.decompose(x, xs_);
+    auto bitmaps = [&](auto i) -> auto& { return coders[i].storage(); };
+    // Restricts candidates to those with the same digit as x in component i.
+    auto same_digit = [&](auto i, bitmap_type const& xs) {
+      auto d = xs_[i];
+      if (d == 0)
+        return xs & bitmaps(i)[0];
+      if (d == base_[i] - 1)
+        return xs - bitmaps(i)[d - 1];
+      return (xs & bitmaps(i)[d]) - bitmaps(i)[d - 1];
+    };
+    switch (op) {
+      default:
+        return bitmap_type{size(), false};
+      case equal:
+      case not_equal: {
+        auto result = seed;
+        for (auto i = base_.size(); i > 0 && !all<0>(result); --i)
+          result = same_digit(i - 1, result);
+        return op == equal ? result : seed - result;
+      }
+      case less:
+      case less_equal:
+      case greater:
+      case greater_equal: {
+        // A candidate satisfies A <= x if it has a smaller digit in the first
+        // component where it differs from x, or no differing digit at all.
+        auto result = bitmap_type{size(), false};
+        auto undecided = seed;
+        for (auto i = base_.size() - 1; i > 0; --i) {
+          if (xs_[i] > 0)
+            result |= undecided & bitmaps(i)[xs_[i] - 1];
+          undecided = same_digit(i, undecided);
+          if (all<0>(undecided))
+            break;
+        }
+        if (!all<0>(undecided)) {
+          if (xs_[0] < base_[0] - 1)
+            result |= undecided & bitmaps(0)[xs_[0]];
+          else
+            result |= undecided;
+        }
+        if (op == greater || op == greater_equal)
+          return seed - result;
+        return result;
+      }
+    }
+  }
+
+  // Other coders evaluate the full bitmaps and restrict the result.
+  template <class C>
+  auto decode(std::vector<C> const& coders, relational_operator op,
+              value_type x, bitmap_type const& candidates) const
+  -> std::enable_if_t<
+    is_equality_coder<C>{} || is_bitslice_coder<C>{},
+    bitmap_type
+  > {
+    if (size() == 0)
+      return {};
+    return candidates & decode(coders, op, x);
+  }
+
   // If we don't have a range_coder, we only support simple equality queries at
   // this point.
   template <class C>
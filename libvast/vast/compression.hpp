@@ -20,6 +20,14 @@ enum class compression : int8_t {
 /// The LZ4 compression algorithm.
 namespace lz4 {
 
+/// The highest compression level, which selects LZ4-HC with the most
+/// exhaustive match search.
+constexpr int max_level = 16;
+
+/// The largest dictionary that LZ4 can make use of, because it only refers
+/// back to the last 64 KiB of input.
+constexpr size_t max_dictionary_size = 64 << 10;
+
 /// Returns an upper bound for the compressed output.
 /// @param size The size of the uncompressed input.
 size_t compress_bound(size_t size);
@@ -27,9 +35,25 @@ size_t compress_bound(size_t size);
 /// Compresses a contiguous byte sequence.
 size_t compress(char const* in, size_t in_size, char* out, size_t out_size);
 
+/// Compresses a contiguous byte sequence at a given level, optionally with a
+/// dictionary of data similar to the input.
+/// @param level 0 selects the fast LZ4 mode, and 1 to `max_level` select
+///              LZ4-HC, trading compression speed for ratio.
+/// @param dict The dictionary or `nullptr` for none.
+/// @param dict_size The size of *dict*.
+size_t compress(char const* in, size_t in_size, char* out, size_t out_size,
+                int level, char const* dict, size_t dict_size);
+
 /// Uncompresses a contiguous byte sequence.
 size_t uncompress(char const* in, size_t in_size, char* out, size_t out_size);
 
+/// Uncompresses a contiguous byte sequence that has been compressed with a
+/// dictionary.
+/// @param dict The dictionary used for compression.
+/// @param dict_size The size of *dict*.
+size_t uncompress(char const* in, size_t in_size, char* out, size_t out_size,
+                  char const* dict, size_t dict_size);
+
 } // namespace lz4
 
 #ifdef VAST_HAVE_SNAPPY
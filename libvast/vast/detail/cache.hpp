@@ -108,7 +108,9 @@ public:
   }
 };
 
-/// A direct-mapped cache with fixed capacity.
+/// A direct-mapped cache with fixed capacity. By default, the capacity bounds
+/// the number of elements. With a custom weigh function, it bounds the sum of
+/// the weights of all elements instead, e.g., their size in bytes.
 template <
   typename Key,
   typename Value,
@@ -123,11 +125,19 @@ public:
   /// The callback to invoke for evicted elements.
   using evict_callback = std::function<void(key_type const&, mapped_type&)>;
 
+  /// The function that computes the weight of an element.
+  using weigh_function = std::function<size_t(mapped_type const&)>;
+
+  /// An entry of the cache along with its position in the eviction policy
+  /// and its weight at the time it was last weighed.
+  struct slot {
+    mapped_type value;
+    typename policy::iterator position;
+    size_t weight;
+  };
+
   /// The cache cache_map holding the hot entries.
-  using cache_map = std::unordered_map<
-    key_type,
-    std::pair<mapped_type, typename policy::iterator>
-  >;
+  using cache_map = std::unordered_map<key_type, slot>;
 
   class const_iterator :
     public iterator_facade<
@@ -153,7 +163,7 @@ public:
 
     std::pair<key_type const&, mapped_type const&> dereference() const {
       auto i = cache_->cache_.find(*i_);
-      return std::make_pair(i->first, i->second.first);
+      return std::make_pair(i->first, i->second.value);
     }
 
     cache const* cache_;
@@ -161,7 +171,8 @@ public:
   };
 
   /// Constructs an LRU cache with a maximum number of elements.
-  /// @param capacity The maximum number of elements in the cache.
+  /// @param capacity The maximum number of elements (or total weight) in the
+  ///                 cache.
   /// @pre `capacity > 0`
   cache(size_t capacity = 100) : capacity_{capacity} {
     VAST_ASSERT(capacity_ > 0);
@@ -173,13 +184,23 @@ public:
     on_evict_ = fun;
   }
 
+  /// Sets a function that computes the weight of an element. If the weight
+  /// of an element changes while it resides in the cache, the cache must
+  /// learn about it through `reweigh`.
+  /// @param fun The function to invoke with an element to weigh.
+  /// @pre `empty()`
+  void weigh(weigh_function fun) {
+    VAST_ASSERT(empty());
+    weigh_ = fun;
+  }
+
   /// Accesses the value for a given key. If key does not exists,
   /// the function default-constructs a value of `mapped_type`.
   /// @param key The key to lookup.
   /// @returns The value corresponding to *key*.
   mapped_type& operator[](key_type const& key) {
     auto i = find(key);
-    return i == cache_.end() ? *insert(key, {}).first : i->second.first;
+    return i == cache_.end() ? *insert(key, {}).first : i->second.value;
   }
 
   /// Retrieves a value for a given key. If the key exists in the cache, the
@@ -189,7 +210,7 @@ public:
   /// @returns An iterator for *key* or the end iterator if *key* is not hot.
   mapped_type* lookup(key_type const& key) {
     auto i = find(key);
-    return i == cache_.end() ? nullptr : &i->second.first;
+    return i == cache_.end() ? nullptr : &i->second.value;
   }
 
   /// Checks whether a given key has a cache entry *without* involving the
@@ -200,7 +221,8 @@ public:
     return cache_.find(key) != cache_.end();
   }
 
-  /// Inserts a fresh entry in the cache.
+  /// Inserts a fresh entry in the cache. If an entry weighs more than the
+  /// capacity, the cache evicts all other elements and holds this one alone.
   /// @param key The key mapping to *value*.
   /// @param value The value for *key*.
   /// @returns An pair of an iterator and boolean flag. If the flag is `true`,
@@ -209,12 +231,14 @@ public:
   std::pair<mapped_type*, bool> insert(key_type key, mapped_type value) {
     auto i = find(key);
     if (i != cache_.end())
-      return {&i->second.first, false};
-    if (cache_.size() == capacity_)
+      return {&i->second.value, false};
+    auto w = weight_of(value);
+    while (!cache_.empty() && weight_ + w > capacity_)
       evict();
+    weight_ += w;
     auto k = policy_.insert(key);
-    auto j = cache_.emplace(std::move(key), make_pair(std::move(value), k));
-    return {&j.first->second.first, true};
+    auto j = cache_.emplace(std::move(key), slot{std::move(value), k, w});
+    return {&j.first->second.value, true};
   }
 
   /// Removes an entry for a given key without invoking the eviction callback.
@@ -224,12 +248,32 @@ public:
     auto i = cache_.find(key);
     if (i == cache_.end())
       return 0;
+    weight_ -= i->second.weight;
     policy_.erase(key);
     cache_.erase(i);
     return 1;
   }
 
-  /// Retrieves the maximum number elements the cache can hold.
+  /// Weighs an element again after its weight has changed and evicts other
+  /// elements if the cache then exceeds its capacity, up to the element
+  /// itself. This does not count as an access of the element.
+  /// @param key The key of the element to weigh.
+  /// @returns `true` iff *key* exists in the cache.
+  bool reweigh(key_type const& key) {
+    auto i = cache_.find(key);
+    if (i == cache_.end())
+      return false;
+    auto w = weight_of(i->second.value);
+    weight_ = weight_ - i->second.weight + w;
+    i->second.weight = w;
+    // Like insert, we let an element that alone exceeds the capacity stay.
+    while (weight_ > capacity_ && !(*policy_.begin() == key))
+      evict();
+    return true;
+  }
+
+  /// Retrieves the maximum number elements (or total weight) the cache can
+  /// hold.
   /// @returns The cache's capacity.
   size_t capacity() const {
     return capacity_;
@@ -241,8 +285,7 @@ public:
   /// @pre `c > 0`
   void capacity(size_t c) {
     VAST_ASSERT(c > 0);
-    auto victims = std::min(cache_.size(), capacity_ - c);
-    for (size_t i = 0; i < victims; ++i)
+    while (!cache_.empty() && weight_ > c)
       evict();
     capacity_ = c;
   }
@@ -253,6 +296,13 @@ public:
     return cache_.size();
   }
 
+  /// Retrieves the total weight of all elements in the cache, which equals
+  /// the number of elements unless a custom weigh function is set.
+  /// @returns The sum of the weights of all cached elements.
+  size_t weight() const {
+    return weight_;
+  }
+
   /// Checks whether the cache is empty.
   /// @returns `true` iff the cache holds no elements.
   bool empty() const {
@@ -263,6 +313,7 @@ public:
   void clear() {
     policy_ = {};
     cache_.clear();
+    weight_ = 0;
   }
 
   const_iterator begin() const {
@@ -277,21 +328,28 @@ private:
   typename cache_map::iterator find(key_type const& key) {
     auto i = cache_.find(key);
     if (i != cache_.end())
-      policy_.access(i->second.second);
+      policy_.access(i->second.position);
     return i;
   }
 
+  size_t weight_of(mapped_type const& x) const {
+    return weigh_ ? weigh_(x) : 1;
+  }
+
   void evict() {
     auto i = cache_.find(policy_.evict());
     VAST_ASSERT(i != cache_.end());
+    weight_ -= i->second.weight;
     if (on_evict_)
-      on_evict_(i->first, i->second.first);
+      on_evict_(i->first, i->second.value);
     cache_.erase(i);
   }
 
   policy policy_;
   size_t capacity_;
+  size_t weight_ = 0;
   evict_callback on_evict_;
+  weigh_function weigh_;
   cache_map cache_;
 };
 
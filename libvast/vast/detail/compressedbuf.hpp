@@ -26,6 +26,14 @@ namespace detail {
 ///     +-------------------+-----------------+--------------------...---+
 ///
 /// Both sizes are written in *variable byte* encoding to save space.
+///
+/// Since blocks are independent of each other, the streambuffer can compress
+/// several of them in parallel. In this mode, it collects full blocks until
+/// it has one per thread, compresses them concurrently, and then writes them
+/// in order. The output is identical to sequential mode. An explicit
+/// `pubsync()` still writes all pending data. All streambuffers of a process
+/// share a budget of one helper thread per core beyond the first, and fall
+/// back to compressing on the calling thread when it is exhausted.
 class compressedbuf : public std::streambuf {
 public:
   /// The default buffer size in bytes.
@@ -35,16 +43,35 @@ public:
   /// @param sb The underlying streambuffer to read from or write to.
   /// @param method The compression method to use for each block.
   /// @param block_size The size of the internal buffer for uncompressed data.
+  /// @param level The compression level, which only LZ4 takes into account.
+  /// @param dictionary Data similar to the blocks that LZ4 uses to prime
+  ///                   every block, or `nullptr` for none. Reading requires
+  ///                   the same dictionary as writing.
+  /// @param threads The number of blocks to compress in parallel when
+  ///                writing, where 0 means one per hardware thread. Parallel
+  ///                compression pays off with block sizes well above the
+  ///                default, and only if the caller does not already run
+  ///                on a busy thread pool.
   /// @pre `block_size > 1`
   compressedbuf(std::streambuf& sb,
                 compression method = compression::null,
-                size_t block_size = default_block_size);
+                size_t block_size = default_block_size,
+                int level = 0,
+                std::vector<char> const* dictionary = nullptr,
+                size_t threads = 1);
+
+  /// Retrieves the number of uncompressed bytes in the put area that the next
+  /// call to `pubsync()` compresses into a block.
+  /// @returns The number of pending bytes.
+  size_t pending() const;
 
 protected:
   // -- buffer management and positioning ------------------------------------
 
-  /// If a put area exists, calls `overflow()` to write all pending output to
-  /// the underlying streambuffer, then clears its internal buffers.
+  /// If a non-empty put area exists, compresses all pending output into a
+  /// block and writes it, along with all blocks that await parallel
+  /// compression, to the underlying streambuffer, then clears its internal
+  /// buffers.
   /// @returns -1 on failure or the number of characters written to the
   ///          underlying streambuffer otherwise.
   int sync() override;
@@ -62,14 +89,31 @@ protected:
   std::streamsize xsgetn(char_type* s, std::streamsize n) override;
 
 private:
-  void compress();
-  void uncompress();
+  struct block {
+    std::vector<char> compressed;
+    std::vector<char> uncompressed;
+  };
+
+  // Hands the put area over to the next block.
+  bool next_block();
+
+  // Compresses all full blocks and writes them to the underlying streambuffer.
+  int write_blocks();
+
+  void compress(block& b) const;
+  void uncompress(block& b) const;
 
   std::streambuf& streambuf_;
   compression method_;
   size_t block_size_;
-  std::vector<char> compressed_;
-  std::vector<char> uncompressed_;
+  int level_;
+  std::vector<char> const* dictionary_;
+  size_t threads_;
+  // When writing, the first *full_* blocks await compression and the next one
+  // constitutes the put area. When reading, the first block holds the get
+  // area.
+  std::vector<block> blocks_;
+  size_t full_ = 0;
 };
 
 } // namespace detail
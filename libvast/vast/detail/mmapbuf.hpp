@@ -28,6 +28,16 @@ public:
   /// Returns the size of the mapped memory region.
   size_t size() const;
 
+  /// Returns a pointer to the beginning of the mapped memory region.
+  /// @returns The mapped memory or `nullptr` if mapping failed.
+  char_type const* data() const;
+
+  /// Reads a part of the mapped region into memory ahead of its use. The
+  /// function blocks until all pages in the range are resident.
+  /// @param offset The beginning of the range.
+  /// @param length The number of bytes in the range.
+  void prefetch(size_t offset, size_t length) const;
+
 protected:
   std::streamsize showmanyc() override;
 
@@ -117,6 +117,11 @@ bool read(int fd, void* buffer, size_t bytes, size_t* got = nullptr);
 /// @returns `true` on successful reading.
 bool write(int fd, void const* buffer, size_t bytes, size_t* put = nullptr);
 
+/// Wraps `fsync(2)`.
+/// @param fd The file descriptor to synchronize with stable storage.
+/// @returns `true` on successful synchronization.
+bool fsync(int fd);
+
 /// Wraps `seek(2)`.
 /// @param fd A seekable file descriptor.
 /// @param bytes The number of bytes that should be skipped.
@@ -1,8 +1,10 @@
 #ifndef VAST_DETAIL_INTERVAL_MAP_HPP
 #define VAST_DETAIL_INTERVAL_MAP_HPP
 
-#include <map>
+#include <algorithm>
 #include <tuple>
+#include <utility>
+#include <vector>
 
 #include "vast/detail/assert.hpp"
 #include "vast/detail/iterator.hpp"
@@ -11,15 +13,29 @@ namespace vast {
 namespace detail {
 
 /// An associative data structure that maps half-open, *disjoint* intervals to
-/// values.
+/// values. The intervals reside contiguously in a vector sorted by their left
+/// endpoint, which makes point and range lookups a binary search over a
+/// cache-friendly layout. Because the intervals are disjoint, the right
+/// endpoints are sorted as well.
 template <typename Point, typename Value>
 class range_map {
   static_assert(std::is_arithmetic<Point>::value,
                 "Point must be an arithmetic type");
 
-  using map_type = std::map<Point, std::pair<Point, Value>>;
-  using map_iterator = typename map_type::iterator;
-  using map_const_iterator = typename map_type::const_iterator;
+  struct slot {
+    Point left;
+    Point right;
+    Value value;
+
+    template <class Inspector>
+    friend auto inspect(Inspector& f, slot& x) {
+      return f(x.left, x.right, x.value);
+    }
+  };
+
+  using vector_type = std::vector<slot>;
+  using slot_iterator = typename vector_type::iterator;
+  using slot_const_iterator = typename vector_type::const_iterator;
 
 public:
   struct entry {
@@ -31,14 +47,14 @@ public:
   class const_iterator
     : public iterator_adaptor<
         const_iterator,
-        map_const_iterator,
+        slot_const_iterator,
         std::tuple<Point, Point, Value>,
         std::bidirectional_iterator_tag,
         entry
       > {
     using super = iterator_adaptor<
       const_iterator,
-      map_const_iterator,
+      slot_const_iterator,
       std::tuple<Point, Point, Value>,
       std::bidirectional_iterator_tag,
       entry
@@ -51,17 +67,16 @@ public:
     friend iterator_access;
 
     entry dereference() const {
-      return {this->base()->first, this->base()->second.first,
-                      this->base()->second.second};
+      return {this->base()->left, this->base()->right, this->base()->value};
     }
   };
 
   const_iterator begin() const {
-    return const_iterator{map_.begin()};
+    return const_iterator{slots_.begin()};
   }
 
   const_iterator end() const {
-    return const_iterator{map_.end()};
+    return const_iterator{slots_.end()};
   }
 
   /// Associates a value with a right-open range.
@@ -71,9 +86,12 @@ public:
   /// @returns `true` on success.
   bool insert(Point l, Point r, Value v) {
     VAST_ASSERT(l < r);
-    auto lb = map_.lower_bound(l);
-    if (locate(l, lb) == map_.end() && (lb == map_.end() || r <= left(lb)))
-      return map_.emplace(l, std::make_pair(r, std::move(v))).second;
+    auto lb = first_not_before(l);
+    if (locate(l, lb) == slots_.end()
+        && (lb == slots_.end() || r <= lb->left)) {
+      slots_.insert(lb, slot{l, r, std::move(v)});
+      return true;
+    }
     return false;
   }
 
@@ -87,50 +105,45 @@ public:
   /// @returns `true` on success.
   bool inject(Point l, Point r, Value v) {
     VAST_ASSERT(l < r);
-    if (map_.empty())
-      return emplace(l, r, std::move(v));
-    auto i = map_.lower_bound(l);
+    if (slots_.empty()) {
+      slots_.push_back(slot{l, r, std::move(v)});
+      return true;
+    }
+    auto i = first_not_before(l);
     // Adjust position (i = this, p = prev, n = next).
-    if (i == map_.end() || (i != map_.begin() && l != left(i)))
+    if (i == slots_.end() || (i != slots_.begin() && l != i->left))
       --i;
-    auto n = i;
-    ++n;
-    auto p = i;
-    if (i != map_.begin())
-      --p;
-    else
-      p = map_.end();
+    auto n = i + 1;
+    auto p = i != slots_.begin() ? i - 1 : slots_.end();
     // Assess the fit.
-    auto fits_left = r <= left(i) && (p == map_.end() || l >= right(p));
-    auto fits_right = l >= right(i) && (n == map_.end() || r <= left(n));
+    auto fits_left = r <= i->left && (p == slots_.end() || l >= p->right);
+    auto fits_right = l >= i->right && (n == slots_.end() || r <= n->left);
     if (fits_left) {
-      auto right_merge = r == left(i) && v == value(i);
-      auto left_merge = p != map_.end() && l == right(p) && v == value(p);
+      auto right_merge = r == i->left && v == i->value;
+      auto left_merge = p != slots_.end() && l == p->right && v == p->value;
       if (left_merge && right_merge) {
-        right(p) = right(i);
-        map_.erase(i);
+        p->right = i->right;
+        slots_.erase(i);
       } else if (left_merge) {
-        right(p) = r;
+        p->right = r;
       } else if (right_merge) {
-        emplace(l, right(i), std::move(v));
-        map_.erase(i);
+        i->left = l;
       } else {
-        emplace(l, r, std::move(v));
+        slots_.insert(i, slot{l, r, std::move(v)});
       }
       return true;
     } else if (fits_right) {
-      auto right_merge = n != map_.end() && r == left(n) && v == value(n);
-      auto left_merge = l == right(i) && v == value(i);
+      auto right_merge = n != slots_.end() && r == n->left && v == n->value;
+      auto left_merge = l == i->right && v == i->value;
       if (left_merge && right_merge) {
-        right(i) = right(n);
-        map_.erase(n);
+        i->right = n->right;
+        slots_.erase(n);
       } else if (left_merge) {
-        right(i) = r;
+        i->right = r;
       } else if (right_merge) {
-        emplace(l, right(n), std::move(v));
-        map_.erase(n);
+        n->left = l;
       } else {
-        emplace(l, r, std::move(v));
+        slots_.insert(n, slot{l, r, std::move(v)});
       }
       return true;
     }
@@ -143,10 +156,10 @@ public:
   ///          has been successfully removed, and `false` if *p* does not map
   ///          to an existing value.
   bool erase(Point p) {
-    auto i = locate(p, map_.lower_bound(p));
-    if (i == map_.end())
+    auto i = locate(p, first_not_before(p));
+    if (i == slots_.end())
       return false;
-    map_.erase(i);
+    slots_.erase(i);
     return true;
   }
 
@@ -155,35 +168,30 @@ public:
   /// @param l The left endpoint of the interval.
   /// @param r The right endpoint of the interval.
   void erase(Point l, Point r) {
-    if (l > r)
+    if (l >= r)
       return;
-    auto next_left = l;
-    for (;;) {
-      auto lb = map_.lower_bound(next_left);
-      auto i = locate(next_left, lb);
-      if (i == map_.end())
-        i = lb;
-      if (i == map_.end() || left(i) >= r)
-        break;
-      next_left = right(i);
-      if (l <= left(i) && r >= right(i)) { // [l,r) overlaps [i) in its entirety
-        map_.erase(i);
-      } else if (left(i) <= l
-                 && right(i) >= r) { // [i) overlaps [l,r) in its entirety
-        Point orig_r = right(i);
-        right(i) = l;
-        inject(r, orig_r, value(i));
-        break;
-      } else if (l <= left(i) && r > left(i)) { // [l,r) overlaps [i) partially
-                                                // and starts before
-        map_.emplace(r, std::make_pair(right(i), std::move(value(i))));
-        map_.erase(i);
-        break;
-      } else if (l < right(i) && r >= right(i)) { // [l,r) overlaps [i)
-                                                  // partially and starts after
-        right(i) = l;
+    auto i = first_ending_after(l);
+    if (i == slots_.end() || i->left >= r)
+      return;
+    if (i->left < l) {
+      if (i->right > r) {
+        // [i) overlaps [l,r) in its entirety: split it in two.
+        auto tail = slot{r, i->right, i->value};
+        i->right = l;
+        slots_.insert(i + 1, std::move(tail));
+        return;
       }
+      // [l,r) overlaps [i) partially and starts after.
+      i->right = l;
+      ++i;
     }
+    // Remove all ranges that [l,r) overlaps in their entirety.
+    auto j = std::partition_point(i, slots_.end(),
+                                  [&](auto& x) { return x.right <= r; });
+    i = slots_.erase(i, j);
+    // [l,r) overlaps [i) partially and starts before.
+    if (i != slots_.end() && i->left < r)
+      i->left = r;
   }
 
   /// Retrieves the value for a given point.
@@ -191,8 +199,8 @@ public:
   /// @returns A pointer to the value associated with the half-open interval
   ///          *[a,b)* if *a <= p < b* and `nullptr` otherwise.
   Value const* lookup(Point const& p) const {
-    auto i = locate(p, map_.lower_bound(p));
-    return i != map_.end() ? &i->second.second : nullptr;
+    auto i = locate(p, first_not_before(p));
+    return i != slots_.end() ? &i->value : nullptr;
   }
 
   /// Retrieves value and interval for a given point.
@@ -205,72 +213,105 @@ public:
   std::tuple<Point, Point, Value const*> find(Point const& p) const {
     // GCC 4.9 still has an explicit tuple ctor.
     using tuple_type = std::tuple<Point, Point, Value const*>;
-    auto i = locate(p, map_.lower_bound(p));
-    if (i == map_.end())
+    auto i = locate(p, first_not_before(p));
+    if (i == slots_.end())
       return tuple_type{0, 0, nullptr};
     else
-      return tuple_type{left(i), right(i), &i->second.second};
+      return tuple_type{i->left, i->right, &i->value};
+  }
+
+  /// Finds the first range that does not lie entirely before a point, i.e.,
+  /// the range containing the point or the first range after it.
+  /// @param p The point to search for.
+  /// @returns An iterator to the first range *[a,b)* with *p < b*.
+  const_iterator lower_bound(Point const& p) const {
+    return const_iterator{first_ending_after(p)};
+  }
+
+  /// Finds the first range that begins after a point.
+  /// @param p The point to search for.
+  /// @returns An iterator to the first range *[a,b)* with *p < a*.
+  const_iterator upper_bound(Point const& p) const {
+    auto pred = [&](auto& x) { return x.left <= p; };
+    return const_iterator{
+      std::partition_point(slots_.begin(), slots_.end(), pred)};
+  }
+
+  /// Finds all ranges that overlap with a given interval.
+  /// @param l The left endpoint of the interval.
+  /// @param r The right endpoint of the interval.
+  /// @returns The iterator range of all entries that overlap with *[l,r)*.
+  std::pair<const_iterator, const_iterator>
+  find_overlapping(Point const& l, Point const& r) const {
+    auto first = first_ending_after(l);
+    if (l >= r)
+      return {const_iterator{first}, const_iterator{first}};
+    auto pred = [&](auto& x) { return x.left < r; };
+    auto last = std::partition_point(first, slots_.end(), pred);
+    return {const_iterator{first}, const_iterator{last}};
   }
 
   /// Retrieves the size of the range map.
   /// @returns The number of entries in the map.
   size_t size() const {
-    return map_.size();
+    return slots_.size();
   }
 
   /// Checks whether the range map is empty.
   /// @returns `true` iff the map is empty.
   bool empty() const {
-    return map_.empty();
+    return slots_.empty();
   }
 
   /// Clears the range map.
   void clear() {
-    return map_.clear();
+    return slots_.clear();
   }
 
   template <class Inspector>
   friend auto inspect(Inspector& f, range_map& m) {
-    return f(m.map_);
+    return f(m.slots_);
   }
 
 private:
-  template <typename Iterator>
-  static auto& left(Iterator i) {
-    return i->first;
+  // Finds the first range that begins at or after a point.
+  slot_const_iterator first_not_before(Point const& p) const {
+    auto pred = [&](auto& x) { return x.left < p; };
+    return std::partition_point(slots_.begin(), slots_.end(), pred);
   }
 
-  template <typename Iterator>
-  static auto& right(Iterator i) {
-    return i->second.first;
+  slot_iterator first_not_before(Point const& p) {
+    auto pred = [&](auto& x) { return x.left < p; };
+    return std::partition_point(slots_.begin(), slots_.end(), pred);
   }
 
-  template <typename Iterator>
-  static auto& value(Iterator i) {
-    return i->second.second;
+  // Finds the first range that ends after a point.
+  slot_const_iterator first_ending_after(Point const& p) const {
+    auto pred = [&](auto& x) { return x.right <= p; };
+    return std::partition_point(slots_.begin(), slots_.end(), pred);
   }
 
-  // Finds the interval of a point.
-  map_const_iterator locate(Point const& p, map_const_iterator lb) const {
-    if ((lb != map_.end() && p == left(lb))
-        || (lb != map_.begin() && p < right(--lb)))
-      return lb;
-    return map_.end();
+  slot_iterator first_ending_after(Point const& p) {
+    auto pred = [&](auto& x) { return x.right <= p; };
+    return std::partition_point(slots_.begin(), slots_.end(), pred);
   }
 
-  map_iterator locate(Point const& p, map_iterator lb) {
-    if ((lb != map_.end() && p == left(lb))
-        || (lb != map_.begin() && p < right(--lb)))
+  // Finds the interval of a point.
+  slot_const_iterator locate(Point const& p, slot_const_iterator lb) const {
+    if ((lb != slots_.end() && p == lb->left)
+        || (lb != slots_.begin() && p < (--lb)->right))
       return lb;
-    return map_.end();
+    return slots_.end();
   }
 
-  bool emplace(Point l, Point r, Value v) {
-    auto pair = std::make_pair(std::move(r), std::move(v));
-    return map_.emplace(std::move(l), std::move(pair)).second;
+  slot_iterator locate(Point const& p, slot_iterator lb) {
+    if ((lb != slots_.end() && p == lb->left)
+        || (lb != slots_.begin() && p < (--lb)->right))
+      return lb;
+    return slots_.end();
   }
 
-  map_type map_;
+  vector_type slots_;
 };
 
 } // namespace detail
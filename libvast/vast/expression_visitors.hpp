@@ -1,6 +1,7 @@
 #ifndef VAST_EXPRESSION_VISITORS_HPP
 #define VAST_EXPRESSION_VISITORS_HPP
 
+#include <utility>
 #include <vector>
 
 #include "vast/expression.hpp"
@@ -84,6 +85,21 @@ struct time_restrictor {
   timestamp last_;
 };
 
+/// Computes a conservative time interval *[from, to]* that contains the
+/// timestamps of all events that can satisfy an expression. The interval
+/// spans all of time unless time extractors constrain it.
+///
+/// @pre Requires prior expression normalization.
+struct time_bounder {
+  using interval = std::pair<timestamp, timestamp>;
+
+  interval operator()(none) const;
+  interval operator()(conjunction const& con) const;
+  interval operator()(disjunction const& dis) const;
+  interval operator()(negation const& n) const;
+  interval operator()(predicate const& p) const;
+};
+
 /// Transforms all ::key_extractor into ::data_extractor instances according to
 /// a given type.
 struct key_resolver {
@@ -216,6 +216,10 @@ public:
   /// @returns `true` on success.
   bool write(void const* source, size_t size, size_t* put = nullptr);
 
+  /// Flushes all written data of the file to stable storage.
+  /// @returns `true` on success.
+  bool sync();
+
   /// Seeks the file forward.
   /// @param bytes The number of bytes to seek forward relative to the current
   ///              position.
@@ -301,6 +305,12 @@ void create_symlink(path const& target, path const& link);
 /// @returns `true` if *p* has been successfully deleted.
 bool rm(path const& p);
 
+/// Moves a file or directory to a new location.
+/// @param from The path to move.
+/// @param to The new location of *from*.
+/// @returns `true` if *from* has been successfully moved to *to*.
+bool mv(path const& from, path const& to);
+
 /// If the path does not exist, create it as directory.
 /// @param p The path to a directory to create.
 /// @returns `true` on success or if *p* exists already.
@@ -0,0 +1,173 @@
+#ifndef VAST_META_INDEX_HPP
+#define VAST_META_INDEX_HPP
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "vast/data.hpp"
+#include "vast/expression.hpp"
+#include "vast/offset.hpp"
+#include "vast/operator.hpp"
+#include "vast/optional.hpp"
+#include "vast/time.hpp"
+#include "vast/type.hpp"
+#include "vast/uuid.hpp"
+#include "vast/variant.hpp"
+
+namespace vast {
+
+class event;
+
+/// Summarizes the values of an ordered type by their minimum and maximum.
+struct minmax_synopsis {
+  data min;
+  data max;
+
+  void add(data const& x);
+
+  /// Checks whether a value in the range may satisfy a predicate.
+  bool lookup(relational_operator op, data const& x) const;
+
+  template <class Inspector>
+  friend auto inspect(Inspector& f, minmax_synopsis& s) {
+    return f(s.min, s.max);
+  }
+};
+
+/// Summarizes strings or addresses in a scalable Bloom filter, which starts
+/// out small and grows with the number of distinct values. The synopsis
+/// consists of a sequence of stages, each a Bloom filter whose number of bits
+/// is a power of two, which allows for folding it in half. New values go
+/// into the last stage. Once that stage is full, the next value opens a stage
+/// with twice the capacity and half the false positive rate, so that the
+/// overall false positive rate stays below 2%.
+struct bloom_synopsis {
+  /// The number of distinct values that the first stage accommodates.
+  static constexpr size_t default_values = 1 << 10;
+
+  /// A single Bloom filter with a false positive rate of `2^-hashes`.
+  struct stage {
+    std::vector<uint64_t> bits;
+    uint32_t hashes;
+    uint64_t values; ///< The number of distinct values in this stage.
+
+    template <class Inspector>
+    friend auto inspect(Inspector& f, stage& s) {
+      return f(s.bits, s.hashes, s.values);
+    }
+  };
+
+  void add(data const& x);
+
+  /// Checks whether a value in the filter may satisfy a predicate.
+  bool lookup(relational_operator op, data const& x) const;
+
+  /// Folds each stage down to the smallest size that keeps its false
+  /// positive rate for the values it holds.
+  void shrink();
+
+  /// Computes the number of bits of all stages.
+  /// @returns The size of the synopsis in bits.
+  uint64_t size() const;
+
+  std::vector<stage> stages;
+
+  template <class Inspector>
+  friend auto inspect(Inspector& f, bloom_synopsis& s) {
+    return f(s.stages);
+  }
+};
+
+/// Summarizes ports by the exact set of port numbers and transport protocols.
+struct port_synopsis {
+  std::vector<uint64_t> numbers;
+  uint8_t protocols = 0;
+
+  void add(data const& x);
+
+  /// Checks whether a port in the set may satisfy a predicate.
+  bool lookup(relational_operator op, data const& x) const;
+
+  template <class Inspector>
+  friend auto inspect(Inspector& f, port_synopsis& s) {
+    return f(s.numbers, s.protocols);
+  }
+};
+
+/// A compact summary of all values of a single field.
+using synopsis = variant<minmax_synopsis, bloom_synopsis, port_synopsis>;
+
+/// The synopses of all fields of a single event type.
+struct type_synopsis {
+  vast::type type;
+  std::map<offset, synopsis> fields;
+
+  template <class Inspector>
+  friend auto inspect(Inspector& f, type_synopsis& s) {
+    return f(s.type, s.fields);
+  }
+};
+
+/// The synopses of all events in a partition.
+struct partition_synopsis {
+  timestamp from = timestamp::max();
+  timestamp to = timestamp::min();
+  std::unordered_map<std::string, type_synopsis> types;
+
+  template <class Inspector>
+  friend auto inspect(Inspector& f, partition_synopsis& s) {
+    return f(s.from, s.to, s.types);
+  }
+};
+
+/// Keeps compact per-partition and per-field summaries of the indexed events,
+/// which allow for ruling out partitions of a query before asking their
+/// indexes. Fields of arithmetic and time types carry their minimum and
+/// maximum, strings and addresses a Bloom filter, and ports the set of port
+/// numbers and protocols. Other fields and operators that the synopses cannot
+/// decide never rule out a partition.
+///
+/// A partition may hold as many distinct values per field as it holds
+/// events, but most fields have far fewer. Bloom filters therefore start out
+/// small, grow with the number of distinct values, and shrink to the observed
+/// number of distinct values once the partition gets sealed.
+class meta_index {
+public:
+  /// Adds a batch of events to the synopses of a partition.
+  /// @param partition The partition that indexes *events*.
+  /// @param events The events to add.
+  void add(uuid const& partition, std::vector<event> const& events);
+
+  /// Shrinks the synopses of a partition that receives no more events.
+  /// @param partition The partition to seal.
+  void seal(uuid const& partition);
+
+  /// Retrieves the partitions that may contain events satisfying an
+  /// expression.
+  /// @param expr The expression to look up.
+  /// @returns The candidate partitions for *expr*.
+  /// @pre *expr* is normalized and validated.
+  std::vector<uuid> lookup(expression const& expr) const;
+
+  /// Retrieves the synopses of a partition.
+  /// @param partition The partition to look for.
+  /// @returns A pointer to the synopses of *partition* or `nullptr`.
+  partition_synopsis const* find(uuid const& partition) const;
+
+  template <class Inspector>
+  friend auto inspect(Inspector& f, meta_index& x) {
+    return f(x.partitions_);
+  }
+
+private:
+  static optional<synopsis> make_synopsis(type const& t);
+
+  std::unordered_map<uuid, partition_synopsis> partitions_;
+};
+
+} // namespace vast
+
+#endif
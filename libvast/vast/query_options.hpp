@@ -9,7 +9,8 @@ namespace vast {
 enum class query_options : uint32_t {
   none = 0x00,
   historical = 0x01,
-  continuous = 0x02
+  continuous = 0x02,
+  low_priority = 0x04
 };
 
 /// Concatenates two query options.
@@ -23,6 +24,7 @@ constexpr query_options no_query_options = query_options::none;
 constexpr query_options historical = query_options::historical;
 constexpr query_options continuous = query_options::continuous;
 constexpr query_options unified = historical + continuous;
+constexpr query_options low_priority = query_options::low_priority;
 
 constexpr bool has_query_option(query_options haystack, query_options needle) {
   return (static_cast<uint32_t>(haystack) & static_cast<uint32_t>(needle)) != 0;
@@ -41,6 +43,10 @@ constexpr bool has_unified_option(query_options opts) {
          && has_query_option(opts, continuous);
 }
 
+constexpr bool has_low_priority_option(query_options opts) {
+  return has_query_option(opts, low_priority);
+}
+
 } // namespace vast
 
 #endif
@@ -19,9 +19,16 @@
 namespace vast {
 
 /// Serializes a sequence of objects into a streambuffer.
+/// @tparam Method The compression method.
+/// @tparam BlockSize The size of a compressed block. Larger blocks improve
+///                   the compression ratio of large objects.
+/// @tparam Threads The number of blocks to compress in parallel, where 0
+///                 means one per hardware thread.
 /// @see load
 template <
   compression Method = compression::null,
+  size_t BlockSize = detail::compressedbuf::default_block_size,
+  size_t Threads = 1,
   class Streambuf,
   class T,
   class... Ts
@@ -33,7 +40,8 @@ auto save(Streambuf& streambuf, T&& x, Ts&&... xs)
       caf::stream_serializer<Streambuf&> s{streambuf};
       detail::write(s, std::forward<T>(x), std::forward<Ts>(xs)...);
     } else {
-      detail::compressedbuf compressed{streambuf, Method};
+      detail::compressedbuf compressed{streambuf, Method, BlockSize, 0,
+                                       nullptr, Threads};
       caf::stream_serializer<detail::compressedbuf&> s{compressed};
       detail::write(s, std::forward<T>(x), std::forward<Ts>(xs)...);
       compressed.pubsync();
@@ -46,18 +54,23 @@ auto save(Streambuf& streambuf, T&& x, Ts&&... xs)
 
 template <
   compression Method = compression::null,
+  size_t BlockSize = detail::compressedbuf::default_block_size,
+  size_t Threads = 1,
   class T,
   class... Ts
 >
 expected<void> save(std::ostream& os, T&& x, Ts&&... xs) {
   auto sb = os.rdbuf();
-  return save<Method>(*sb, std::forward<T>(x), std::forward<Ts>(xs)...);
+  return save<Method, BlockSize, Threads>(*sb, std::forward<T>(x),
+                                          std::forward<Ts>(xs)...);
 }
 
 /// Serializes a sequence of objects into a container of bytes.
 /// @see load
 template <
   compression Method = compression::null,
+  size_t BlockSize = detail::compressedbuf::default_block_size,
+  size_t Threads = 1,
   class Container,
   class T,
   class... Ts
@@ -68,13 +81,16 @@ auto save(Container& container, T&& x, Ts&&... xs)
   expected<void>
 > {
   caf::containerbuf<Container> sink{container};
-  return save<Method>(sink, std::forward<T>(x), std::forward<Ts>(xs)...);
+  return save<Method, BlockSize, Threads>(sink, std::forward<T>(x),
+                                          std::forward<Ts>(xs)...);
 }
 
 /// Serializes a sequence of objects into a file.
 /// @see load
 template <
   compression Method = compression::null,
+  size_t BlockSize = detail::compressedbuf::default_block_size,
+  size_t Threads = 1,
   class T,
   class... Ts
 >
@@ -82,7 +98,8 @@ expected<void> save(path const& p, T&& x, Ts&&... xs) {
   std::ofstream fs{p.str()};
   if (!fs)
     return make_error(ec::filesystem_error, "failed to create filestream", p);
-  return save<Method>(*fs.rdbuf(), std::forward<T>(x), std::forward<Ts>(xs)...);
+  return save<Method, BlockSize, Threads>(*fs.rdbuf(), std::forward<T>(x),
+                                          std::forward<Ts>(xs)...);
 }
 
 } // namespace vast
@@ -1,7 +1,11 @@
 #ifndef VAST_SYSTEM_ARCHIVE_HPP
 #define VAST_SYSTEM_ARCHIVE_HPP
 
+#include <deque>
 #include <map>
+#include <memory>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include <caf/all.hpp>
@@ -9,10 +13,13 @@
 #include "vast/aliases.hpp"
 #include "vast/batch.hpp"
 #include "vast/detail/cache.hpp"
+#include "vast/detail/mmapbuf.hpp"
 #include "vast/detail/range_map.hpp"
 #include "vast/die.hpp"
 #include "vast/event.hpp"
 #include "vast/filesystem.hpp"
+#include "vast/optional.hpp"
+#include "vast/time.hpp"
 #include "vast/uuid.hpp"
 #include "vast/compression.hpp"
 
@@ -23,41 +30,213 @@ namespace vast {
 namespace system {
 
 /// A sequence of batches.
+///
+/// A segment lives either in memory, in which case it owns its batches, or
+/// it has been written to a file which gets memory-mapped upon opening. The
+/// file has the following layout:
+///
+///     +-------+---------+----+-------+-------+--------------+-----------+--...--+
+///     | magic | version | id | bytes | types | dictionaries | directory | batches |
+///     +-------+---------+----+-------+-------+--------------+-----------+--...--+
+///
+/// The segment stores each distinct type once in its type dictionary. The
+/// directory contains one entry per batch with its ID range, the location of
+/// the serialized batch relative to the end of the directory, and the
+/// dictionary positions of the types in the batch's type table. Batches
+/// themselves thus carry no type definitions. Each directory entry also
+/// records the time interval of the events in its batch, which allows for
+/// skipping batches during time-restricted lookups.
+///
+/// Batches may be compressed with a dictionary of sample data, typically one
+/// per event type. The segment stores each distinct compression dictionary
+/// once, and the directory entry of a batch refers to the one it needs.
+///
+/// Opening a segment only reads the header, and extraction deserializes only
+/// those batches that intersect with the query directly from the mapped
+/// region.
 class segment {
 public:
   using magic_type = uint32_t;
   using version_type = uint32_t;
 
   static constexpr magic_type magic = 0x2a2a2a2a;
-  static constexpr version_type version = 1;
+  static constexpr version_type version = 8;
 
-  void add(batch&& b);
+  /// Describes the location of a batch within a segment.
+  struct entry {
+    event_id first;     ///< The ID of the first event in the batch.
+    event_id last;      ///< The ID one past the last event in the batch.
+    timestamp earliest; ///< The timestamp of the earliest event.
+    timestamp latest;   ///< The timestamp of the latest event.
+    uint64_t offset;    ///< The byte offset of the serialized batch.
+    uint64_t size;      ///< The size of the serialized batch in bytes.
+    std::vector<uint32_t> types; ///< The type table of the batch.
+    uint32_t dictionary; ///< One past the compression dictionary, 0 for none.
 
-  expected<std::vector<event>> extract(bitmap const& bm) const;
+    template <class Inspector>
+    friend auto inspect(Inspector& f, entry& e) {
+      return f(e.first, e.last, e.earliest, e.latest, e.offset, e.size,
+               e.types, e.dictionary);
+    }
+  };
 
-  uuid const& id() const;
+  /// Opens a segment from a file by memory-mapping it.
+  /// @param filename The file containing the segment.
+  /// @returns The segment at *filename*.
+  static expected<segment> open(path const& filename);
 
-  template <class Inspector>
-  friend auto inspect(Inspector& f, segment& s) {
-    return f(s.batches_, s.bytes_, s.id_);
-  }
+  /// Appends a batch to the segment and moves its types into the segment's
+  /// type dictionary.
+  /// @param b The batch to add.
+  /// @param dictionary The compression dictionary of *b* or `nullptr` for
+  ///                   none.
+  /// @pre `b` has IDs assigned that do not overlap with existing batches and
+  ///      the segment has not been opened from a file.
+  void add(batch&& b, std::vector<char> const* dictionary = nullptr);
+
+  /// Writes the segment to a file.
+  /// @param filename The file to write the segment to.
+  /// @pre The segment has not been opened from a file.
+  expected<void> write(path const& filename) const;
+
+  /// Extracts all events for a set of IDs, optionally restricted to a time
+  /// interval. The segment does not touch batches outside the interval.
+  /// @param bm The IDs of the events to extract.
+  /// @param from The earliest timestamp of an extracted event.
+  /// @param to The latest timestamp of an extracted event.
+  /// @returns The events from *bm* that reside in this segment and have a
+  ///          timestamp in *[from, to]*.
+  expected<std::vector<event>>
+  extract(bitmap const& bm, timestamp from = timestamp::min(),
+          timestamp to = timestamp::max()) const;
+
+  /// Pages in the batches of a mapped segment that contain events for a set
+  /// of IDs, such that a subsequent extraction does not block on disk I/O.
+  /// This is a no-op for in-memory segments.
+  /// @param bm The IDs of the events to extract later.
+  void prefetch(bitmap const& bm) const;
+
+  uuid const& id() const;
 
   friend uint64_t bytes(segment const& s);
 
+  /// Computes the number of bytes of a segment that reside in memory. For an
+  /// in-memory segment, these are all of its bytes. For a mapped segment,
+  /// these are its header and the batches it has extracted from so far.
+  friend uint64_t resident(segment const& s);
+
 private:
-  // TODO: use a vector & binary_search for O(1) append and O(log N) search.
-  std::map<event_id, batch> batches_;
+  // Deserializes the batch at a given position from the mapped file.
+  expected<batch> load_batch(size_t i) const;
+
+  // Each distinct type of all batches, referenced from the directory.
+  std::vector<type> types_;
+  // Maps types to their position in the dictionary while adding batches.
+  std::unordered_map<type, uint32_t> type_ids_;
+  // Each distinct compression dictionary of all batches.
+  std::vector<std::vector<char>> dictionaries_;
+  // Sorted by first event ID, one entry per batch.
+  std::vector<entry> directory_;
+  // The batches of an in-memory segment, parallel to the directory.
+  std::vector<batch> batches_;
+  // The mapped file of a segment opened from the filesystem.
+  std::unique_ptr<detail::mmapbuf> file_;
+  // The absolute offset of the first batch in the mapped file.
+  uint64_t base_ = 0;
+  // The batches of a mapped segment that we have deserialized at least once,
+  // parallel to the directory, and their size plus the size of the header.
+  mutable std::vector<bool> loaded_;
+  mutable uint64_t resident_ = 0;
   uint64_t bytes_ = 0;
   uuid id_ = uuid::random();
 };
 
+/// The time interval spanned by the events of a segment.
+struct time_bounds {
+  timestamp earliest = timestamp::max();
+  timestamp latest = timestamp::min();
+
+  template <class Inspector>
+  friend auto inspect(Inspector& f, time_bounds& b) {
+    return f(b.earliest, b.latest);
+  }
+};
+
+/// A change to the meta data of the ARCHIVE, as recorded in its journal.
+struct meta_delta {
+  uuid id;                                           ///< The new segment.
+  std::vector<std::pair<event_id, event_id>> ranges; ///< The IDs in *id*.
+  time_bounds bounds;                                ///< The times in *id*.
+  std::vector<uuid> replaced; ///< The segments that *id* supersedes.
+
+  template <class Inspector>
+  friend auto inspect(Inspector& f, meta_delta& x) {
+    return f(x.id, x.ranges, x.bounds, x.replaced);
+  }
+};
+
+/// A lookup that waits for batches still at a compressor.
+struct deferred_lookup {
+  bitmap ids;
+  timestamp from;
+  timestamp to;
+  caf::typed_response_promise<std::vector<event>> promise;
+  caf::actor sink; ///< If valid, the lookup streams its results here.
+};
+
+/// A batch under way at a compressor that has not yet been appended to the
+/// active segment.
+struct pending_batch {
+  event_id first;
+  event_id last;
+  std::vector<char> const* dictionary; ///< The compression dictionary.
+  optional<batch> sealed;
+  caf::typed_response_promise<ok_atom> promise; ///< Acknowledges the batch.
+};
+
 struct archive_state {
+  using flush_promise = caf::typed_response_promise<ok_atom>;
+  using batch_promise = caf::typed_response_promise<ok_atom>;
+  using lookup_promise = caf::typed_response_promise<std::vector<event>>;
+
   path dir;
   uint64_t max_segment_size;
   compression method;
+  int level = 0;
+  size_t block_size;
+  batch::layout layout;
+  bool train;
+  std::unordered_map<type, std::vector<char>> dictionaries;
   detail::range_map<event_id, uuid> segments;
+  std::unordered_map<uuid, time_bounds> bounds;
   detail::cache<uuid, segment> cache;
+  caf::actor prefetcher;
+  caf::actor compactor;
+  caf::actor writer;
+  // Segments handed to the WRITER that have not yet become durable.
+  std::unordered_map<uuid, std::shared_ptr<segment const>> unwritten;
+  // The number of journal records since the last meta data snapshot.
+  size_t journaled = 0;
+  bool compacting = false;
+  // Whether a segment became durable during the current compaction.
+  bool recompact = false;
+  // Segments that missed the cache recently but were not admitted into it.
+  std::deque<uuid> misses;
+  // Whether to admit segments into a full cache only on a repeated miss, so
+  // that a one-off scan does not push out hot segments.
+  bool admission = true;
+  uint64_t cache_hits = 0;
+  uint64_t cache_misses = 0;
+  uint64_t cache_evictions = 0;
   segment active;
+  std::vector<std::pair<event_id, event_id>> active_ranges;
+  std::vector<caf::actor> compressors;
+  size_t next_compressor = 0;
+  uint64_t next_sequence = 0;
+  std::map<uint64_t, pending_batch> pending;
+  std::vector<deferred_lookup> deferred_lookups;
+  std::vector<flush_promise> deferred_flushes;
+  bool shutting_down = false;
   accountant_type accountant;
   char const* name = "archive";
 };
@@ -65,21 +244,98 @@ struct archive_state {
 using archive_type = caf::typed_actor<
   caf::reacts_to<shutdown_atom>,
   caf::reacts_to<accountant_type>,
-  caf::reacts_to<std::vector<event>>,
+  caf::replies_to<std::vector<event>>::with<ok_atom>,
   caf::replies_to<flush_atom>::with<ok_atom>,
-  caf::replies_to<bitmap>::with<std::vector<event>>
+  caf::replies_to<bitmap>::with<std::vector<event>>,
+  caf::reacts_to<bitmap, caf::actor>,
+  caf::replies_to<bitmap, timestamp, timestamp>::with<std::vector<event>>,
+  caf::reacts_to<bitmap, timestamp, timestamp, caf::actor>,
+  caf::reacts_to<prefetch_atom, bitmap>
 >;
 
 /// The *ARCHIVE* stores raw events in the form of compressed batches and
 /// answers queries for specific bitmaps.
+///
+/// Serializing and compressing incoming events into batches happens at a pool
+/// of compressor actors, which lets ingestion scale with the number of cores.
+/// The ARCHIVE appends sealed batches strictly in the order in which their
+/// events arrived. Lookups only wait for outstanding batches if they ask for
+/// IDs that may reside in one of them. The ARCHIVE acknowledges each batch
+/// with an `ok_atom` once it resides in the active segment, which lets
+/// senders limit the number of batches under way. It reports the number of
+/// batches at the compressors as `archive.pending`.
+///
+/// A lookup with a bitmap alone yields all matching events in a single reply.
+/// A lookup with a bitmap and a sink actor instead streams the events of each
+/// candidate segment to the sink as soon as they are available, as
+/// `std::vector<event>`, and concludes with `(done_atom, uint64_t)` that
+/// carries the total number of shipped events, or with a `caf::error` if it
+/// fails to extract the events of a segment. This keeps memory bounded by
+/// a single segment and reduces the time to first result for broad queries.
+/// Both kinds of lookup also exist with an additional time interval
+/// *[from, to]* after the bitmap, which restricts the result to events with a
+/// timestamp in the interval. The ARCHIVE keeps the time bounds of every
+/// segment in its meta data and skips segments and batches outside the
+/// interval without loading them.
+///
+/// The ARCHIVE never blocks on disk writes. A full segment goes to a
+/// dedicated I/O thread, the WRITER, which writes it and appends a record of
+/// the corresponding meta data change to a journal. The WRITER syncs all
+/// writes that accumulated in its mailbox with a single group commit, and a
+/// flush request constitutes an explicit durability point: the ARCHIVE
+/// answers it once all previous segments and journal records reside on
+/// stable storage. Until then, lookups use the in-memory segments. On
+/// startup, the ARCHIVE loads the last meta data snapshot and replays the
+/// journal on top. The WRITER replaces the snapshot and truncates the journal
+/// only every so often.
+///
+/// Whenever the ARCHIVE writes a segment, a background thread looks for runs
+/// of adjacent undersized segments, e.g., due to frequent flushing, and merges
+/// them into a single segment. The ARCHIVE then journals the replacement, and
+/// the WRITER deletes the original segments once the record and the directory
+/// entry of the merged segment are durable. The WRITER reports each sync of
+/// the archive directory as `archive.sync.directory`, along with the number
+/// of segments it is about to delete, and the number of deleted segments as
+/// `archive.segments.removed`.
+///
+/// A dedicated I/O thread pages in the candidate segments of a lookup while
+/// the ARCHIVE extracts events from the preceding ones, or while the lookup
+/// waits for batches at the compressors. Clients can also send
+/// `(prefetch_atom, bitmap)` as a hint to warm up segments well before
+/// looking them up; the hint passes through the mailbox of the ARCHIVE and
+/// therefore gains nothing right before a lookup.
+///
+/// With LZ4 and training enabled, the ARCHIVE assembles a compression
+/// dictionary from the first events of each type it sees and compresses all
+/// subsequent batches whose first event has that type with the dictionary.
+/// This improves the ratio of small batches considerably. Each segment stores
+/// the dictionaries of its batches.
 /// @param self The actor handle.
 /// @param dir The root directory of the archive.
-/// @param capacity The number of segments to cache in memory.
+/// @param capacity The number of bytes of segments to cache in memory. A
+///                 mapped segment counts only with its header and the
+///                 batches that lookups have decoded.
 /// @param max_segment_size The maximum segment size in bytes.
-/// @pre `max_segment_size > 0`
+/// @param compressors The number of compressor actors. If 0, the ARCHIVE
+///                    compresses batches itself.
+/// @param method The compression method for batches.
+/// @param level The compression level. For LZ4, 0 selects the fast mode and 1
+///              to `lz4::max_level` select LZ4-HC.
+/// @param train Whether to compress batches with a dictionary of samples of
+///              their type. Only LZ4 supports dictionaries.
+/// @param block_size The size of a compressed block within a batch. Each
+///                   block is an entry point for lookups, so smaller blocks
+///                   make lookups cheaper and larger ones improve the
+///                   compression ratio.
+/// @param layout The layout of the events within a batch. The columnar layout
+///               usually compresses better, at the cost of decoding all
+///               columns of a block for a single event.
+/// @pre `max_segment_size > 0 && block_size > 0`
 archive_type::behavior_type
 archive(archive_type::stateful_pointer<archive_state> self, path dir,
-        size_t capacity, size_t max_segment_size);
+        size_t capacity, size_t max_segment_size, size_t compressors,
+        compression method, int level, bool train, size_t block_size,
+        batch::layout layout);
 
 } // namespace system
 } // namespace vast
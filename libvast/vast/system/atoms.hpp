@@ -46,6 +46,7 @@ using peer_atom = caf::atom_constant<caf::atom("peer")>;
 using persist_atom = caf::atom_constant<caf::atom("persist")>;
 using ping_atom = caf::atom_constant<caf::atom("ping")>;
 using pong_atom = caf::atom_constant<caf::atom("pong")>;
+using prefetch_atom = caf::atom_constant<caf::atom("prefetch")>;
 using progress_atom = caf::atom_constant<caf::atom("progress")>;
 using prompt_atom = caf::atom_constant<caf::atom("prompt")>;
 using publish_atom = caf::atom_constant<caf::atom("publish")>;
@@ -56,6 +57,7 @@ using request_atom = caf::atom_constant<caf::atom("request")>;
 using response_atom = caf::atom_constant<caf::atom("response")>;
 using run_atom = caf::atom_constant<caf::atom("run")>;
 using schema_atom = caf::atom_constant<caf::atom("schema")>;
+using seal_atom = caf::atom_constant<caf::atom("seal")>;
 using seed_atom = caf::atom_constant<caf::atom("seed")>;
 using set_atom = caf::atom_constant<caf::atom("set")>;
 using shutdown_atom = caf::atom_constant<caf::atom("shutdown")>;
@@ -0,0 +1,58 @@
+#ifndef VAST_SYSTEM_CONTINUOUS_QUERY_ENGINE_HPP
+#define VAST_SYSTEM_CONTINUOUS_QUERY_ENGINE_HPP
+
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "vast/bitmap.hpp"
+#include "vast/expression.hpp"
+
+namespace vast {
+
+class event;
+
+namespace system {
+
+/// Evaluates a set of standing queries over batches of freshly ingested
+/// events. The engine splits all queries into their predicates and evaluates
+/// each distinct predicate only once per event, no matter how many queries it
+/// occurs in. The hits of a query then follow from the hits of its
+/// predicates.
+class continuous_query_engine {
+public:
+  /// Registers a query.
+  /// @param expr The normalized query expression.
+  /// @returns `false` if *expr* is already registered.
+  bool add(expression const& expr);
+
+  /// Unregisters a query.
+  /// @param expr The query expression to remove.
+  /// @returns `false` if *expr* is not registered.
+  bool remove(expression const& expr);
+
+  /// @returns `true` iff there exists no registered query.
+  bool empty() const;
+
+  /// @returns The number of registered queries.
+  size_t size() const;
+
+  /// @returns The number of distinct predicates across all queries.
+  size_t predicates() const;
+
+  /// Evaluates all queries over a batch of events in a single pass.
+  /// @param events The events to evaluate, ordered by their IDs.
+  /// @returns The queries with at least one hit in *events*, together with
+  ///          their hits.
+  std::vector<std::pair<expression, bitmap>>
+  evaluate(std::vector<event> const& events) const;
+
+private:
+  std::map<expression, std::vector<predicate>> queries_;
+  std::map<predicate, size_t> predicates_;
+};
+
+} // namespace system
+} // namespace vast
+
+#endif
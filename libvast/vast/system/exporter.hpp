@@ -31,6 +31,10 @@ struct exporter_state {
   uint64_t requested = 0;
   bitmap hits;
   bitmap unprocessed;
+  // The number of archive lookups that have not yet concluded.
+  size_t lookups = 0;
+  // Whether the INDEX has delivered all hits.
+  bool index_done = false;
   std::unordered_map<type, expression> checkers;
   std::deque<event> candidates;
   std::vector<event> results;
@@ -41,7 +45,8 @@ struct exporter_state {
 
 /// The EXPORTER receives index hits, looks up the corresponding events in the
 /// archive, and performs a candidate check to select the resulting stream of
-/// matching events.
+/// matching events. If an archive lookup fails, the EXPORTER forwards the
+/// error to its sinks and terminates with it.
 /// @param self The actor handle.
 /// @param ast The AST of query.
 /// @param qos The query options.
@@ -1,13 +1,16 @@
 #ifndef VAST_SYSTEM_IMPORTER_HPP
 #define VAST_SYSTEM_IMPORTER_HPP
 
+#include <deque>
 #include <vector>
 
+#include <caf/response_promise.hpp>
 #include <caf/stateful_actor.hpp>
 
 #include "vast/aliases.hpp"
 #include "vast/event.hpp"
 
+#include "vast/system/accountant.hpp"
 #include "vast/system/archive.hpp"
 
 namespace vast {
@@ -16,15 +19,31 @@ namespace system {
 /// Receives chunks from SOURCEs, imbues them with an ID, and relays them to
 /// ARCHIVE and INDEX.
 struct importer_state {
+  /// The number of events that ARCHIVE or INDEX may have yet to acknowledge
+  /// before IMPORTER stops granting credit to SOURCEs.
+  static constexpr uint64_t max_in_flight = 1 << 18;
   caf::actor identifier;
   archive_type archive;
   caf::actor index;
+  accountant_type accountant;
   event_id got = 0;
   std::vector<event> batch;
+  uint64_t archive_in_flight = 0;
+  uint64_t index_in_flight = 0;
+  /// The SOURCEs waiting for credit, one per batch.
+  std::deque<caf::response_promise> stalled;
   const char* name = "importer";
 };
 
 /// Spawns an IMPORTER.
+///
+/// IMPORTER takes part in credit-based flow control of the ingestion path.
+/// ARCHIVE and INDEX acknowledge each batch with an `ok_atom` once they have
+/// processed it, and IMPORTER answers each batch of a SOURCE with an
+/// `ok_atom` once fewer than `importer_state::max_in_flight` events await
+/// acknowledgement at both of them. A SOURCE only ships a bounded number of
+/// unanswered batches, so that ingestion slows down to the rate of the
+/// slowest component instead of piling up batches in mailboxes.
 /// @param self The actor handle.
 caf::behavior importer(caf::stateful_actor<importer_state>* self);
 
@@ -1,15 +1,17 @@
 #ifndef VAST_INDEX_HPP
 #define VAST_INDEX_HPP
 
-#include <list>
 #include <map>
+#include <string>
 #include <unordered_map>
+#include <unordered_set>
 
 #include <caf/stateful_actor.hpp>
 
 #include "vast/bitmap.hpp"
 #include "vast/expression.hpp"
 #include "vast/filesystem.hpp"
+#include "vast/meta_index.hpp"
 #include "vast/uuid.hpp"
 #include "vast/schema.hpp"
 #include "vast/time.hpp"
@@ -18,15 +20,11 @@
 #include "vast/detail/flat_set.hpp"
 
 #include "vast/system/accountant.hpp"
+#include "vast/system/query_scheduler.hpp"
 
 namespace vast {
 namespace system {
 
-struct schedule_state {
-  uuid part;
-  detail::flat_set<expression> queries;
-};
-
 struct continuous_query_state {
   bitmap hits;
   caf::actor task;
@@ -36,6 +34,19 @@ struct historical_query_state {
   bitmap hits;
   caf::actor task;
   std::unordered_map<caf::actor_addr, uuid> parts;
+  query_scheduler::priority priority = query_scheduler::priority::interactive;
+  std::unordered_set<uuid> sealed;
+  std::unordered_set<uuid> coverage;
+};
+
+/// The result of a completed historical query. Because sealed partitions no
+/// longer change, the hits remain valid for all partitions in the coverage.
+/// Nothing invalidates a cached result, so a partition must remain immutable
+/// once it belongs to a coverage. Merging the batches of a partition keeps
+/// its events and hence qualifies.
+struct query_result {
+  bitmap hits;
+  std::unordered_set<uuid> coverage;
 };
 
 struct index_query_state {
@@ -48,24 +59,23 @@ struct index_partition_state {
   timestamp last_modified;
   vast::schema schema;
   uint64_t events = 0;
-  // Our poor-man's version of a "meta index". To be factored into a separate
-  // actor in the future.
-  timestamp from = timestamp::max();
-  timestamp to = timestamp::min();
 };
 
 template <class Inspector>
 auto inspect(Inspector& f, index_partition_state& s) {
-  return f(s.last_modified, s.schema, s.events, s.from, s.to);
+  return f(s.last_modified, s.schema, s.events);
 }
 
 struct index_state {
-  std::list<schedule_state> schedule;
+  std::unordered_map<uuid, detail::flat_set<expression>> running;
+  query_scheduler scheduler;
   std::map<expression, index_query_state> queries;
   std::unordered_map<uuid, index_partition_state> partitions;
+  meta_index meta;
   caf::actor active;
   uuid active_id;
   detail::cache<uuid, caf::actor, detail::mru> passive;
+  detail::cache<std::string, query_result> results;
   accountant_type accountant;
   path dir;
   char const* name = "index";
@@ -87,6 +97,34 @@ struct index_state {
 /// After receiving the DONE atom the sink will not receive any further hits.
 /// This sequence applies both to continuous and historical queries.
 ///
+/// The index keeps a ::meta_index with compact summaries of the events in
+/// each partition. A historical query only goes to the partitions whose
+/// summaries do not rule it out, so that selective queries need not load
+/// most partitions.
+///
+/// When replacing the active partition, the index seals it, upon which the
+/// partition merges the indexes of its batches. Passive partitions loaded from
+/// disk get sealed once they have no more outstanding queries, so that older
+/// partitions get merged in the background as well.
+///
+/// The active partition answers each batch of events with an `ok_atom` once
+/// it has indexed the batch, which provides backpressure to the sender.
+///
+/// Historical queries that need more passive partitions than fit into memory
+/// wait in a ::query_scheduler. Whenever a passive partition has no more
+/// outstanding queries, the index replaces it with the next partition from
+/// the scheduler and hands that partition all queries waiting for it. Queries
+/// with the `low_priority` option only get new partitions while no
+/// interactive query waits. The index reports the queue depth and the waiting
+/// time of queries to the accountant.
+///
+/// The index caches the hits of completed historical queries together with
+/// the sealed partitions that have answered them. Re-issuing a query starts
+/// from the cached hits and only evaluates the active partition and sealed
+/// partitions that the cached result does not cover yet. The cache uses the
+/// normalized query expression as key and never invalidates an entry, which
+/// requires that the events of a sealed partition never change.
+///
 /// @param dir The directory of the index.
 /// @param max_events The maximum number of events per partition.
 /// @param passive The maximum number of passive partitions in memory.
@@ -1,30 +1,66 @@
 #ifndef VAST_SYSTEM_INDEXER_HPP
 #define VAST_SYSTEM_INDEXER_HPP
 
+#include <memory>
 #include <unordered_map>
+#include <vector>
 
 #include <caf/stateful_actor.hpp>
 
+#include "vast/expected.hpp"
 #include "vast/filesystem.hpp"
+#include "vast/offset.hpp"
 #include "vast/type.hpp"
+#include "vast/value_index.hpp"
 
 namespace vast {
 namespace system {
 
+/// The value index of a single column of an event type, i.e., the aspect of
+/// an event that ends up in one index file.
+struct column_index {
+  /// Determines how to extract the value of a column from an event.
+  enum kind_type {
+    time_column,  ///< The event timestamp.
+    data_column,  ///< The data of a non-record event.
+    field_column  ///< A field of a record event.
+  };
+
+  kind_type kind;
+  offset field;
+  vast::type type;
+  path filename;
+  std::unique_ptr<value_index> idx;
+  value_index::size_type last_flush = 0;
+};
+
 struct event_indexer_state {
   path dir;
   type event_type;
-  std::unordered_map<path, caf::actor> indexers;
+  std::unordered_map<path, column_index> columns;
   const char* name = "event-indexer";
 };
 
-/// Indexes an event.
+/// Indexes the events of a single type. The indexer owns the value indexes of
+/// all columns and walks every batch once, column by column, instead of
+/// wrapping each value index into an actor of its own. An indexer with
+/// persistent state loads only the columns that a predicate needs.
 /// @param self The actor handle.
 /// @param dir The directory where to store the indexes in.
 /// @param type event_type The type of the event to index.
 caf::behavior event_indexer(caf::stateful_actor<event_indexer_state>* self,
                             path dir, type event_type);
 
+/// Merges the persistent indexes of several event indexers for the same type
+/// into a single set of indexes.
+/// @param inputs The directories of the event indexers, ordered by the event
+///               IDs they cover.
+/// @param output The directory where to write the merged indexes.
+/// @param event_type The type of the indexed events.
+/// @returns An error if loading, merging, or writing an index failed.
+expected<void> merge_indexes(std::vector<path> const& inputs,
+                             path const& output, type const& event_type);
+
 } // namespace system
 } // namespace vast
 
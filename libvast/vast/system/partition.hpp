@@ -2,17 +2,22 @@
 #define VAST_SYSTEM_PARTITION_HPP
 
 #include <map>
+#include <vector>
 
 #include <caf/actor.hpp>
+#include <caf/actor_addr.hpp>
+#include <caf/response_promise.hpp>
 
 #include "vast/aliases.hpp"
 #include "vast/bitmap.hpp"
 #include "vast/detail/flat_set.hpp"
 #include "vast/expression.hpp"
 #include "vast/filesystem.hpp"
+#include "vast/optional.hpp"
 #include "vast/schema.hpp"
 
 #include "vast/system/accountant.hpp"
+#include "vast/system/continuous_query_engine.hpp"
 
 namespace vast {
 namespace system {
@@ -27,22 +32,60 @@ struct predicate_state {
 struct partition_query_state {
   caf::actor task;
   bitmap hits;
+  /// The operands of a conjunction that still await dispatching, cheapest
+  /// first.
+  std::vector<expression> stages;
+  /// The operand currently being evaluated.
+  expression stage;
+  /// The predicates of the current operand with outstanding hits.
+  detail::flat_set<predicate> pending;
+  /// The conjunction of the hits of all evaluated operands.
+  optional<bitmap> mask;
 };
 
 struct partition_state {
-  caf::actor proxy;
+  continuous_query_engine continuous;
   accountant_type accountant;
   vast::schema schema;
   size_t pending_events = 0;
+  /// Acknowledges each batch once its indexing task completes.
+  std::map<caf::actor_addr, caf::response_promise> acks;
   std::multimap<event_id, caf::actor> indexers;
+  std::multimap<event_id, path> catalog;
+  std::vector<expression> deferred;
+  std::vector<expression const*> stalled;
+  bool sealed = false;
+  bool merging = false;
+  bool shutting_down = false;
   std::map<expression, partition_query_state> queries;
   std::map<predicate, predicate_state> predicates;
   const char* name = "partition";
 };
 
 /// A horizontal partition of the INDEX.
-/// For each event batch, PARTITION spawns one event indexer per
-/// type occurring in the batch and forwards to them the events.
+/// For each event batch, PARTITION splits the events by type in a single pass,
+/// spawns one event indexer per type, and forwards to each indexer only the
+/// events of its type. When opening
+/// an existing directory, PARTITION only records the persistent batches and
+/// their types, and loads the indexers of a type when it receives a predicate
+/// that applies to the type. Once sealed, PARTITION merges the indexes of all
+/// its batches into a single batch as soon as no query is in progress. The
+/// merge runs on a separate thread, during which PARTITION completes queries
+/// whose hits are in and defers the others.
+///
+/// PARTITION evaluates the operands of a conjunctive historical query one
+/// after another, in the order of their estimated lookup cost. Each operand
+/// only reaches the batches in which all previous operands have hits, where
+/// the value indexes evaluate it for these candidate events only. The query
+/// completes as soon as the intersection becomes empty.
+///
+/// PARTITION answers each batch with an `ok_atom` once all its events are
+/// indexed, and reports the number of events under way to the accountant as
+/// `partition.indexing.pending`. When a query makes it load INDEXERs from
+/// disk, it reports their number as `partition.indexers.loaded`.
+///
+/// PARTITION evaluates continuous queries directly on each incoming batch,
+/// before indexing it, and sends their hits to the sink.
 /// @param dir The directory where to store this partition on the file system.
 /// @param sink The actor receiving results of this partition.
 /// @pre `sink != invalid_actor`
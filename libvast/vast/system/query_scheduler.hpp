@@ -0,0 +1,87 @@
+#ifndef VAST_SYSTEM_QUERY_SCHEDULER_HPP
+#define VAST_SYSTEM_QUERY_SCHEDULER_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "vast/expression.hpp"
+#include "vast/optional.hpp"
+#include "vast/time.hpp"
+#include "vast/uuid.hpp"
+
+namespace vast {
+namespace system {
+
+/// Decides in which order INDEX loads the passive partitions that concurrent
+/// historical queries wait for. The scheduler serves interactive queries
+/// before batch queries and rotates among the queries of the same priority,
+/// so that a broad query cannot monopolize the slots for passive partitions.
+/// A partition goes out to all queries waiting for it at once.
+class query_scheduler {
+public:
+  using clock = std::chrono::steady_clock;
+
+  /// The scheduling class of a query.
+  enum class priority : uint8_t {
+    interactive,
+    batch
+  };
+
+  /// A partition to load, together with the queries waiting for it.
+  struct job {
+    uuid partition;
+    /// The waiting queries and how long each one has been waiting.
+    std::vector<std::pair<expression, timespan>> queries;
+  };
+
+  /// Lets a query wait for a partition.
+  /// @param part The partition to wait for.
+  /// @param expr The query.
+  /// @param prio The priority of *expr*, which applies only if the scheduler
+  ///             does not know *expr* yet.
+  /// @param now The current time.
+  void enqueue(uuid const& part, expression const& expr,
+               priority prio = priority::interactive,
+               clock::time_point now = clock::now());
+
+  /// Selects the next partition to load. The choice falls on the next pending
+  /// partition of the query with the highest priority that has been served
+  /// least recently.
+  /// @param now The current time.
+  /// @returns The next partition with all its waiting queries, or nothing if
+  ///          the scheduler is empty.
+  optional<job> next(clock::time_point now = clock::now());
+
+  /// Checks whether a query waits for at least one partition.
+  /// @param expr The query to check.
+  /// @returns `true` iff *expr* has pending partitions.
+  bool contains(expression const& expr) const;
+
+  /// @returns The number of queued pairs of partition and query.
+  size_t size() const;
+
+  /// @returns `true` iff no query waits for a partition.
+  bool empty() const;
+
+private:
+  struct query_state {
+    priority prio;
+    std::deque<uuid> parts;
+    uint64_t last_served;
+  };
+
+  std::map<expression, query_state> queries_;
+  std::unordered_map<uuid, std::map<expression, clock::time_point>> waiting_;
+  size_t size_ = 0;
+  uint64_t round_ = 0;
+};
+
+} // namespace system
+} // namespace vast
+
+#endif
@@ -39,7 +39,13 @@ struct Reader {
 template <class Reader>
 struct source_state {
   static constexpr size_t max_batch_size = 1 << 20;
+  /// The number of batches a source may ship before its sink has answered
+  /// any of them.
+  static constexpr uint64_t initial_credit = 4;
   uint64_t batch_size = 65536;
+  uint64_t credit = initial_credit;
+  bool stalled = false;
+  std::chrono::steady_clock::time_point stalled_since;
   std::vector<event> events;
   std::chrono::steady_clock::time_point start;
   accountant_type accountant;
@@ -47,7 +53,9 @@ struct source_state {
   Reader reader;
 };
 
-/// An event producer.
+/// An event producer. Each batch consumes one unit of credit, and the sink
+/// returns it by answering the batch with an `ok_atom`. Without credit, the
+/// source stops reading until the sink catches up.
 /// @tparam Reader The concrete source implementation.
 /// @param self The actor handle.
 /// @param reader The reader instance.
@@ -115,6 +123,13 @@ source(caf::stateful_actor<source_state<Reader>>* self, Reader&& reader) {
         self->quit(make_error(ec::unspecified, "no sink"));
         return;
       }
+      // Wait for the sink to return credit before producing more events.
+      if (self->state.credit == 0) {
+        VAST_DEBUG(self, "waits for credit from sink");
+        self->state.stalled = true;
+        self->state.stalled_since = steady_clock::now();
+        return;
+      }
       // Extract events until the source has exhausted its input or until we
       // have completed a batch.
       //
@@ -154,7 +169,27 @@ source(caf::stateful_actor<source_state<Reader>>* self, Reader&& reader) {
           self->send(self->state.accountant, "source.batch.events", events);
           self->send(self->state.accountant, "source.batch.rate", rate);
         }
-        self->send(self->state.sink, std::move(self->state.events));
+        --self->state.credit;
+        self->request(self->state.sink, caf::infinite,
+                      std::move(self->state.events)).then(
+          [=](ok_atom) {
+            ++self->state.credit;
+            if (!self->state.stalled)
+              return;
+            auto wait = steady_clock::now() - self->state.stalled_since;
+            VAST_DEBUG(self, "got credit after", wait);
+            if (self->state.accountant)
+              self->send(self->state.accountant, "source.credit.wait",
+                         duration_cast<timespan>(wait));
+            self->state.stalled = false;
+            self->send(self, run_atom::value);
+          },
+          [=](caf::error& e) {
+            VAST_ERROR(self, "failed to ship events:",
+                       self->system().render(e));
+            self->quit(std::move(e));
+          }
+        );
         self->state.events = {};
         self->state.events.reserve(self->state.batch_size);
         // FIXME: if we do not give the stdlib implementation a hint to yield
@@ -50,10 +50,24 @@ public:
   /// @returns The result of the lookup or an error upon failure.
   expected<bitmap> lookup(relational_operator op, data const& x) const;
 
-  /// Merges another value index with this one.
+  /// Looks up data under a relational operator, restricted to a set of
+  /// candidate IDs. Indexes that combine several bitmaps per lookup evaluate
+  /// them only over the candidates, so that the cost of a lookup follows the
+  /// number of candidates rather than the size of the index.
+  /// @param op The relation operator.
+  /// @param x The value to lookup.
+  /// @param candidates The IDs to consider.
+  /// @returns The result of the lookup, which has the same size as the index
+  ///          but no 1-bits outside *candidates*, or an error upon failure.
+  expected<bitmap> lookup(relational_operator op, data const& x,
+                          bitmap const& candidates) const;
+
+  /// Merges another value index of the same type with this one. Both indexes
+  /// must cover the same ID space, e.g., two consecutive batches of a
+  /// partition, such that all IDs in *other* come after ::offset.
   /// @param other The value index to merge.
-  /// @returns `true` on success.
-  //bool merge(value_index const& other);
+  /// @returns An error if the indexes are incompatible or overlap.
+  expected<void> merge(value_index const& other);
 
   /// Retrieves the ID of the last ::push_back operation.
   /// @returns The largest ID in the index.
@@ -73,6 +87,15 @@ private:
   virtual expected<bitmap>
   lookup_impl(relational_operator op, data const& x) const = 0;
 
+  /// Performs a restricted lookup. The default implementation restricts the
+  /// result of an unrestricted lookup.
+  /// @pre `!all<0>(candidates)`
+  virtual expected<bitmap>
+  masked_lookup_impl(relational_operator op, data const& x,
+                     bitmap const& candidates) const;
+
+  virtual bool merge_impl(value_index const& other) = 0;
+
   size_type nils_ = 0;
   ewah_bitmap mask_;
   ewah_bitmap none_;
@@ -164,8 +187,9 @@ private:
   };
 
   struct searcher {
-    searcher(bitmap_index_type const& idx, relational_operator op)
-      : bmi_{idx}, op_{op} {
+    searcher(bitmap_index_type const& idx, relational_operator op,
+             bitmap const* candidates = nullptr)
+      : bmi_{idx}, op_{op}, candidates_{candidates} {
     }
 
     template <class U>
@@ -178,14 +202,14 @@ private:
       // Boolean indexes support only equality
       if (!(op_ == equal || op_ == not_equal))
         return make_error(ec::unsupported_operator, op_);
-      return bmi_.lookup(op_, x);
+      return lookup(x);
     }
 
     template <class U>
     auto operator()(U x) const
     -> std::enable_if_t<std::is_arithmetic<U>{}, expected<bitmap>> {
       // No operator constraint on arithmetic type.
-      return bmi_.lookup(op_, x);
+      return lookup(x);
     }
 
     expected<bitmap> operator()(timestamp x) const {
@@ -196,8 +220,16 @@ private:
       return (*this)(x.count());
     }
 
+    template <class U>
+    bitmap lookup(U x) const {
+      if (candidates_)
+        return bmi_.lookup(op_, x, *candidates_);
+      return bmi_.lookup(op_, x);
+    }
+
     bitmap_index_type const& bmi_;
     relational_operator op_;
+    bitmap const* candidates_;
   };
 
   bool push_back_impl(data const& x, size_type skip) override {
@@ -209,6 +241,20 @@ private:
     return visit(searcher{bmi_, op}, x);
   };
 
+  expected<bitmap>
+  masked_lookup_impl(relational_operator op, data const& x,
+                     bitmap const& candidates) const override {
+    return visit(searcher{bmi_, op, &candidates}, x);
+  }
+
+  bool merge_impl(value_index const& other) override {
+    auto x = dynamic_cast<arithmetic_index const*>(&other);
+    if (!x)
+      return false;
+    bmi_.merge(x->bmi_);
+    return true;
+  }
+
   bitmap_index_type bmi_;
 };
 
@@ -240,6 +286,12 @@ private:
   expected<bitmap>
   lookup_impl(relational_operator op, data const& x) const override;
 
+  expected<bitmap>
+  masked_lookup_impl(relational_operator op, data const& x,
+                     bitmap const& candidates) const override;
+
+  bool merge_impl(value_index const& other) override;
+
   size_t max_length_;
   length_bitmap_index length_;
   std::vector<char_bitmap_index> chars_;
@@ -266,6 +318,12 @@ private:
   expected<bitmap>
   lookup_impl(relational_operator op, data const& x) const override;
 
+  expected<bitmap>
+  masked_lookup_impl(relational_operator op, data const& x,
+                     bitmap const& candidates) const override;
+
+  bool merge_impl(value_index const& other) override;
+
   std::array<byte_index, 16> bytes_;
   type_index v4_;
 };
@@ -290,6 +348,8 @@ private:
   expected<bitmap>
   lookup_impl(relational_operator op, data const& x) const override;
 
+  bool merge_impl(value_index const& other) override;
+
   address_index network_;
   prefix_index length_;
 };
@@ -324,6 +384,12 @@ private:
   expected<bitmap>
   lookup_impl(relational_operator op, data const& x) const override;
 
+  expected<bitmap>
+  masked_lookup_impl(relational_operator op, data const& x,
+                     bitmap const& candidates) const override;
+
+  bool merge_impl(value_index const& other) override;
+
   number_index num_;
   protocol_index proto_;
 };
@@ -374,6 +440,12 @@ private:
   expected<bitmap>
   lookup_impl(relational_operator op, data const& x) const override;
 
+  expected<bitmap>
+  masked_lookup_impl(relational_operator op, data const& x,
+                     bitmap const& candidates) const override;
+
+  bool merge_impl(value_index const& other) override;
+
   std::vector<std::unique_ptr<value_index>> elements_;
   size_bitmap_index size_;
   size_t max_size_;